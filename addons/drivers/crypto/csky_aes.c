@@ -24,23 +24,34 @@
 #include <linux/irq.h>
 #include <linux/of_device.h>
 #include <linux/crypto.h>
+#include <linux/debugfs.h>
 #include <crypto/algapi.h>
 #include <crypto/aes.h>
+#include <crypto/hash.h>
+#include <crypto/scatterwalk.h>
+#include <crypto/xts.h>
+#include <crypto/internal/aead.h>
+#include <crypto/internal/skcipher.h>
 #include "csky_aes.h"
-
-#define CSKY_AES_BUFFER_ORDER	2
-#define CSKY_AES_BUFFER_SIZE	(PAGE_SIZE << CSKY_AES_BUFFER_ORDER)
+#include "csky_engine.h"
 
 #define AES_FLAGS_ENC		BIT(0)
 #define AES_FLAGS_DEC		BIT(1)
 #define AES_FLAGS_ECB		BIT(2)
 #define AES_FLAGS_CBC		BIT(3)
+#define AES_FLAGS_CTR		BIT(4)
+#define AES_FLAGS_XTS		BIT(5)
+#define AES_FLAGS_GCM		BIT(6)
+#define AES_FLAGS_MODE_MASK	(AES_FLAGS_ENC | AES_FLAGS_DEC | \
+				 AES_FLAGS_ECB | AES_FLAGS_CBC | \
+				 AES_FLAGS_CTR | AES_FLAGS_XTS | AES_FLAGS_GCM)
 
 #define AES_FLAGS_INIT		BIT(8)
-#define AES_FLAGS_BUSY		BIT(9)
 
 #define CSKY_AES_QUEUE_LENGTH	10
 
+#define CSKY_AES_GCM_IV_SIZE	12
+
 #define SIZE_IN_WORDS(x)	(x>>2)
 
 #define HTOL(x)			((x & 0xff) << 24 | (x & 0xff00) << 8 | \
@@ -49,9 +60,9 @@
 struct csky_aes_dev;
 
 struct csky_aes_base_ctx {
-	struct csky_aes_dev *dd;
 	int keylen;
 	u32 key[AES_KEYSIZE_256 / sizeof(u32)];
+	u32 key_id;
 	u32 block_size;
 };
 
@@ -59,58 +70,66 @@ struct csky_aes_ctx {
 	struct csky_aes_base_ctx base;
 };
 
+struct csky_aes_xts_ctx {
+	struct csky_aes_base_ctx base;
+	u32 key2[AES_KEYSIZE_256 / sizeof(u32)];
+	u32 key2_id;
+};
+
+struct csky_aes_gcm_ctx {
+	struct csky_aes_base_ctx base;
+	struct crypto_cipher	*cipher;	/* only used to derive H */
+	struct crypto_shash	*ghash;
+};
+
 struct csky_aes_reqctx {
 	unsigned long	mode;
 };
 
+struct csky_aes_gcm_reqctx {
+	unsigned long		mode;
+	struct scatterlist	src[2];
+	struct scatterlist	dst[2];
+	struct shash_desc	ghash;		/* must be last */
+};
+
 struct csky_aes_dev {
-	struct list_head		list;
+	struct csky_engine		engine;
 	struct crypto_async_request	*areq;
 	struct csky_aes_base_ctx	*ctx;
 	struct device			*dev;
 	struct aes_reg __iomem		*reg_base;
-	struct tasklet_struct		done_task;
 
-	struct crypto_queue 		queue;
-	struct scatterlist 		*real_dst;
+	struct scatter_walk		in_walk;
+	struct scatter_walk		out_walk;
+	u8				*iv;
+	uint32_t			block[AES_BLOCK_SIZE / sizeof(u32)];
+	uint32_t			src_blk[AES_BLOCK_SIZE / sizeof(u32)];
+	__be32				ctr[AES_BLOCK_SIZE / sizeof(u32)];
+	uint32_t			tweak[AES_BLOCK_SIZE / sizeof(u32)];
+	uint32_t			ekj0[AES_BLOCK_SIZE / sizeof(u32)];
+	struct shash_desc		*ghash;
+
+	/* Key currently held by the engine, see csky_aes_load_key() */
+	u32				key_id;
+	bool				key_dec;
+	u64				key_hits;
+	u64				key_misses;
+	struct dentry			*debugfs;
+
 	unsigned long			flags;
-	spinlock_t			lock;
 	size_t				total;
-	size_t				datalen;
-	u32				*data;
-	size_t				buflen;
-	void				*buf;
-};
-
-struct csky_aes_drv {
-	struct list_head	dev_list;
-	spinlock_t		lock;
-};
-
-static struct csky_aes_drv csky_aes = {
-	.dev_list = LIST_HEAD_INIT(csky_aes.dev_list),
-	.lock	  = __SPIN_LOCK_UNLOCKED(csky_aes.lock),
+	size_t				assoclen;
+	size_t				cryptlen;
 };
 
-static struct csky_aes_dev *csky_aes_find_dev(struct csky_aes_base_ctx *ctx)
-{
-	struct csky_aes_dev *aes_dd = NULL;
-	struct csky_aes_dev *tmp;
+static struct csky_engine_class csky_aes_engines =
+	CSKY_ENGINE_CLASS_INIT(csky_aes_engines, "aes");
 
-	spin_lock_bh(&csky_aes.lock);
-	if (!ctx->dd) {
-		list_for_each_entry(tmp, &csky_aes.dev_list, list) {
-			aes_dd = tmp;
-			break;
-		}
-		ctx->dd = aes_dd;
-	} else {
-		aes_dd = ctx->dd;
-	}
-	spin_unlock_bh(&csky_aes.lock);
+/* Every setkey gets a fresh id; 0 means no key is loaded */
+static atomic_t csky_aes_key_gen = ATOMIC_INIT(0);
 
-	return aes_dd;
-}
+static struct dentry *csky_aes_debugfs_root;
 
 static inline void csky_aes_setopcode(struct csky_aes_dev *dd, uint32_t opr)
 {
@@ -203,12 +222,6 @@ static inline int csky_aes_check_int_status(struct csky_aes_dev *dd,
 	return (readl_relaxed(&dd->reg_base->state) & flag) ? 1 : 0;
 }
 
-static inline size_t csky_aes_padlen(size_t len, size_t block_size)
-{
-	len &= block_size - 1;
-	return len ? block_size - len : 0;
-}
-
 static inline void csky_aes_in_block(struct csky_aes_dev *dd, uint32_t *data)
 {
 	int i;
@@ -229,47 +242,239 @@ static inline void csky_aes_out_block(struct csky_aes_dev *dd, uint32_t *data)
 						- 1 - i]));
 }
 
+/*
+ * Move (up to) one block between a scatterlist and @buf. The walk keeps
+ * its position across calls, so a request of any length is streamed
+ * through the engine straight from the caller's pages without a bounce
+ * buffer.
+ */
+static inline void csky_aes_walk(struct scatter_walk *walk, void *buf,
+				 size_t len, int out, bool more)
+{
+	scatterwalk_copychunks(buf, walk, len, out);
+	scatterwalk_done(walk, out, more);
+}
+
+/* CTR and GCM only ever run the engine forwards to build a keystream */
+static inline bool csky_aes_engine_decrypts(struct csky_aes_dev *dd)
+{
+	return (dd->flags & AES_FLAGS_DEC) &&
+	       !(dd->flags & (AES_FLAGS_CTR | AES_FLAGS_GCM));
+}
+
+/* Multiply the XTS tweak by x in GF(2^128), little-endian convention */
+static void csky_aes_xts_next_tweak(u8 *t)
+{
+	u8 carry = t[AES_BLOCK_SIZE - 1] >> 7;
+	int i;
+
+	for (i = AES_BLOCK_SIZE - 1; i > 0; i--)
+		t[i] = (t[i] << 1) | (t[i - 1] >> 7);
+	t[0] = (t[0] << 1) ^ (carry ? 0x87 : 0);
+}
+
+static void csky_aes_gcm_ghash(struct csky_aes_dev *dd, const u8 *data,
+			       size_t len)
+{
+	u8 pad[AES_BLOCK_SIZE];
+
+	if (len < AES_BLOCK_SIZE) {
+		memset(pad, 0, sizeof(pad));
+		memcpy(pad, data, len);
+		data = pad;
+	}
+
+	crypto_shash_update(dd->ghash, data, AES_BLOCK_SIZE);
+}
+
+/* Build the engine input for the next block from the source data */
+static void csky_aes_load_block(struct csky_aes_dev *dd, size_t len,
+				bool more)
+{
+	u8 *src = (u8 *)dd->src_blk;
+	u8 *blk = (u8 *)dd->block;
+
+	csky_aes_walk(&dd->in_walk, src, len, 0, more);
+
+	if (dd->flags & (AES_FLAGS_CTR | AES_FLAGS_GCM)) {
+		memcpy(blk, dd->ctr, AES_BLOCK_SIZE);
+	} else if (dd->flags & AES_FLAGS_XTS) {
+		memcpy(blk, src, AES_BLOCK_SIZE);
+		crypto_xor(blk, (u8 *)dd->tweak, AES_BLOCK_SIZE);
+	} else {
+		memcpy(blk, src, AES_BLOCK_SIZE);
+	}
+}
+
+/* Turn the engine output into the result block and write it out */
+static void csky_aes_store_block(struct csky_aes_dev *dd, size_t len,
+				 bool more)
+{
+	u8 *src = (u8 *)dd->src_blk;
+	u8 *blk = (u8 *)dd->block;
+
+	if (dd->flags & AES_FLAGS_CTR) {
+		crypto_xor(blk, src, len);
+		crypto_inc((u8 *)dd->ctr, AES_BLOCK_SIZE);
+	} else if (dd->flags & AES_FLAGS_GCM) {
+		crypto_xor(blk, src, len);
+		crypto_inc((u8 *)dd->ctr + 12, 4);
+		csky_aes_gcm_ghash(dd, (dd->flags & AES_FLAGS_ENC) ? blk : src,
+				   len);
+	} else if (dd->flags & AES_FLAGS_XTS) {
+		crypto_xor(blk, (u8 *)dd->tweak, AES_BLOCK_SIZE);
+		csky_aes_xts_next_tweak((u8 *)dd->tweak);
+	}
+
+	csky_aes_walk(&dd->out_walk, blk, len, 1, more);
+}
+
+static void csky_aes_wait(struct csky_aes_dev *dd, uint32_t flag)
+{
+	while (csky_aes_check_int_status(dd, flag))
+		cpu_relax();
+}
+
 static inline int csky_aes_complete(struct csky_aes_dev *dd, int err)
 {
-	dd->flags &= ~AES_FLAGS_BUSY;
-	dd->areq->complete(dd->areq, err);
+	return csky_engine_complete(&dd->engine, err);
+}
 
-	tasklet_schedule(&dd->done_task);
+static void csky_aes_set_iv(struct csky_aes_dev *dd, const uint32_t *iv)
+{
+	int i;
 
-	return err;
+	for (i = 0; i < SIZE_IN_WORDS(AES_BLOCK_SIZE); i++) {
+		writel_relaxed(HTOL(iv[i]),
+			&dd->reg_base->iv[SIZE_IN_WORDS(AES_BLOCK_SIZE)
+					  - 1 - i]);
+	}
 }
 
-static int csky_aes_engine_op(struct csky_aes_dev *dd)
+static void csky_aes_write_key(struct csky_aes_dev *dd, const uint32_t *key,
+			       int keylen)
 {
-	int cbc_mode = dd->flags & AES_FLAGS_CBC;
 	int i;
+
+	for (i = 0; i < SIZE_IN_WORDS(keylen); i++)
+		writel_relaxed(HTOL(key[i]),
+			&dd->reg_base->key[SIZE_IN_WORDS(keylen) - 1 - i]);
+
+	csky_aes_set_key_length(dd, keylen);
+}
+
+/*
+ * Load @key unless the engine already holds it in the wanted direction.
+ * A decryption key is only usable after the engine has expanded it, so
+ * a key cached in one direction is a miss for the other. Returns true
+ * when the key registers were (re)written.
+ */
+static bool csky_aes_load_key(struct csky_aes_dev *dd, const uint32_t *key,
+			      u32 key_id, bool dec)
+{
+	if (key_id && dd->key_id == key_id && dd->key_dec == dec) {
+		dd->key_hits++;
+		return false;
+	}
+
+	dd->key_misses++;
+	csky_aes_write_key(dd, key, dd->ctx->keylen);
+	dd->key_id  = key_id;
+	dd->key_dec = dec;
+
+	return true;
+}
+
+/*
+ * Encrypt a single block and wait for it. Only used to derive the XTS
+ * tweak and the GCM E(J0) block, one block per request.
+ */
+static void csky_aes_encrypt_block(struct csky_aes_dev *dd,
+				   const uint32_t *key, u32 key_id,
+				   uint32_t *data)
+{
+	csky_aes_load_key(dd, key, key_id, false);
+	csky_aes_setopcode(dd, AES_OPC_ENC);
+	csky_aes_config_mode(dd, 0);
+
+	csky_aes_in_block(dd, data);
+	csky_aes_enable(dd);
+	while (csky_aes_check_int_status(dd, AES_IT_BUSY))
+		cpu_relax();
+	csky_aes_disable(dd);
+	csky_aes_out_block(dd, data);
+}
+
+static int csky_aes_gcm_finish(struct csky_aes_dev *dd)
+{
+	struct aead_request *req = aead_request_cast(dd->areq);
+	unsigned int authsize = crypto_aead_authsize(crypto_aead_reqtfm(req));
+	__be64 lengths[2];
+	u8 tag[AES_BLOCK_SIZE];
+	u8 *expected = (u8 *)dd->ekj0;
+
+	lengths[0] = cpu_to_be64((u64)dd->assoclen * 8);
+	lengths[1] = cpu_to_be64((u64)dd->cryptlen * 8);
+	crypto_shash_finup(dd->ghash, (u8 *)lengths, sizeof(lengths), tag);
+	crypto_xor(tag, (u8 *)dd->ekj0, AES_BLOCK_SIZE);
+
+	if (dd->flags & AES_FLAGS_ENC) {
+		scatterwalk_map_and_copy(tag, req->dst,
+					 dd->assoclen + dd->cryptlen,
+					 authsize, 1);
+		return 0;
+	}
+
+	scatterwalk_map_and_copy(expected, req->src,
+				 dd->assoclen + dd->cryptlen, authsize, 0);
+
+	return crypto_memneq(tag, expected, authsize) ? -EBADMSG : 0;
+}
+
+static int csky_aes_finish(struct csky_aes_dev *dd)
+{
 	int err = 0;
-	int len;
 
+	/* Hand the chaining value back so the caller can continue the stream */
+	if (dd->flags & AES_FLAGS_CBC)
+		memcpy(dd->iv,
+		       (dd->flags & AES_FLAGS_ENC) ? dd->block : dd->src_blk,
+		       AES_BLOCK_SIZE);
+	else if (dd->flags & AES_FLAGS_CTR)
+		memcpy(dd->iv, dd->ctr, AES_BLOCK_SIZE);
+	else if (dd->flags & AES_FLAGS_GCM)
+		err = csky_aes_gcm_finish(dd);
+
+	return csky_aes_complete(dd, err);
+}
+
+static int csky_aes_engine_op(struct csky_aes_dev *dd)
+{
+	int cbc_mode = dd->flags & AES_FLAGS_CBC;
+	size_t len;
+	bool more;
+
+	if (cbc_mode)
+		csky_aes_set_iv(dd, (uint32_t *)dd->iv);
 	csky_aes_config_mode(dd, cbc_mode);
-	for (i = 0; i < dd->datalen; i += AES_BLOCK_SIZE) {
-		csky_aes_in_block(dd, dd->data);
 
+	while (dd->total) {
+		len  = min_t(size_t, dd->total, AES_BLOCK_SIZE);
+		more = dd->total > AES_BLOCK_SIZE;
+
+		csky_aes_load_block(dd, len, more);
+		csky_aes_in_block(dd, dd->block);
 		csky_aes_enable(dd);
-		csky_aes_check_int_status(dd, AES_IT_BUSY);
+		csky_aes_wait(dd, AES_IT_BUSY);
 		csky_aes_disable(dd);
 
-		csky_aes_out_block(dd, dd->data);
-		dd->data += SIZE_IN_WORDS(AES_BLOCK_SIZE);
-	}
-
-	if (dd->flags & AES_FLAGS_ENC)
-		len = dd->datalen;
-	else if (dd->flags & AES_FLAGS_DEC)
-		len = dd->total;
-	else
-		return csky_aes_complete(dd, -EINVAL);
+		csky_aes_out_block(dd, dd->block);
+		csky_aes_store_block(dd, len, more);
 
-	if (!sg_copy_from_buffer(dd->real_dst, sg_nents(dd->real_dst),
-							dd->buf, len))
-		err = -EINVAL;
+		dd->total -= len;
+	}
 
-	return csky_aes_complete(dd, err);
+	return csky_aes_finish(dd);
 }
 
 static int csky_aes_start(struct csky_aes_dev *dd,
@@ -277,282 +482,539 @@ static int csky_aes_start(struct csky_aes_dev *dd,
 			  struct scatterlist *dst,
 			  size_t len)
 {
-	size_t padlen = csky_aes_padlen(len, AES_BLOCK_SIZE);
-
 	if (!(dd->flags & AES_FLAGS_INIT)) {
 		return -EACCES;
 	}
 
-	if (unlikely(len == 0))
+	if (unlikely(!(dd->flags & (AES_FLAGS_CTR | AES_FLAGS_GCM)) &&
+		     (len == 0 || (len & (AES_BLOCK_SIZE - 1)))))
 		return -EINVAL;
 
-	sg_copy_to_buffer(src, sg_nents(src), dd->buf, len);
-
-	dd->real_dst= dst;
-	dd->total   = len;
-	dd->datalen = len + padlen;
-	dd->data	= (u32 *)dd->buf;
+	scatterwalk_start(&dd->in_walk, src);
+	scatterwalk_start(&dd->out_walk, dst);
+	dd->total = len;
 
 	return 0;
 }
 
-static int csky_aes_set_key(struct csky_aes_dev *dd, const uint32_t *iv)
+static int csky_aes_set_key(struct csky_aes_dev *dd)
 {
-	int i;
-	uint32_t *key	= dd->ctx->key;
-	uint32_t  keylen = dd->ctx->keylen;
-
-	for (i = 0; i < SIZE_IN_WORDS(dd->ctx->keylen); i++)
-		writel_relaxed(HTOL(key[i]),
-			&dd->reg_base->key[SIZE_IN_WORDS(dd->ctx->keylen)
-					   - 1 - i]);
+	bool dec = csky_aes_engine_decrypts(dd);
 
-	csky_aes_set_key_length(dd, keylen);
+	if (!csky_aes_load_key(dd, dd->ctx->key, dd->ctx->key_id, dec)) {
+		csky_aes_setopcode(dd, dec ? AES_OPC_DEC : AES_OPC_ENC);
+		return 0;
+	}
 
-	if (dd->flags & AES_FLAGS_ENC)
+	if (!dec) {
 		csky_aes_setopcode(dd, AES_OPC_ENC);
-	else if (dd->flags & AES_FLAGS_DEC) {
+	} else {
 		csky_aes_setopcode(dd, AES_OPC_EXP);
 		csky_aes_enable(dd);
-		while (csky_aes_check_int_status(dd, AES_IT_KEYINT));
+		csky_aes_wait(dd, AES_IT_KEYINT);
 		csky_aes_disable(dd);
 		csky_aes_setopcode(dd, AES_OPC_DEC);
 	}
 
-	if (dd->flags & AES_FLAGS_CBC) {
-		for (i = 0; i < SIZE_IN_WORDS(AES_BLOCK_SIZE); i++) {
-			writel_relaxed(HTOL(iv[i]),
-				&dd->reg_base->iv[SIZE_IN_WORDS(AES_BLOCK_SIZE)
-						  - 1 - i]);
-		}
-	}
-
 	return 0;
 }
 
-static int csky_aes_handle(struct csky_aes_dev *dd)
+static int csky_aes_skcipher_start(struct csky_aes_dev *dd)
 {
-	struct ablkcipher_request *req = ablkcipher_request_cast(dd->areq);
-	struct csky_aes_reqctx	*rctx  = ablkcipher_request_ctx(req);
+	struct skcipher_request *req = skcipher_request_cast(dd->areq);
+	struct csky_aes_reqctx	*rctx = skcipher_request_ctx(req);
+	struct csky_aes_xts_ctx *xctx;
 	int ret;
 
-	dd->flags &= ~(AES_FLAGS_ECB | AES_FLAGS_CBC |
-				   AES_FLAGS_ENC | AES_FLAGS_DEC);
 	dd->flags |= rctx->mode;
 
-	csky_aes_init(dd);
-	ret = csky_aes_start(dd, req->src, req->dst, req->nbytes);
+	ret = csky_aes_start(dd, req->src, req->dst, req->cryptlen);
 	if (ret)
 		return ret;
 
-	ret = csky_aes_set_key(dd, req->info);
-	if (ret)
-		return ret;
+	dd->iv = req->iv;
+
+	if (dd->flags & AES_FLAGS_CTR) {
+		memcpy(dd->ctr, req->iv, AES_BLOCK_SIZE);
+	} else if (dd->flags & AES_FLAGS_XTS) {
+		xctx = container_of(dd->ctx, struct csky_aes_xts_ctx, base);
+		memcpy(dd->tweak, req->iv, AES_BLOCK_SIZE);
+		csky_aes_encrypt_block(dd, xctx->key2, xctx->key2_id,
+				       dd->tweak);
+	}
 
-	ret = csky_aes_engine_op(dd);
-	return ret;
+	return 0;
 }
 
-static int csky_aes_handle_queue(struct csky_aes_dev *dd,
-				 struct crypto_async_request *new_areq)
+static void csky_aes_gcm_hash_assoc(struct csky_aes_dev *dd,
+				    struct scatterlist *src,
+				    unsigned int assoclen)
 {
-	struct crypto_async_request *areq, *backlog;
-	struct csky_aes_base_ctx	*ctx;
-	unsigned long flags;
-	int ret = 0;
-
-	spin_lock_irqsave(&dd->lock, flags);
-	if (new_areq)
-		ret = crypto_enqueue_request(&dd->queue, new_areq);
-	if (dd->flags & AES_FLAGS_BUSY) {
-		spin_unlock_irqrestore(&dd->lock, flags);
-		return ret;
+	struct scatter_walk walk;
+	u8 buf[AES_BLOCK_SIZE];
+	size_t len;
+
+	scatterwalk_start(&walk, src);
+	while (assoclen) {
+		len = min_t(size_t, assoclen, AES_BLOCK_SIZE);
+		assoclen -= len;
+
+		csky_aes_walk(&walk, buf, len, 0, assoclen);
+		csky_aes_gcm_ghash(dd, buf, len);
 	}
-	backlog = crypto_get_backlog(&dd->queue);
-	areq 	= crypto_dequeue_request(&dd->queue);
-	if (areq)
-		dd->flags |= AES_FLAGS_BUSY;
-	spin_unlock_irqrestore(&dd->lock, flags);
+}
+
+static int csky_aes_gcm_start(struct csky_aes_dev *dd)
+{
+	struct aead_request *req = aead_request_cast(dd->areq);
+	struct csky_aes_gcm_reqctx *rctx = aead_request_ctx(req);
+	struct csky_aes_gcm_ctx *ctx;
+	unsigned int authsize = crypto_aead_authsize(crypto_aead_reqtfm(req));
+	struct scatterlist *src, *dst;
+	size_t cryptlen = req->cryptlen;
+	int ret;
 
-	if (!areq)
+	ctx = container_of(dd->ctx, struct csky_aes_gcm_ctx, base);
+	dd->flags |= rctx->mode;
+
+	if (dd->flags & AES_FLAGS_DEC) {
+		if (cryptlen < authsize)
+			return -EINVAL;
+		cryptlen -= authsize;
+	}
+
+	src = scatterwalk_ffwd(rctx->src, req->src, req->assoclen);
+	dst = (req->src == req->dst) ? src :
+	      scatterwalk_ffwd(rctx->dst, req->dst, req->assoclen);
+
+	ret = csky_aes_start(dd, src, dst, cryptlen);
+	if (ret)
 		return ret;
 
-	if (backlog)
-		backlog->complete(backlog, -EINPROGRESS);
+	dd->iv	     = req->iv;
+	dd->assoclen = req->assoclen;
+	dd->cryptlen = cryptlen;
+
+	/* J0 = IV || 0^31 || 1; data starts at inc32(J0) */
+	memcpy(dd->ctr, req->iv, CSKY_AES_GCM_IV_SIZE);
+	dd->ctr[3] = cpu_to_be32(1);
+	memcpy(dd->ekj0, dd->ctr, AES_BLOCK_SIZE);
+	csky_aes_encrypt_block(dd, ctx->base.key, ctx->base.key_id, dd->ekj0);
+	crypto_inc((u8 *)dd->ctr + 12, 4);
+
+	dd->ghash = &rctx->ghash;
+	dd->ghash->tfm = ctx->ghash;
+	dd->ghash->flags = 0;
+	crypto_shash_init(dd->ghash);
+	csky_aes_gcm_hash_assoc(dd, req->src, req->assoclen);
+
+	return 0;
+}
+
+static int csky_aes_handle(struct csky_aes_dev *dd)
+{
+	int ret;
+
+	dd->flags &= ~AES_FLAGS_MODE_MASK;
+
+	csky_aes_init(dd);
+	if (crypto_tfm_alg_type(dd->areq->tfm) == CRYPTO_ALG_TYPE_AEAD)
+		ret = csky_aes_gcm_start(dd);
+	else
+		ret = csky_aes_skcipher_start(dd);
+	if (ret)
+		return csky_aes_complete(dd, ret);
+
+	ret = csky_aes_set_key(dd);
+	if (ret)
+		return csky_aes_complete(dd, ret);
+
+	return csky_aes_engine_op(dd);
+}
+
+static int csky_aes_start_req(struct csky_engine *eng,
+			      struct crypto_async_request *areq)
+{
+	struct csky_aes_dev *dd = container_of(eng, struct csky_aes_dev,
+					       engine);
 
-	ctx		 = crypto_tfm_ctx(areq->tfm);
 	dd->areq = areq;
-	dd->ctx  = ctx;
+	dd->ctx  = crypto_tfm_ctx(areq->tfm);
 
 	return csky_aes_handle(dd);
 }
 
-static int csky_aes_crypt(struct ablkcipher_request *req, unsigned long mode)
+static const struct csky_engine_ops csky_aes_engine_ops = {
+	.start	= csky_aes_start_req,
+};
+
+static int csky_aes_crypt(struct skcipher_request *req, unsigned long mode)
 {
+	struct crypto_skcipher	 *tfm = crypto_skcipher_reqtfm(req);
 	struct csky_aes_base_ctx *ctx;
 	struct csky_aes_reqctx   *rctx;
-	struct csky_aes_dev		 *dd;
+	struct csky_engine	 *eng;
 
-	ctx = crypto_ablkcipher_ctx(crypto_ablkcipher_reqtfm(req));
+	ctx = crypto_skcipher_ctx(tfm);
 	if (!ctx)
 		return -ENOMEM;
-	dd  = csky_aes_find_dev(ctx);
-	if (!dd)
+	eng = csky_engine_select(&csky_aes_engines);
+	if (!eng)
 		return -ENODEV;
 
-	rctx		= ablkcipher_request_ctx(req);
+	if (!req->cryptlen)
+		return 0;
+
+	if (!(mode & AES_FLAGS_CTR) &&
+	    !IS_ALIGNED(req->cryptlen, AES_BLOCK_SIZE)) {
+		crypto_skcipher_set_flags(tfm, CRYPTO_TFM_RES_BAD_BLOCK_LEN);
+		return -EINVAL;
+	}
+
+	rctx		= skcipher_request_ctx(req);
 	rctx->mode  = mode;
 
-	if ((mode & AES_FLAGS_ECB) || (mode & AES_FLAGS_CBC))
-		ctx->block_size = AES_BLOCK_SIZE;
+	ctx->block_size = AES_BLOCK_SIZE;
 
-	return csky_aes_handle_queue(dd, &req->base);
+	return csky_engine_enqueue(eng, &req->base);
 }
 
-static int csky_aes_setkey(struct crypto_ablkcipher *tfm, const u8 *key,
-						   unsigned int keylen)
+static int csky_aes_setkey(struct crypto_skcipher *tfm, const u8 *key,
+			   unsigned int keylen)
 {
-	struct csky_aes_base_ctx *ctx = crypto_ablkcipher_ctx(tfm);
+	struct csky_aes_base_ctx *ctx = crypto_skcipher_ctx(tfm);
 
 	if (keylen != AES_KEYSIZE_128 &&
 		keylen != AES_KEYSIZE_192 &&
 		keylen != AES_KEYSIZE_256) {
-		crypto_ablkcipher_set_flags(tfm, CRYPTO_TFM_RES_BAD_KEY_LEN);
+		crypto_skcipher_set_flags(tfm, CRYPTO_TFM_RES_BAD_KEY_LEN);
 		return -EINVAL;
 	}
 
 	memcpy(ctx->key, key, keylen);
 	ctx->keylen = keylen;
+	ctx->key_id = atomic_inc_return(&csky_aes_key_gen);
 
 	return 0;
 }
 
-static int csky_aes_ecb_encrypt(struct ablkcipher_request *req)
+static int csky_aes_xts_setkey(struct crypto_skcipher *tfm, const u8 *key,
+			       unsigned int keylen)
+{
+	struct csky_aes_xts_ctx *ctx = crypto_skcipher_ctx(tfm);
+	int err;
+
+	err = xts_check_key(crypto_skcipher_tfm(tfm), key, keylen);
+	if (err)
+		return err;
+
+	err = csky_aes_setkey(tfm, key, keylen / 2);
+	if (err)
+		return err;
+
+	memcpy(ctx->key2, key + keylen / 2, keylen / 2);
+	ctx->key2_id = atomic_inc_return(&csky_aes_key_gen);
+
+	return 0;
+}
+
+static int csky_aes_ecb_encrypt(struct skcipher_request *req)
 {
 	return csky_aes_crypt(req, AES_FLAGS_ECB | AES_FLAGS_ENC);
 }
 
-static int csky_aes_ecb_decrypt(struct ablkcipher_request *req)
+static int csky_aes_ecb_decrypt(struct skcipher_request *req)
 {
 	return csky_aes_crypt(req, AES_FLAGS_ECB | AES_FLAGS_DEC);
 }
 
-static int csky_aes_cbc_encrypt(struct ablkcipher_request *req)
+static int csky_aes_cbc_encrypt(struct skcipher_request *req)
 {
 	return csky_aes_crypt(req, AES_FLAGS_CBC | AES_FLAGS_ENC);
 }
 
-static int csky_aes_cbc_decrypt(struct ablkcipher_request *req)
+static int csky_aes_cbc_decrypt(struct skcipher_request *req)
 {
 	return csky_aes_crypt(req, AES_FLAGS_CBC | AES_FLAGS_DEC);
 }
 
-static int csky_aes_cra_init(struct crypto_tfm *tfm)
+static int csky_aes_ctr_encrypt(struct skcipher_request *req)
+{
+	return csky_aes_crypt(req, AES_FLAGS_CTR | AES_FLAGS_ENC);
+}
+
+static int csky_aes_ctr_decrypt(struct skcipher_request *req)
 {
-	tfm->crt_ablkcipher.reqsize = sizeof(struct csky_aes_reqctx);
+	return csky_aes_crypt(req, AES_FLAGS_CTR | AES_FLAGS_DEC);
+}
 
-	return 0;
+static int csky_aes_xts_encrypt(struct skcipher_request *req)
+{
+	return csky_aes_crypt(req, AES_FLAGS_XTS | AES_FLAGS_ENC);
+}
+
+static int csky_aes_xts_decrypt(struct skcipher_request *req)
+{
+	return csky_aes_crypt(req, AES_FLAGS_XTS | AES_FLAGS_DEC);
 }
 
-static void csky_aes_cra_exit(struct crypto_tfm *tfm)
+static int csky_aes_init_tfm(struct crypto_skcipher *tfm)
 {
+	crypto_skcipher_set_reqsize(tfm, sizeof(struct csky_aes_reqctx));
 
+	return 0;
 }
 
-static struct crypto_alg csky_aes_algs[] = {
+static struct skcipher_alg csky_aes_algs[] = {
 	{
-		.cra_name		= "ecb(aes)",
-		.cra_driver_name	= "csky-ecb-aes",
-		.cra_priority		= 200,
-		.cra_flags 		= CRYPTO_ALG_TYPE_ABLKCIPHER | CRYPTO_ALG_ASYNC,
-		.cra_blocksize		= AES_BLOCK_SIZE,
-		.cra_ctxsize		= sizeof(struct csky_aes_ctx),
-		.cra_alignmask		= 0xf,
-		.cra_type		= &crypto_ablkcipher_type,
-		.cra_module		= THIS_MODULE,
-		.cra_init		= csky_aes_cra_init,
-		.cra_exit		= csky_aes_cra_exit,
-		.cra_u.ablkcipher	= {
-			.min_keysize	= AES_MIN_KEY_SIZE,
-			.max_keysize	= AES_MAX_KEY_SIZE,
-			.setkey		= csky_aes_setkey,
-			.encrypt	= csky_aes_ecb_encrypt,
-			.decrypt	= csky_aes_ecb_decrypt,
-		}
+		.base = {
+			.cra_name		= "ecb(aes)",
+			.cra_driver_name	= "csky-ecb-aes",
+			.cra_priority		= 200,
+			.cra_flags		= CRYPTO_ALG_ASYNC,
+			.cra_blocksize		= AES_BLOCK_SIZE,
+			.cra_ctxsize		= sizeof(struct csky_aes_ctx),
+			.cra_alignmask		= 0xf,
+			.cra_module		= THIS_MODULE,
+		},
+		.init		= csky_aes_init_tfm,
+		.min_keysize	= AES_MIN_KEY_SIZE,
+		.max_keysize	= AES_MAX_KEY_SIZE,
+		.setkey		= csky_aes_setkey,
+		.encrypt	= csky_aes_ecb_encrypt,
+		.decrypt	= csky_aes_ecb_decrypt,
 	},
 	{
-		.cra_name		= "cbc(aes)",
-		.cra_driver_name	= "csky-cbc-aes",
-		.cra_priority		= 200,
-		.cra_flags		= CRYPTO_ALG_TYPE_ABLKCIPHER | CRYPTO_ALG_ASYNC,
-		.cra_blocksize		= AES_BLOCK_SIZE,
-		.cra_ctxsize		= sizeof(struct csky_aes_ctx),
-		.cra_alignmask		= 0xf,
-		.cra_type		= &crypto_ablkcipher_type,
-		.cra_module		= THIS_MODULE,
-		.cra_init		= csky_aes_cra_init,
-		.cra_exit		= csky_aes_cra_exit,
-		.cra_u.ablkcipher	= {
-			.min_keysize	= AES_MIN_KEY_SIZE,
-			.max_keysize	= AES_MAX_KEY_SIZE,
-			.ivsize		= AES_BLOCK_SIZE,
-			.setkey		= csky_aes_setkey,
-			.encrypt	= csky_aes_cbc_encrypt,
-			.decrypt	= csky_aes_cbc_decrypt,
-		}
+		.base = {
+			.cra_name		= "cbc(aes)",
+			.cra_driver_name	= "csky-cbc-aes",
+			.cra_priority		= 200,
+			.cra_flags		= CRYPTO_ALG_ASYNC,
+			.cra_blocksize		= AES_BLOCK_SIZE,
+			.cra_ctxsize		= sizeof(struct csky_aes_ctx),
+			.cra_alignmask		= 0xf,
+			.cra_module		= THIS_MODULE,
+		},
+		.init		= csky_aes_init_tfm,
+		.min_keysize	= AES_MIN_KEY_SIZE,
+		.max_keysize	= AES_MAX_KEY_SIZE,
+		.ivsize		= AES_BLOCK_SIZE,
+		.setkey		= csky_aes_setkey,
+		.encrypt	= csky_aes_cbc_encrypt,
+		.decrypt	= csky_aes_cbc_decrypt,
+	},
+	{
+		.base = {
+			.cra_name		= "ctr(aes)",
+			.cra_driver_name	= "csky-ctr-aes",
+			.cra_priority		= 200,
+			.cra_flags		= CRYPTO_ALG_ASYNC,
+			.cra_blocksize		= 1,
+			.cra_ctxsize		= sizeof(struct csky_aes_ctx),
+			.cra_alignmask		= 0xf,
+			.cra_module		= THIS_MODULE,
+		},
+		.init		= csky_aes_init_tfm,
+		.min_keysize	= AES_MIN_KEY_SIZE,
+		.max_keysize	= AES_MAX_KEY_SIZE,
+		.ivsize		= AES_BLOCK_SIZE,
+		.chunksize	= AES_BLOCK_SIZE,
+		.setkey		= csky_aes_setkey,
+		.encrypt	= csky_aes_ctr_encrypt,
+		.decrypt	= csky_aes_ctr_decrypt,
+	},
+	{
+		.base = {
+			.cra_name		= "xts(aes)",
+			.cra_driver_name	= "csky-xts-aes",
+			.cra_priority		= 200,
+			.cra_flags		= CRYPTO_ALG_ASYNC,
+			.cra_blocksize		= AES_BLOCK_SIZE,
+			.cra_ctxsize		= sizeof(struct csky_aes_xts_ctx),
+			.cra_alignmask		= 0xf,
+			.cra_module		= THIS_MODULE,
+		},
+		.init		= csky_aes_init_tfm,
+		.min_keysize	= 2 * AES_MIN_KEY_SIZE,
+		.max_keysize	= 2 * AES_MAX_KEY_SIZE,
+		.ivsize		= AES_BLOCK_SIZE,
+		.setkey		= csky_aes_xts_setkey,
+		.encrypt	= csky_aes_xts_encrypt,
+		.decrypt	= csky_aes_xts_decrypt,
 	},
-
 };
 
-static int csky_aes_buff_init(struct csky_aes_dev *dd)
+static int csky_aes_gcm_crypt(struct aead_request *req, unsigned long mode)
 {
-	dd->buf		= (void *)__get_free_pages(GFP_KERNEL, CSKY_AES_BUFFER_ORDER);
-	dd->buflen	= CSKY_AES_BUFFER_SIZE;
-	dd->buflen &= ~(AES_BLOCK_SIZE - 1);
+	struct csky_aes_gcm_ctx	   *ctx;
+	struct csky_aes_gcm_reqctx *rctx;
+	struct csky_engine	   *eng;
 
-	if (!dd->buf) {
-		dev_err(dd->dev, "unable to alloc pages.\n");
-		return -ENOMEM;
+	ctx = crypto_aead_ctx(crypto_aead_reqtfm(req));
+	eng = csky_engine_select(&csky_aes_engines);
+	if (!eng)
+		return -ENODEV;
+
+	rctx	   = aead_request_ctx(req);
+	rctx->mode = AES_FLAGS_GCM | mode;
+
+	ctx->base.block_size = AES_BLOCK_SIZE;
+
+	return csky_engine_enqueue(eng, &req->base);
+}
+
+static int csky_aes_gcm_encrypt(struct aead_request *req)
+{
+	return csky_aes_gcm_crypt(req, AES_FLAGS_ENC);
+}
+
+static int csky_aes_gcm_decrypt(struct aead_request *req)
+{
+	return csky_aes_gcm_crypt(req, AES_FLAGS_DEC);
+}
+
+static int csky_aes_gcm_setkey(struct crypto_aead *tfm, const u8 *key,
+			       unsigned int keylen)
+{
+	struct csky_aes_gcm_ctx *ctx = crypto_aead_ctx(tfm);
+	u8 hash_key[AES_BLOCK_SIZE];
+	int err;
+
+	if (keylen != AES_KEYSIZE_128 &&
+		keylen != AES_KEYSIZE_192 &&
+		keylen != AES_KEYSIZE_256) {
+		crypto_aead_set_flags(tfm, CRYPTO_TFM_RES_BAD_KEY_LEN);
+		return -EINVAL;
 	}
 
-	return 0;
+	memcpy(ctx->base.key, key, keylen);
+	ctx->base.keylen = keylen;
+	ctx->base.key_id = atomic_inc_return(&csky_aes_key_gen);
+
+	/*
+	 * setkey runs outside the engine queue, so the GHASH key
+	 * H = E(K, 0^128) is derived with the software cipher.
+	 */
+	err = crypto_cipher_setkey(ctx->cipher, key, keylen);
+	if (err)
+		return err;
+
+	memset(hash_key, 0, sizeof(hash_key));
+	crypto_cipher_encrypt_one(ctx->cipher, hash_key, hash_key);
+	err = crypto_shash_setkey(ctx->ghash, hash_key, sizeof(hash_key));
+	memzero_explicit(hash_key, sizeof(hash_key));
+
+	return err;
 }
 
-static void csky_aes_buff_cleanup(struct csky_aes_dev *dd)
+static int csky_aes_gcm_setauthsize(struct crypto_aead *tfm,
+				    unsigned int authsize)
 {
-	if ((unsigned long)dd->buf)
-		free_pages((unsigned long)dd->buf, CSKY_AES_BUFFER_ORDER);
+	switch (authsize) {
+	case 4:
+	case 8:
+	case 12:
+	case 13:
+	case 14:
+	case 15:
+	case 16:
+		return 0;
+	default:
+		return -EINVAL;
+	}
 }
 
-static void csky_aes_done_task(unsigned long data)
+static int csky_aes_gcm_init_tfm(struct crypto_aead *tfm)
 {
-	struct csky_aes_dev *dd = (struct csky_aes_dev *)data;
+	struct csky_aes_gcm_ctx *ctx = crypto_aead_ctx(tfm);
+
+	ctx->cipher = crypto_alloc_cipher("aes", 0, 0);
+	if (IS_ERR(ctx->cipher))
+		return PTR_ERR(ctx->cipher);
+
+	ctx->ghash = crypto_alloc_shash("ghash", 0, 0);
+	if (IS_ERR(ctx->ghash)) {
+		crypto_free_cipher(ctx->cipher);
+		return PTR_ERR(ctx->ghash);
+	}
+
+	crypto_aead_set_reqsize(tfm, sizeof(struct csky_aes_gcm_reqctx) +
+				crypto_shash_descsize(ctx->ghash));
 
-	csky_aes_handle_queue(dd, NULL);
+	return 0;
 }
 
-static void csky_aes_unregister_algs(struct csky_aes_dev *dd)
+static void csky_aes_gcm_exit_tfm(struct crypto_aead *tfm)
 {
-	int i;
+	struct csky_aes_gcm_ctx *ctx = crypto_aead_ctx(tfm);
+
+	crypto_free_shash(ctx->ghash);
+	crypto_free_cipher(ctx->cipher);
+}
+
+static struct aead_alg csky_aes_gcm_alg = {
+	.base = {
+		.cra_name		= "gcm(aes)",
+		.cra_driver_name	= "csky-gcm-aes",
+		.cra_priority		= 200,
+		.cra_flags		= CRYPTO_ALG_ASYNC,
+		.cra_blocksize		= 1,
+		.cra_ctxsize		= sizeof(struct csky_aes_gcm_ctx),
+		.cra_alignmask		= 0xf,
+		.cra_module		= THIS_MODULE,
+	},
+	.init		= csky_aes_gcm_init_tfm,
+	.exit		= csky_aes_gcm_exit_tfm,
+	.setkey		= csky_aes_gcm_setkey,
+	.setauthsize	= csky_aes_gcm_setauthsize,
+	.encrypt	= csky_aes_gcm_encrypt,
+	.decrypt	= csky_aes_gcm_decrypt,
+	.ivsize		= CSKY_AES_GCM_IV_SIZE,
+	.maxauthsize	= AES_BLOCK_SIZE,
+};
 
-	for (i = 0; i < ARRAY_SIZE(csky_aes_algs); i++)
-		crypto_unregister_alg(&csky_aes_algs[i]);
+static void csky_aes_unregister_algs(struct csky_aes_dev *dd)
+{
+	crypto_unregister_aead(&csky_aes_gcm_alg);
+	crypto_unregister_skciphers(csky_aes_algs, ARRAY_SIZE(csky_aes_algs));
 }
 
 static int csky_aes_register_algs(struct csky_aes_dev *dd)
 {
-	int err, i, j;
+	int err;
 
-	for (i = 0; i < ARRAY_SIZE(csky_aes_algs); i++) {
-		err = crypto_register_alg(&csky_aes_algs[i]);
-		if (err) {
-			for (j = 0; j < i; j++)
-				crypto_unregister_alg(&csky_aes_algs[j]);
-			return err;
-		}
-	}
+	err = crypto_register_skciphers(csky_aes_algs,
+					ARRAY_SIZE(csky_aes_algs));
+	if (err)
+		return err;
 
-	return 0;
+	err = crypto_register_aead(&csky_aes_gcm_alg);
+	if (err)
+		crypto_unregister_skciphers(csky_aes_algs,
+					    ARRAY_SIZE(csky_aes_algs));
+
+	return err;
+}
+
+static void csky_aes_add_debugfs(struct csky_aes_dev *dd)
+{
+	if (!debugfs_initialized())
+		return;
+
+	if (!csky_aes_debugfs_root)
+		csky_aes_debugfs_root = debugfs_create_dir("csky_aes", NULL);
+	if (!csky_aes_debugfs_root)
+		return;
+
+	dd->debugfs = debugfs_create_dir(dev_name(dd->dev),
+					 csky_aes_debugfs_root);
+	if (!dd->debugfs)
+		return;
+
+	debugfs_create_u64("key_cache_hits", 0400, dd->debugfs,
+			   &dd->key_hits);
+	debugfs_create_u64("key_cache_misses", 0400, dd->debugfs,
+			   &dd->key_misses);
 }
 
 static int csky_aes_probe(struct platform_device *pdev)
@@ -573,12 +1035,8 @@ static int csky_aes_probe(struct platform_device *pdev)
 
 	platform_set_drvdata(pdev, aes_dd);
 
-	INIT_LIST_HEAD(&aes_dd->list);
-	spin_lock_init(&aes_dd->lock);
-
-	tasklet_init(&aes_dd->done_task, csky_aes_done_task, (unsigned long)aes_dd);
-
-	crypto_init_queue(&aes_dd->queue, CSKY_AES_QUEUE_LENGTH);
+	csky_engine_init(&aes_dd->engine, dev, &csky_aes_engine_ops,
+			 CSKY_AES_QUEUE_LENGTH);
 
 	aes_res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
 	if (!aes_res) {
@@ -592,28 +1050,22 @@ static int csky_aes_probe(struct platform_device *pdev)
 		goto res_err;
 	}
 
-	err = csky_aes_buff_init(aes_dd);
-	if (err)
-		goto res_err;
-
-	spin_lock(&csky_aes.lock);
-	list_add_tail(&aes_dd->list, &csky_aes.dev_list);
-	spin_unlock(&csky_aes.lock);
+	if (csky_engine_add(&csky_aes_engines, &aes_dd->engine) == 1) {
+		err = csky_aes_register_algs(aes_dd);
+		if (err)
+			goto err_algs;
+	}
 
-	err = csky_aes_register_algs(aes_dd);
-	if (err)
-		goto err_algs;
+	csky_aes_add_debugfs(aes_dd);
 
 	dev_info(dev, "CSKY AES Driver Initialized\n");
 
 	return 0;
 
 err_algs:
-	spin_lock(&csky_aes.lock);
-	list_del(&aes_dd->list);
-	spin_unlock(&csky_aes.lock);
+	csky_engine_del(&csky_aes_engines, &aes_dd->engine);
 res_err:
-	tasklet_kill(&aes_dd->done_task);
+	csky_engine_exit(&aes_dd->engine);
 aes_dd_err:
 
 	return err;
@@ -627,14 +1079,11 @@ static int csky_aes_remove(struct platform_device *pdev)
 	if (!aes_dd)
 		return -ENODEV;
 
-	spin_lock(&csky_aes.lock);
-	list_del(&aes_dd->list);
-	spin_unlock(&csky_aes.lock);
-
-	csky_aes_buff_cleanup(aes_dd);
+	debugfs_remove_recursive(aes_dd->debugfs);
 
-	tasklet_kill(&aes_dd->done_task);
-	csky_aes_unregister_algs(aes_dd);
+	if (!csky_engine_del(&csky_aes_engines, &aes_dd->engine))
+		csky_aes_unregister_algs(aes_dd);
+	csky_engine_exit(&aes_dd->engine);
 
 	return 0;
 }
@@ -25,6 +25,8 @@
 #include <linux/of_device.h>
 #include <linux/platform_device.h>
 #include <linux/delay.h>
+#include <linux/debugfs.h>
+#include <linux/ktime.h>
 #include <linux/crypto.h>
 #include <linux/cryptohash.h>
 #include <crypto/algapi.h>
@@ -32,6 +34,7 @@
 #include <crypto/internal/hash.h>
 #include <asm/unaligned.h>
 #include "csky_crc.h"
+#include "csky_crc_sw.h"
 
 #define CRC_CCRYPTO_QUEUE_LENGTH	5
 
@@ -45,6 +48,11 @@
 #define CRC_CRYPTO_STATE_FINALUPDATE	2
 #define CRC_CRYPTO_STATE_FINISH		3
 
+#define CRC_CALIBRATE_MAX		256
+#define CRC_CALIBRATE_LOOPS		16
+#define CRC_CALIBRATE_SEL		0x0	/* crc16_modbus */
+#define CRC_CALIBRATE_INIT		0xFFFF
+
 struct csky_crc_reqctx {
 	u32 dummy;
 };
@@ -60,6 +68,13 @@ struct csky_crypto_crc {
 	struct crypto_queue		queue;
 
 	u8				busy;
+
+	u32				sw_threshold;
+	u64				sw_reqs;
+	u64				sw_bytes;
+	u64				hw_reqs;
+	u64				hw_bytes;
+	struct dentry			*debugfs;
 };
 
 struct csky_crypto_crc_list {
@@ -72,6 +87,8 @@ static struct csky_crypto_crc_list crc_list = {
 	.lock	  = __SPIN_LOCK_UNLOCKED(crc_list.lock),
 };
 
+static struct dentry *csky_crc_debugfs_root;
+
 struct csky_crypto_crc_reqctx {
 	struct csky_crypto_crc *crc;
 
@@ -89,8 +106,24 @@ struct csky_crypto_crc_ctx {
 	u32	sel;
 	crc_mod_e mod;
 	crc_std_e std;
+
+	const struct csky_crc_sw_model *sw;
 };
 
+static struct csky_crypto_crc *csky_crypto_crc_find_dev(void)
+{
+	struct csky_crypto_crc *crc = NULL, *tmp;
+
+	spin_lock_bh(&crc_list.lock);
+	list_for_each_entry(tmp, &crc_list.dev_list, list) {
+		crc = tmp;
+		break;
+	}
+	spin_unlock_bh(&crc_list.lock);
+
+	return crc;
+}
+
 static struct scatterlist *sg_get(struct scatterlist *sg_list,
 				  unsigned int nents,
 				  unsigned int index)
@@ -119,15 +152,9 @@ static int csky_crypto_crc_init(struct ahash_request *req)
 	struct crypto_ahash *tfm = crypto_ahash_reqtfm(req);
 	struct csky_crypto_crc_ctx *crc_ctx = crypto_ahash_ctx(tfm);
 	struct csky_crypto_crc_reqctx *ctx  = ahash_request_ctx(req);
-	struct csky_crypto_crc *crc;
-
-	spin_lock_bh(&crc_list.lock);
-	list_for_each_entry(crc, &crc_list.dev_list, list) {
-		crc_ctx->crc = crc;
-		break;
-	}
-	spin_unlock_bh(&crc_list.lock);
+	struct csky_crypto_crc *crc = csky_crypto_crc_find_dev();
 
+	crc_ctx->crc	 = crc;
 	ctx->crc	 = crc;
 	ctx->bufnext_len = 0;
 	ctx->total	 = 0;
@@ -241,8 +268,11 @@ static int csky_crypto_crc_handle_queue(struct csky_crypto_crc *crc,
 	}
 	backlog   = crypto_get_backlog(&crc->queue);
 	async_req = crypto_dequeue_request(&crc->queue);
-	if (async_req)
+	if (async_req) {
 		crc->busy = 1;
+		crc->hw_reqs++;
+		crc->hw_bytes += ahash_request_cast(async_req)->nbytes;
+	}
 	spin_unlock_irqrestore(&crc->lock, flags);
 
 	if (!async_req)
@@ -277,6 +307,37 @@ static int csky_crypto_crc_handle_queue(struct csky_crypto_crc *crc,
 	return csky_crypto_crc_handle(crc);
 }
 
+/*
+ * A message shorter than sw_threshold is checksummed on the CPU: for a
+ * few bytes the table lookup is cheaper than programming the engine and
+ * going through the queue and the done tasklet.  Only whole messages are
+ * dispatched this way, a hash already fed to the engine stays there.
+ */
+static bool csky_crypto_crc_try_sw(struct ahash_request *req)
+{
+	struct crypto_ahash *tfm = crypto_ahash_reqtfm(req);
+	struct csky_crypto_crc_ctx *crc_ctx = crypto_ahash_ctx(tfm);
+	struct csky_crypto_crc *crc = crc_ctx->crc;
+	unsigned int i, ds = crypto_ahash_digestsize(tfm);
+	unsigned long flags;
+	u32 result;
+
+	if (!crc || !crc_ctx->sw || !req->nbytes ||
+	    req->nbytes >= crc->sw_threshold)
+		return false;
+
+	result = csky_crc_sw_digest_sg(crc_ctx->sw, req->src, req->nbytes);
+	for (i = 0; i < ds; i++)
+		req->result[i] = result >> (8 * i);
+
+	spin_lock_irqsave(&crc->lock, flags);
+	crc->sw_reqs++;
+	crc->sw_bytes += req->nbytes;
+	spin_unlock_irqrestore(&crc->lock, flags);
+
+	return true;
+}
+
 static int csky_crypto_crc_update(struct ahash_request *req)
 {
 	struct csky_crypto_crc_reqctx *ctx = ahash_request_ctx(req);
@@ -308,6 +369,9 @@ static int csky_crypto_crc_finup(struct ahash_request *req)
 
 	dev_dbg(ctx->crc->dev, "crc_finishupdate\n");
 
+	if (!ctx->total && csky_crypto_crc_try_sw(req))
+		return 0;
+
 	ctx->total += req->nbytes;
 	ctx->flag   = CRC_CRYPTO_STATE_FINALUPDATE;
 
@@ -318,6 +382,9 @@ static int csky_crypto_crc_digest(struct ahash_request *req)
 {
 	int ret;
 
+	if (csky_crypto_crc_try_sw(req))
+		return 0;
+
 	ret = csky_crypto_crc_init(req);
 	if (ret)
 		return ret;
@@ -329,31 +396,40 @@ static int csky_crypto_crc_cra_init(struct csky_crypto_crc_ctx *ctx)
 {
 	int ret = 0;
 
+	ctx->crc = csky_crypto_crc_find_dev();
+	ctx->sw	 = NULL;
+
 	if (ctx->mod == MOD_CRC16) {
 		switch (ctx->std) {
 		case STD_MODBUS:
 			ctx->sel = 0x0;
 			ctx->key = 0xFFFF;
+			ctx->sw  = csky_crc_sw_get(CRC_SW_16_MODBUS);
 			break;
 		case STD_IBM:
 			ctx->sel = 0x0;
 			ctx->key = 0x0;
+			ctx->sw  = csky_crc_sw_get(CRC_SW_16_ARC);
 			break;
 		case STD_MAXIM:
 			ctx->sel = 0x4;
 			ctx->key = 0x0;
+			ctx->sw  = csky_crc_sw_get(CRC_SW_16_MAXIM);
 			break;
 		case STD_USB:
 			ctx->sel = 0x4;
 			ctx->key = 0xFFFF;
+			ctx->sw  = csky_crc_sw_get(CRC_SW_16_USB);
 			break;
 		case STD_CCITT:
 			ctx->sel = 0x1;
 			ctx->key = 0x0;
+			ctx->sw  = csky_crc_sw_get(CRC_SW_16_KERMIT);
 			break;
 		case STD_X25:
 			ctx->sel = 0x5;
 			ctx->key = 0xFFFF;
+			ctx->sw  = csky_crc_sw_get(CRC_SW_16_X25);
 			break;
 		default:
 			ret = -EINVAL;
@@ -363,10 +439,12 @@ static int csky_crypto_crc_cra_init(struct csky_crypto_crc_ctx *ctx)
 		case STD_MAXIM:
 			ctx->sel = 0x2;
 			ctx->key = 0x0;
+			ctx->sw  = csky_crc_sw_get(CRC_SW_8_MAXIM);
 			break;
 		case STD_ROHC:
 			ctx->sel = 0x3;
 			ctx->key = 0xff;
+			ctx->sw  = csky_crc_sw_get(CRC_SW_8_ROHC);
 			break;
 		default:
 			ret = -EINVAL;
@@ -690,6 +768,67 @@ static void csky_crypto_crc_done_task(unsigned long data)
 	csky_crypto_crc_handle_queue(crc, NULL);
 }
 
+/*
+ * Find the message length from which the engine beats the software
+ * model.  Only the register traffic is timed, so the queueing overhead
+ * of a real request makes the threshold err on the side of the engine.
+ */
+static void csky_crypto_crc_calibrate(struct csky_crypto_crc *crc)
+{
+	const struct csky_crc_sw_model *sw = csky_crc_sw_get(CRC_SW_16_MODBUS);
+	u32 buf[CRC_CALIBRATE_MAX / CHKSUM_DIGEST_SIZE];
+	unsigned int len, i;
+	u64 t_hw, t_sw;
+
+	memset(buf, 0x5a, sizeof(buf));
+
+	for (len = CHKSUM_DIGEST_SIZE; len <= CRC_CALIBRATE_MAX; len <<= 1) {
+		t_hw = ktime_get_ns();
+		for (i = 0; i < CRC_CALIBRATE_LOOPS; i++) {
+			writel(CRC_CALIBRATE_SEL, &crc->regs->sel);
+			writel(CRC_CALIBRATE_INIT, &crc->regs->init);
+			writesl(&crc->regs->data, buf,
+				len / CHKSUM_DIGEST_SIZE);
+			readl(&crc->regs->data);
+		}
+		t_hw = ktime_get_ns() - t_hw;
+
+		t_sw = ktime_get_ns();
+		for (i = 0; i < CRC_CALIBRATE_LOOPS; i++)
+			csky_crc_sw_digest_buf(sw, buf, len);
+		t_sw = ktime_get_ns() - t_sw;
+
+		if (t_hw <= t_sw)
+			break;
+	}
+
+	crc->sw_threshold = len;
+	dev_info(crc->dev, "software CRC below %u bytes\n", len);
+}
+
+static void csky_crypto_crc_add_debugfs(struct csky_crypto_crc *crc)
+{
+	if (!debugfs_initialized())
+		return;
+
+	if (!csky_crc_debugfs_root)
+		csky_crc_debugfs_root = debugfs_create_dir("csky_crc", NULL);
+	if (!csky_crc_debugfs_root)
+		return;
+
+	crc->debugfs = debugfs_create_dir(dev_name(crc->dev),
+					  csky_crc_debugfs_root);
+	if (!crc->debugfs)
+		return;
+
+	debugfs_create_u32("sw_threshold", 0600, crc->debugfs,
+			   &crc->sw_threshold);
+	debugfs_create_u64("sw_requests", 0400, crc->debugfs, &crc->sw_reqs);
+	debugfs_create_u64("sw_bytes", 0400, crc->debugfs, &crc->sw_bytes);
+	debugfs_create_u64("hw_requests", 0400, crc->debugfs, &crc->hw_reqs);
+	debugfs_create_u64("hw_bytes", 0400, crc->debugfs, &crc->hw_bytes);
+}
+
 static int csky_crypto_crc_probe(struct platform_device *pdev)
 {
 	struct device *dev = &pdev->dev;
@@ -724,6 +863,10 @@ static int csky_crypto_crc_probe(struct platform_device *pdev)
 		goto _res_err;
 	}
 
+	csky_crc_sw_init_models();
+	csky_crypto_crc_calibrate(crc);
+	csky_crypto_crc_add_debugfs(crc);
+
 	spin_lock(&crc_list.lock);
 	list_add(&crc->list, &crc_list.dev_list);
 	spin_unlock(&crc_list.lock);
@@ -752,6 +895,7 @@ _reg_err:
 	spin_lock(&crc_list.lock);
 	list_del(&crc->list);
 	spin_unlock(&crc_list.lock);
+	debugfs_remove_recursive(crc->debugfs);
 
 	return ret;
 }
@@ -771,6 +915,7 @@ static int csky_crypto_crc_remove(struct platform_device *pdev)
 	for (i = 0; i < ARRAY_SIZE(crc_algs); i++)
 		crypto_unregister_ahash(&crc_algs[i]);
 
+	debugfs_remove_recursive(crc->debugfs);
 	tasklet_kill(&crc->done_task);
 
 	return 0;
@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2018 C-SKY MicroSystems Co.,Ltd.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <linux/kernel.h>
+#include <linux/bitrev.h>
+#include <linux/scatterlist.h>
+#include "csky_crc_sw.h"
+
+#define CRC_SW_WORD_SIZE	4
+
+#define CRC_SW_MODEL(w, r, p, i, x) \
+	{ .width = (w), .reflected = (r), .poly = (p), .init = (i), .xorout = (x) }
+
+/* Rocksoft parameters of the algorithms the engines implement */
+static struct csky_crc_sw_model crc_sw_models[CRC_SW_NR] = {
+	[CRC_SW_8_MAXIM]	= CRC_SW_MODEL(8,  true,  0x31,   0x00,   0x00),
+	[CRC_SW_8_ROHC]		= CRC_SW_MODEL(8,  true,  0x07,   0xff,   0x00),
+	[CRC_SW_16_ARC]		= CRC_SW_MODEL(16, true,  0x8005, 0x0000, 0x0000),
+	[CRC_SW_16_MAXIM]	= CRC_SW_MODEL(16, true,  0x8005, 0x0000, 0xffff),
+	[CRC_SW_16_USB]		= CRC_SW_MODEL(16, true,  0x8005, 0xffff, 0xffff),
+	[CRC_SW_16_MODBUS]	= CRC_SW_MODEL(16, true,  0x8005, 0xffff, 0x0000),
+	[CRC_SW_16_KERMIT]	= CRC_SW_MODEL(16, true,  0x1021, 0x0000, 0x0000),
+	[CRC_SW_16_X25]		= CRC_SW_MODEL(16, true,  0x1021, 0xffff, 0xffff),
+	[CRC_SW_16_CCITT_FALSE]	= CRC_SW_MODEL(16, false, 0x1021, 0xffff, 0x0000),
+	[CRC_SW_16_XMODEM]	= CRC_SW_MODEL(16, false, 0x1021, 0x0000, 0x0000),
+	[CRC_SW_16_DNP]		= CRC_SW_MODEL(16, true,  0x3d65, 0x0000, 0xffff),
+};
+
+static u32 csky_crc_sw_mask(const struct csky_crc_sw_model *m)
+{
+	return m->width == 32 ? ~0U : (1U << m->width) - 1;
+}
+
+static void csky_crc_sw_init_table(struct csky_crc_sw_model *m)
+{
+	u32 mask = csky_crc_sw_mask(m);
+	u32 top  = 1U << (m->width - 1);
+	u32 rpoly, c;
+	int i, j;
+
+	rpoly = bitrev32(m->poly) >> (32 - m->width);
+
+	for (i = 0; i < 256; i++) {
+		if (m->reflected) {
+			c = i;
+			for (j = 0; j < 8; j++)
+				c = (c & 1) ? (c >> 1) ^ rpoly : c >> 1;
+		} else {
+			c = (u32)i << (m->width - 8);
+			for (j = 0; j < 8; j++)
+				c = (c & top) ? (c << 1) ^ m->poly : c << 1;
+		}
+		m->table[i] = c & mask;
+	}
+}
+
+void csky_crc_sw_init_models(void)
+{
+	static bool done;
+	int i;
+
+	if (done)
+		return;
+
+	for (i = 0; i < CRC_SW_NR; i++)
+		csky_crc_sw_init_table(&crc_sw_models[i]);
+	done = true;
+}
+
+const struct csky_crc_sw_model *csky_crc_sw_get(crc_sw_e id)
+{
+	if (id >= CRC_SW_NR)
+		return NULL;
+
+	return &crc_sw_models[id];
+}
+
+static u32 csky_crc_sw_update(const struct csky_crc_sw_model *m, u32 crc,
+			      const u8 *p, size_t len)
+{
+	unsigned int shift = m->width - 8;
+	u32 mask = csky_crc_sw_mask(m);
+
+	if (m->reflected) {
+		while (len--)
+			crc = m->table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	} else {
+		while (len--)
+			crc = (m->table[((crc >> shift) ^ *p++) & 0xff] ^
+			       (crc << 8)) & mask;
+	}
+
+	return crc;
+}
+
+static u32 csky_crc_sw_final(const struct csky_crc_sw_model *m, u32 crc,
+			     size_t len)
+{
+	static const u8 zero[CRC_SW_WORD_SIZE];
+	size_t pad = -len & (CRC_SW_WORD_SIZE - 1);
+
+	crc = csky_crc_sw_update(m, crc, zero, pad);
+
+	return (crc ^ m->xorout) & csky_crc_sw_mask(m);
+}
+
+u32 csky_crc_sw_digest_buf(const struct csky_crc_sw_model *m,
+			   const void *buf, size_t len)
+{
+	u32 crc = csky_crc_sw_update(m, m->init, buf, len);
+
+	return csky_crc_sw_final(m, crc, len);
+}
+
+u32 csky_crc_sw_digest_sg(const struct csky_crc_sw_model *m,
+			  struct scatterlist *sg, unsigned int nbytes)
+{
+	struct sg_mapping_iter miter;
+	unsigned int left = nbytes;
+	u32 crc = m->init;
+	size_t len;
+
+	sg_miter_start(&miter, sg, sg_nents(sg),
+		       SG_MITER_FROM_SG | SG_MITER_ATOMIC);
+
+	while (left && sg_miter_next(&miter)) {
+		len = min_t(size_t, miter.length, left);
+		crc = csky_crc_sw_update(m, crc, miter.addr, len);
+		left -= len;
+	}
+
+	sg_miter_stop(&miter);
+
+	return csky_crc_sw_final(m, crc, nbytes);
+}
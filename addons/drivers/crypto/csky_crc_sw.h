@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2018 C-SKY MicroSystems Co.,Ltd.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef __CSKY_CRC_SW_H
+#define __CSKY_CRC_SW_H
+
+#include <linux/types.h>
+#include <linux/scatterlist.h>
+
+/*
+ * Table driven software model of the CRC engines, used for requests too
+ * short to be worth the engine round trip.  Like the engines, the model
+ * consumes the message in 32-bit words and zero pads a partial last word,
+ * so both paths produce the same digest for the same request.
+ */
+typedef enum {
+	CRC_SW_8_MAXIM	= 0,
+	CRC_SW_8_ROHC,
+	CRC_SW_16_ARC,
+	CRC_SW_16_MAXIM,
+	CRC_SW_16_USB,
+	CRC_SW_16_MODBUS,
+	CRC_SW_16_KERMIT,
+	CRC_SW_16_X25,
+	CRC_SW_16_CCITT_FALSE,
+	CRC_SW_16_XMODEM,
+	CRC_SW_16_DNP,
+	CRC_SW_NR
+} crc_sw_e;
+
+struct csky_crc_sw_model {
+	u8	width;
+	bool	reflected;
+	u32	poly;
+	u32	init;
+	u32	xorout;
+	u32	table[256];
+};
+
+void csky_crc_sw_init_models(void);
+const struct csky_crc_sw_model *csky_crc_sw_get(crc_sw_e id);
+
+u32 csky_crc_sw_digest_buf(const struct csky_crc_sw_model *m,
+			   const void *buf, size_t len);
+u32 csky_crc_sw_digest_sg(const struct csky_crc_sw_model *m,
+			  struct scatterlist *sg, unsigned int nbytes);
+
+#endif /* __CSKY_CRC_SW_H */
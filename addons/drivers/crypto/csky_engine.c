@@ -0,0 +1,261 @@
+/*
+ * Copyright (C) 2018 C-SKY MicroSystems Co.,Ltd.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/delay.h>
+#include <linux/device.h>
+#include <linux/debugfs.h>
+#include "csky_engine.h"
+
+static bool round_robin;
+module_param(round_robin, bool, 0644);
+MODULE_PARM_DESC(round_robin,
+		 "Hand requests to engine instances in turn instead of to the least loaded one");
+
+static struct dentry *csky_engine_debugfs_root;
+
+static void csky_engine_done_task(unsigned long data)
+{
+	struct csky_engine *eng = (struct csky_engine *)data;
+
+	if (test_and_clear_bit(CSKY_ENGINE_FLAGS_IRQ, &eng->flags)) {
+		/* Resumed from the interrupt: the caller has already returned */
+		eng->is_async = true;
+		eng->ops->resume(eng);
+		return;
+	}
+
+	csky_engine_enqueue(eng, NULL);
+}
+
+void csky_engine_init(struct csky_engine *eng, struct device *dev,
+		      const struct csky_engine_ops *ops,
+		      unsigned int max_qlen)
+{
+	INIT_LIST_HEAD(&eng->list);
+	spin_lock_init(&eng->lock);
+	crypto_init_queue(&eng->queue, max_qlen);
+	tasklet_init(&eng->done_task, csky_engine_done_task,
+		     (unsigned long)eng);
+
+	eng->dev = dev;
+	eng->ops = ops;
+}
+
+void csky_engine_exit(struct csky_engine *eng)
+{
+	tasklet_kill(&eng->done_task);
+}
+
+static void csky_engine_add_debugfs(struct csky_engine_class *cls,
+				    struct csky_engine *eng)
+{
+	if (!debugfs_initialized())
+		return;
+
+	if (!csky_engine_debugfs_root)
+		csky_engine_debugfs_root = debugfs_create_dir("csky_engine",
+							      NULL);
+	if (!csky_engine_debugfs_root)
+		return;
+
+	if (!cls->debugfs)
+		cls->debugfs = debugfs_create_dir(cls->name,
+						  csky_engine_debugfs_root);
+	if (!cls->debugfs)
+		return;
+
+	eng->debugfs = debugfs_create_dir(dev_name(eng->dev), cls->debugfs);
+	if (!eng->debugfs)
+		return;
+
+	debugfs_create_u32("queue_depth", 0400, eng->debugfs,
+			   &eng->queue.qlen);
+	debugfs_create_u32("max_queue_depth", 0600, eng->debugfs,
+			   &eng->max_qlen);
+	debugfs_create_u64("requests", 0400, eng->debugfs, &eng->requests);
+	debugfs_create_u64("busy_ns", 0400, eng->debugfs, &eng->busy_ns);
+}
+
+/*
+ * Make an initialised engine available to csky_engine_select(). Returns
+ * the number of instances in the class, so the caller can register its
+ * algorithms along with the first one.
+ */
+unsigned int csky_engine_add(struct csky_engine_class *cls,
+			     struct csky_engine *eng)
+{
+	unsigned int nr;
+
+	eng->cls = cls;
+	csky_engine_add_debugfs(cls, eng);
+
+	spin_lock_bh(&cls->lock);
+	list_add_tail(&eng->list, &cls->dev_list);
+	nr = ++cls->nr_dev;
+	spin_unlock_bh(&cls->lock);
+
+	return nr;
+}
+
+/*
+ * Take an engine out of its class.  Queued requests fail with -ENODEV,
+ * and so does anything submitted to an engine csky_engine_select() had
+ * already handed out; the request running on the hardware is waited
+ * for.  Returns the number of instances left, 0 once the last one is
+ * gone.
+ */
+unsigned int csky_engine_del(struct csky_engine_class *cls,
+			     struct csky_engine *eng)
+{
+	struct crypto_async_request *areq, *tmp;
+	unsigned long flags;
+	unsigned int nr;
+	LIST_HEAD(flushed);
+
+	spin_lock_bh(&cls->lock);
+	list_del_init(&eng->list);
+	nr = --cls->nr_dev;
+
+	spin_lock_irqsave(&eng->lock, flags);
+	eng->dead = true;
+	while ((areq = crypto_dequeue_request(&eng->queue)))
+		list_add_tail(&areq->list, &flushed);
+	spin_unlock_irqrestore(&eng->lock, flags);
+	spin_unlock_bh(&cls->lock);
+
+	list_for_each_entry_safe(areq, tmp, &flushed, list)
+		areq->complete(areq, -ENODEV);
+
+	while (READ_ONCE(eng->busy))
+		msleep(1);
+
+	debugfs_remove_recursive(eng->debugfs);
+	eng->debugfs = NULL;
+
+	return nr;
+}
+
+static unsigned int csky_engine_load(struct csky_engine *eng)
+{
+	return READ_ONCE(eng->queue.qlen) + READ_ONCE(eng->busy);
+}
+
+/*
+ * Pick the instance with the fewest queued and running requests.  The
+ * list is rotated on every call, so instances with the same load take
+ * turns and round_robin simply takes the head.
+ */
+struct csky_engine *csky_engine_select(struct csky_engine_class *cls)
+{
+	struct csky_engine *eng, *best = NULL;
+	unsigned int load, best_load = UINT_MAX;
+
+	spin_lock_bh(&cls->lock);
+	list_for_each_entry(eng, &cls->dev_list, list) {
+		if (round_robin) {
+			best = eng;
+			break;
+		}
+
+		load = csky_engine_load(eng);
+		if (load < best_load) {
+			best = eng;
+			best_load = load;
+			if (!load)
+				break;
+		}
+	}
+	if (best)
+		list_rotate_left(&cls->dev_list);
+	spin_unlock_bh(&cls->lock);
+
+	return best;
+}
+
+/*
+ * Queue @new_areq, if any, and start the next request when the engine is
+ * idle.  Only the caller's own request, started right away, may report
+ * its result synchronously; everything else completes via ->complete().
+ */
+int csky_engine_enqueue(struct csky_engine *eng,
+			struct crypto_async_request *new_areq)
+{
+	struct crypto_async_request *areq, *backlog;
+	unsigned long flags;
+	bool start_async;
+	int err, ret = 0;
+
+	spin_lock_irqsave(&eng->lock, flags);
+	if (eng->dead) {
+		spin_unlock_irqrestore(&eng->lock, flags);
+		return new_areq ? -ENODEV : 0;
+	}
+	if (new_areq) {
+		ret = crypto_enqueue_request(&eng->queue, new_areq);
+		if (eng->queue.qlen > eng->max_qlen)
+			eng->max_qlen = eng->queue.qlen;
+	}
+	if (eng->busy) {
+		spin_unlock_irqrestore(&eng->lock, flags);
+		return ret;
+	}
+	backlog = crypto_get_backlog(&eng->queue);
+	areq	= crypto_dequeue_request(&eng->queue);
+	if (areq) {
+		eng->busy	= true;
+		eng->areq	= areq;
+		eng->busy_since = ktime_get();
+		eng->requests++;
+	}
+	spin_unlock_irqrestore(&eng->lock, flags);
+
+	if (!areq)
+		return ret;
+
+	if (backlog)
+		backlog->complete(backlog, -EINPROGRESS);
+
+	start_async   = (areq != new_areq);
+	eng->is_async = start_async;
+
+	err = eng->ops->start(eng, areq);
+
+	return start_async ? ret : err;
+}
+
+/*
+ * Finish the running request and let the done tasklet start the next
+ * one.  The engine may be handed to another request as soon as it is
+ * marked idle, so everything needed afterwards is read first.
+ */
+int csky_engine_complete(struct csky_engine *eng, int err)
+{
+	struct crypto_async_request *areq = eng->areq;
+	bool is_async = eng->is_async;
+	unsigned long flags;
+
+	spin_lock_irqsave(&eng->lock, flags);
+	eng->busy_ns += ktime_to_ns(ktime_sub(ktime_get(), eng->busy_since));
+	eng->busy = false;
+	spin_unlock_irqrestore(&eng->lock, flags);
+
+	if (is_async)
+		areq->complete(areq, err);
+
+	tasklet_schedule(&eng->done_task);
+
+	return err;
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2018 C-SKY MicroSystems Co.,Ltd.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef __CSKY_ENGINE_H__
+#define __CSKY_ENGINE_H__
+
+#include <linux/interrupt.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <crypto/algapi.h>
+
+/*
+ * Request scheduling shared by the AES, TDES and SHA drivers.  Every
+ * probed instance of an engine owns a csky_engine holding its request
+ * queue and completion tasklet; instances of the same kind are grouped
+ * in a csky_engine_class and each new request goes to the least loaded
+ * one.
+ *
+ * A driver only provides ->start(), which begins a dequeued request.
+ * Drivers with a completion interrupt also provide ->resume(), which
+ * continues it from the done tasklet after the interrupt handler called
+ * csky_engine_irq().  Both return -EINPROGRESS while waiting for the
+ * hardware and otherwise finish through csky_engine_complete().
+ */
+
+struct csky_engine;
+
+struct csky_engine_ops {
+	int (*start)(struct csky_engine *eng,
+		     struct crypto_async_request *areq);
+	int (*resume)(struct csky_engine *eng);
+};
+
+struct csky_engine_class {
+	const char		*name;
+	struct list_head	dev_list;
+	spinlock_t		lock;
+	unsigned int		nr_dev;
+	struct dentry		*debugfs;
+};
+
+#define CSKY_ENGINE_CLASS_INIT(cls, _name) {			\
+	.name	  = _name,					\
+	.dev_list = LIST_HEAD_INIT(cls.dev_list),		\
+	.lock	  = __SPIN_LOCK_UNLOCKED(cls.lock),		\
+}
+
+#define CSKY_ENGINE_FLAGS_IRQ	0
+
+struct csky_engine {
+	struct list_head		list;
+	struct csky_engine_class	*cls;
+	struct device			*dev;
+	const struct csky_engine_ops	*ops;
+
+	spinlock_t			lock;
+	struct crypto_queue		queue;
+	struct tasklet_struct		done_task;
+	struct crypto_async_request	*areq;
+	unsigned long			flags;
+	bool				busy;
+	bool				is_async;
+	bool				dead;	/* Removed, refuses requests */
+
+	/* statistics, see csky_engine_add_debugfs() */
+	u64				requests;
+	u64				busy_ns;
+	ktime_t				busy_since;
+	u32				max_qlen;
+	struct dentry			*debugfs;
+};
+
+void csky_engine_init(struct csky_engine *eng, struct device *dev,
+		      const struct csky_engine_ops *ops,
+		      unsigned int max_qlen);
+void csky_engine_exit(struct csky_engine *eng);
+
+unsigned int csky_engine_add(struct csky_engine_class *cls,
+			     struct csky_engine *eng);
+unsigned int csky_engine_del(struct csky_engine_class *cls,
+			     struct csky_engine *eng);
+
+struct csky_engine *csky_engine_select(struct csky_engine_class *cls);
+int csky_engine_enqueue(struct csky_engine *eng,
+			struct crypto_async_request *new_areq);
+int csky_engine_complete(struct csky_engine *eng, int err);
+
+static inline void csky_engine_irq(struct csky_engine *eng)
+{
+	set_bit(CSKY_ENGINE_FLAGS_IRQ, &eng->flags);
+	tasklet_schedule(&eng->done_task);
+}
+
+#endif
@@ -26,6 +26,12 @@
 #include <linux/irq.h>
 #include <linux/of_device.h>
 #include <linux/delay.h>
+#include <linux/debugfs.h>
+#include <linux/scatterlist.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/uaccess.h>
+#include <linux/completion.h>
 #include <linux/crypto.h>
 #include <linux/version.h>
 #include <crypto/akcipher.h>
@@ -35,25 +41,44 @@
 #include "csky_rsa.h"
 
 #define RSA_FLAGS_BUSY		BIT(0)
+#define RSA_FLAGS_CAL_Q		BIT(1)
+#define RSA_FLAGS_OPR		BIT(2)
+#define RSA_FLAGS_POLL		BIT(3)
 
 #define RSA_FLAGS_SIGN		BIT(8)
 #define RSA_FLAGS_VERIFY	BIT(9)
 #define RSA_FLAGS_ENC		BIT(10)
 #define RSA_FLAGS_DEC		BIT(11)
 
-#define RSA_FLAGS_OPR_MASK	(RSA_FLAGS_SIGN | RSA_FLAGS_VERIFY | \
-				 RSA_FLAGS_ENC | RSA_FLAGS_DEC)
-#define CSKY_RSA_QUEUE_LENGTH	10
+/* Bit number in csky_rsa_dev.pending, set by the interrupt handler */
+#define RSA_PENDING_IRQ		0
+
+#define CSKY_RSA_QUEUE_LENGTH	64
+
+#define RSA_BENCH_MAX_COUNT	(1 << 16)
+#define RSA_BENCH_MAX_KEY	PAGE_SIZE
 
 struct csky_rsa_dev;
 
+/*
+ * Key material in the engine's little-endian word order. Each modulus
+ * carries its Montgomery constant R^2 mod m, computed once at setkey.
+ */
 struct rsa_key_obj {
-	uint8_t *n;
-	uint8_t *e;
-	uint8_t *d;
 	uint32_t n_len;
-	uint32_t e_len;
-	uint32_t d_len;
+	bignum_t n;
+	bignum_t e;
+	bignum_t d;
+	bignum_t n_r2;
+
+	bool	 crt;
+	bignum_t p;
+	bignum_t q;
+	bignum_t dp;
+	bignum_t dq;
+	bignum_t qinv;
+	bignum_t p_r2;
+	bignum_t q_r2;
 };
 
 struct csky_rsa_base_ctx {
@@ -66,7 +91,42 @@ struct csky_rsa_ctx {
 };
 
 struct csky_rsa_reqctx {
-	unsigned long dummy;
+	unsigned long mode;
+};
+
+/* One modular exponentiation for the engine: out = base^exp mod m */
+struct csky_rsa_exp {
+	bignum_t *m;
+	bignum_t *exp;
+	bignum_t *r2;
+	uint32_t *base;
+	uint32_t *out;
+};
+
+/* Sign/verify benchmark driven from debugfs, see csky_rsa_bench_run() */
+struct csky_rsa_bench {
+	struct mutex lock;
+	void *key;
+	unsigned int keylen;
+	char result[128];
+};
+
+struct csky_rsa_bench_wait {
+	struct completion done;
+	int err;
+};
+
+/* Per-device scratch, owned by the request holding RSA_FLAGS_BUSY */
+struct csky_rsa_work {
+	uint32_t in[BN_MAX_WORDS];
+	uint32_t out[BN_MAX_WORDS];
+	uint32_t cp[BN_MAX_WORDS];
+	uint32_t cq[BN_MAX_WORDS];
+	uint32_t m1[BN_MAX_WORDS];
+	uint32_t m2[BN_MAX_WORDS];
+	uint32_t t[BN_MAX_WORDS];
+	uint32_t prod[BN_MAX_WORDS];
+	uint8_t  msg[BN_MAX_BYTES];
 };
 
 struct csky_rsa_dev {
@@ -76,14 +136,25 @@ struct csky_rsa_dev {
 	struct device			*dev;
 	struct rsa_reg __iomem		*reg_base;
 	struct tasklet_struct		done_task;
+	int				irq;
+	bool				is_async;
 
 	struct crypto_queue		queue;
 	unsigned long			flags;
+	unsigned long			pending;
 	spinlock_t			lock;
 
 	void *				buf;
 	uint32_t			buflen;
-	struct scatterlist		*real_dst;
+	struct csky_rsa_work		*work;
+
+	/* Exponentiations of the current request and the one in flight */
+	struct csky_rsa_exp		exp[2];
+	unsigned int			nr_exp;
+	unsigned int			cur_exp;
+
+	struct dentry			*debugfs;
+	struct csky_rsa_bench		bench;
 };
 
 struct csky_rsa_drv {
@@ -96,12 +167,24 @@ static struct csky_rsa_drv csky_rsa = {
 	.lock	  = __SPIN_LOCK_UNLOCKED(csky_rsa.lock),
 };
 
+static struct dentry *csky_rsa_debugfs_root;
+
 static inline void csky_rsa_clear_int(struct csky_rsa_dev *dd)
 {
 	writel_relaxed(0xffff, &dd->reg_base->rsa_isr);
 	writel_relaxed(0x0000, &dd->reg_base->rsa_imr);
 }
 
+static inline void csky_rsa_irq_enable(struct csky_rsa_dev *dd, uint32_t flag)
+{
+	writel_relaxed(flag | RSA_ISR_ERR, &dd->reg_base->rsa_imr);
+}
+
+static inline void csky_rsa_irq_disable(struct csky_rsa_dev *dd)
+{
+	writel_relaxed(0x0000, &dd->reg_base->rsa_imr);
+}
+
 static inline void csky_rsa_setm_width(struct csky_rsa_dev *dd, uint32_t width)
 {
 	writel_relaxed(width, &dd->reg_base->rsa_mwid);
@@ -143,21 +226,6 @@ static inline uint32_t csky_rsa_loop_cnt(struct csky_rsa_dev *dd)
 	return readl_relaxed(&dd->reg_base->rsa_lp_cnt);
 }
 
-static inline uint32_t csky_rsa_cal_q_done(struct csky_rsa_dev *dd)
-{
-	return (readl_relaxed(&dd->reg_base->rsa_isr) >> 5) & 0x1;
-}
-
-static inline uint32_t csky_rsa_opr_done(struct csky_rsa_dev *dd)
-{
-	return readl_relaxed(&dd->reg_base->rsa_isr) & 0x1;
-}
-
-static inline uint32_t csky_rsa_raise_exception(struct csky_rsa_dev *dd)
-{
-	return readl_relaxed(&dd->reg_base->rsa_isr) & 0x1E;
-}
-
 static inline uint32_t csky_rsa_loadm(struct csky_rsa_dev *dd, uint32_t *data,
 				      uint32_t length)
 {
@@ -236,6 +304,9 @@ static uint32_t get_valid_bits(const uint32_t *addr, uint32_t wordsize)
 		}
 	}
 
+	if (i == 0)
+		return 0;
+
 	for (j = 32; j > 0; j--) {
 		if (addr[i - 1] & (0x1 << (j - 1))) {
 			break;
@@ -245,41 +316,37 @@ static uint32_t get_valid_bits(const uint32_t *addr, uint32_t wordsize)
 	return ((i - 1) << 5) + j;
 }
 
-static uint32_t get_first_nonzero_words(uint32_t *a, uint32_t max_words)
+static int word_array_cmp(const uint32_t *a, uint32_t a_words,
+			  const uint32_t *b, uint32_t b_words)
 {
-	uint32_t i = 0;
+	uint32_t i;
+
+	for (i = a_words; i > b_words; i--)
+		if (a[i - 1])
+			return 1;
+	for (i = b_words; i > a_words; i--)
+		if (b[i - 1])
+			return -1;
+	for (i = min(a_words, b_words); i > 0; i--)
+		if (a[i - 1] != b[i - 1])
+			return (a[i - 1] > b[i - 1]) ? 1 : -1;
 
-	for (i = max_words; i > 0; i--) {
-		if (a[i - 1]) {
-			return i;
-		}
-	}
 	return 0;
 }
 
-static uint32_t word_array_left_shift(uint32_t *a, uint32_t words,
-				      uint32_t shift_bits, uint32_t *r)
+/* a = (a << 1) | bit, returning the bit shifted out of the top word */
+static uint32_t word_array_shl1(uint32_t *a, uint32_t words, uint32_t bit)
 {
-	uint32_t i = 0;
-	uint32_t w;
-	uint32_t b;
-	uint32_t tmp = 0;
-
-	w = shift_bits >> 5;
-	b = shift_bits - (w << 5);
-
-	for (i = 0; i < w; i++) {
-		r[i] = 0;
-	}
+	uint32_t i;
+	uint32_t carry;
 
-	tmp = 0;
 	for (i = 0; i < words; i++) {
-		r[w + i] = (tmp | ((a[i] << b) & (~((0x1 << b) - 1))));
-		tmp = ((a[i] >> (32 - b)) & ((0x1 << b) - 1));
+		carry = a[i] >> 31;
+		a[i]  = (a[i] << 1) | bit;
+		bit   = carry;
 	}
-	r[w + i] = tmp;
 
-	return 0;
+	return bit;
 }
 
 static uint32_t _word_array_sub(uint32_t *a, uint32_t a_words,
@@ -312,49 +379,92 @@ static uint32_t _word_array_sub(uint32_t *a, uint32_t a_words,
 	return 0;
 }
 
-static uint32_t word_array_mod(uint32_t *a, uint32_t a_words,
+static uint32_t word_array_add(uint32_t *a, uint32_t a_words,
 			       uint32_t *b, uint32_t b_words,
 			       uint32_t *r)
 {
-	uint32_t ret;
-	bignum_t tmpa;
-	bignum_t tmpb;
-	uint32_t tmpa_valid_bits, tmpa_words;
-	uint32_t tmpb_words, b_valid_bits;
-
-	memset(&tmpa, 0, sizeof(tmpa));
-	memset(&tmpb, 0, sizeof(tmpa));
-
-	b_valid_bits = get_valid_bits(b, b_words);
-
-	memcpy(tmpa.pdata, a, (a_words << 2));
-
-	do {
-		tmpa_words = get_first_nonzero_words(tmpa.pdata, a_words);
-		tmpa_valid_bits = get_valid_bits(tmpa.pdata, tmpa_words);
-		if (tmpa_valid_bits > b_valid_bits + 1) {
-			memset(tmpb.pdata, 0, (a_words << 2));
-			word_array_left_shift(b, b_words,
-				tmpa_valid_bits - b_valid_bits - 1,
-				tmpb.pdata);
-			tmpb_words = get_first_nonzero_words(tmpb.pdata,
-							     a_words);
-			ret = _word_array_sub(tmpa.pdata, tmpa_words,
-					      tmpb.pdata, tmpb_words,
-					      tmpa.pdata);
-		} else if (tmpa_words == b_words) {
-			memcpy(r, tmpa.pdata, (tmpa_words << 2));
-			ret = _word_array_sub(r, tmpa_words,
-					      b, b_words,
-					      tmpa.pdata);
-		} else {
-			ret = _word_array_sub(tmpa.pdata, tmpa_words,
-					      b, b_words,
-					      tmpa.pdata);
+	uint32_t i;
+	uint64_t tmp = 0;
+
+	for (i = 0; i < a_words; i++) {
+		tmp += UINT32_TO_UINT64(a[i]);
+		if (i < b_words)
+			tmp += UINT32_TO_UINT64(b[i]);
+		r[i] = UINT64L_TO_UINT32(tmp);
+		tmp  = UINT64H_TO_UINT32(tmp);
+	}
+
+	return (uint32_t)tmp;
+}
+
+/* r[a_words + b_words] = a * b, schoolbook */
+static void word_array_mul(const uint32_t *a, uint32_t a_words,
+			   const uint32_t *b, uint32_t b_words,
+			   uint32_t *r)
+{
+	uint32_t i, j;
+	uint64_t tmp;
+
+	memset(r, 0, (a_words + b_words) << 2);
+
+	for (i = 0; i < a_words; i++) {
+		tmp = 0;
+		for (j = 0; j < b_words; j++) {
+			tmp += (uint64_t)a[i] * b[j] + r[i + j];
+			r[i + j] = UINT64L_TO_UINT32(tmp);
+			tmp = UINT64H_TO_UINT32(tmp);
 		}
-	} while (ret == 0);
+		r[i + b_words] = UINT64L_TO_UINT32(tmp);
+	}
+}
 
-	return 0;
+/*
+ * r = a mod m, one bit at a time. Only used on the CRT path and at
+ * setkey, where a is at most twice as wide as m; it needs no allocation
+ * and so is safe from the done tasklet.
+ */
+static void word_array_mod(const uint32_t *a, uint32_t a_words,
+			   uint32_t *m, uint32_t m_words,
+			   uint32_t *r)
+{
+	uint32_t acc[RSA_HW_MAX_WORDS + 1];
+	uint32_t i;
+
+	memset(acc, 0, sizeof(acc));
+
+	for (i = a_words << 5; i > 0; i--) {
+		word_array_shl1(acc, m_words + 1,
+				(a[(i - 1) >> 5] >> ((i - 1) & 0x1f)) & 0x1);
+		if (word_array_cmp(acc, m_words + 1, m, m_words) >= 0)
+			_word_array_sub(acc, m_words + 1, m, m_words, acc);
+	}
+
+	memcpy(r, acc, m_words << 2);
+}
+
+/*
+ * R^2 mod m for R = 2^(32 * m->words), the constant the engine takes in
+ * its C register file. It only depends on the modulus, so it is worked
+ * out once per key by doubling 1 modulo m.
+ */
+static void csky_rsa_calc_r2(bignum_t *m, bignum_t *r2)
+{
+	uint32_t acc[RSA_HW_MAX_WORDS + 1];
+	uint32_t i;
+
+	memset(acc, 0, sizeof(acc));
+	acc[0] = 1;
+
+	for (i = 0; i < (m->words << 6); i++) {
+		word_array_shl1(acc, m->words + 1, 0);
+		if (word_array_cmp(acc, m->words + 1, m->pdata, m->words) >= 0)
+			_word_array_sub(acc, m->words + 1, m->pdata, m->words,
+					acc);
+	}
+
+	memset(r2, 0, sizeof(*r2));
+	memcpy(r2->pdata, acc, m->words << 2);
+	r2->words = m->words;
 }
 
 static void convert_byte_array(uint8_t *in, uint8_t *out, uint32_t len)
@@ -387,88 +497,191 @@ static void convert_bndata_to_buf(const uint32_t *src, uint32_t src_words,
 	convert_byte_array((uint8_t *)src, (uint8_t *)dst, dst_bytes);
 }
 
+/*
+ * Exponentiations with at most this many exponent bits, such as public
+ * key operations with e = 65537, finish faster than an interrupt round
+ * trip and are polled; longer ones wait for the interrupt.
+ */
+static unsigned int poll_exp_bits = 32;
+module_param(poll_exp_bits, uint, 0644);
+MODULE_PARM_DESC(poll_exp_bits,
+		 "Poll exponentiations with at most this many exponent bits");
 
-static uint32_t sw_exptmod_2_2m(const uint32_t *modulus, uint32_t words,
-				uint32_t *tmp_c)
+/*
+ * Load one exponentiation and start the Q calculation. Every operand is
+ * m->words wide, which must be even (the width registers count 64-bit
+ * units) and fit the register files.
+ */
+static int csky_rsa_exptmod_load(struct csky_rsa_dev *dd,
+				 struct csky_rsa_exp *op)
 {
-	uint32_t ret;
-	uint32_t m_valid_bits;
-	uint32_t data1 = 0;
-	bignum_t tmp;
-
-	memset(&tmp, 0, sizeof(bignum_t));
+	uint32_t words = op->m->words;
+	uint32_t exp_bits;
 
-	m_valid_bits = (words << 5);
-
-	data1 = 0x1;
-	word_array_left_shift(&data1, 1, (m_valid_bits << 1), tmp.pdata);
-	tmp.words = get_first_nonzero_words(tmp.pdata, words*2 + 1);
-
-	ret = word_array_mod(tmp.pdata, tmp.words,
-			     (uint32_t *)modulus, words, tmp_c);
-	if (ret != 0) {
-		return ret;
-	}
-	return 0;
-}
-
-static uint32_t csky_rsa_exptmod_1024(struct csky_rsa_dev *dd,
-				      const uint32_t *modulus,
-				      const uint32_t *exponent,
-				      const uint32_t *base,
-				      uint32_t *out)
-{
-	uint32_t tmp_c[32];
-	uint32_t ret;
+	if (!words || words > RSA_HW_MAX_WORDS || (words & 0x1))
+		return -EINVAL;
 
-	if ((NULL == modulus) || (NULL == exponent) || (NULL == base) ||
-	    (NULL == out)) {
-		return 1;
-	}
+	exp_bits = get_valid_bits(op->exp->pdata, words);
+	if (!exp_bits)
+		return -EINVAL;
 
-	ret = sw_exptmod_2_2m(modulus, 32, tmp_c);
-	if (ret != 0) {
-		return ret;
-	}
+	if (dd->irq <= 0 || exp_bits <= poll_exp_bits)
+		dd->flags |= RSA_FLAGS_POLL;
+	else
+		dd->flags &= ~RSA_FLAGS_POLL;
 
 	/* reset for safe */
 	csky_rsa_opr_reset(dd);
 	/* clear and disable int */
 	csky_rsa_clear_int(dd);
 	/* set m */
-	csky_rsa_setm_width(dd, 32 >> 1);
-	csky_rsa_loadm(dd, (uint32_t *)modulus, 32);
+	csky_rsa_setm_width(dd, words >> 1);
+	csky_rsa_loadm(dd, op->m->pdata, words);
 	/* set d */
-	csky_rsa_setd_width(dd, get_valid_bits(exponent, 32) - 1);
-	csky_rsa_loadd(dd, (uint32_t *)exponent, 32);
+	csky_rsa_setd_width(dd, exp_bits - 1);
+	csky_rsa_loadd(dd, op->exp->pdata, words);
 	/* set b */
-	csky_rsa_setb_width(dd, 32 >> 1);
-	csky_rsa_loadb(dd, (uint32_t *)base, 32);
+	csky_rsa_setb_width(dd, words >> 1);
+	csky_rsa_loadb(dd, op->base, words);
 	/* set c */
-	csky_rsa_loadc(dd, tmp_c, 32);
+	csky_rsa_loadc(dd, op->r2->pdata, words);
 
 	csky_rsa_cal_q(dd);
-	while(!csky_rsa_cal_q_done(dd) && (!csky_rsa_raise_exception(dd)));
+	dd->flags |= RSA_FLAGS_CAL_Q;
 
-	if (!csky_rsa_raise_exception(dd)) {
-		csky_rsa_opr_start(dd);
-		while((!csky_rsa_opr_done(dd)) &&
-			(csky_rsa_loop_cnt(dd) < MAX_RSA_LP_CNT) &&
-			(!csky_rsa_raise_exception(dd)));
-
-		if ((csky_rsa_loop_cnt(dd) >= MAX_RSA_LP_CNT)
-			|| csky_rsa_raise_exception(dd)) {
-			ret = 1;
-		} else {
-			csky_rsa_read_r(dd, out, 32);
+	return 0;
+}
+
+static int csky_rsa_wait(struct csky_rsa_dev *dd, uint32_t flag)
+{
+	uint32_t isr;
+
+	for (;;) {
+		isr = readl_relaxed(&dd->reg_base->rsa_isr);
+		if (isr & RSA_ISR_ERR)
+			return -EIO;
+		if (isr & flag)
+			return 0;
+
+		if (!(dd->flags & RSA_FLAGS_POLL)) {
+			csky_rsa_irq_enable(dd, flag);
+			return -EINPROGRESS;
 		}
-	} else {
-		ret = 1;
+
+		if ((flag & RSA_ISR_DONE) &&
+		    csky_rsa_loop_cnt(dd) >= MAX_RSA_LP_CNT)
+			return -EIO;
+
+		cpu_relax();
+	}
+}
+
+/*
+ * Run one exponentiation. Returns -EINPROGRESS when it has to wait for
+ * the interrupt; the done tasklet calls it again from where it stopped.
+ */
+static int csky_rsa_exptmod(struct csky_rsa_dev *dd, struct csky_rsa_exp *op)
+{
+	int err;
+
+	if (!(dd->flags & (RSA_FLAGS_CAL_Q | RSA_FLAGS_OPR))) {
+		err = csky_rsa_exptmod_load(dd, op);
+		if (err)
+			return err;
 	}
 
-	csky_rsa_opr_reset(dd);
+	if (dd->flags & RSA_FLAGS_CAL_Q) {
+		err = csky_rsa_wait(dd, RSA_ISR_CAL_Q);
+		if (err)
+			goto out;
 
-	return ret;
+		dd->flags &= ~RSA_FLAGS_CAL_Q;
+		csky_rsa_opr_start(dd);
+		dd->flags |= RSA_FLAGS_OPR;
+	}
+
+	err = csky_rsa_wait(dd, RSA_ISR_DONE);
+	if (!err)
+		csky_rsa_read_r(dd, op->out, op->m->words);
+
+out:
+	if (err != -EINPROGRESS) {
+		dd->flags &= ~(RSA_FLAGS_CAL_Q | RSA_FLAGS_OPR);
+		csky_rsa_opr_reset(dd);
+	}
+
+	return err;
+}
+
+/*
+ * Private key operation through the Chinese Remainder Theorem: two
+ * half-width exponentiations on the engine, recombined with Garner's
+ * formula m = m2 + q * (qInv * (m1 - m2) mod p).
+ */
+static void csky_rsa_crt_split(struct csky_rsa_dev *dd,
+			       struct rsa_key_obj *key, uint32_t *c)
+{
+	struct csky_rsa_work *w = dd->work;
+
+	/* m1 = (c mod p)^dP mod p */
+	word_array_mod(c, key->n.words, key->p.pdata, key->p.words, w->cp);
+	dd->exp[0].m	= &key->p;
+	dd->exp[0].exp	= &key->dp;
+	dd->exp[0].r2	= &key->p_r2;
+	dd->exp[0].base	= w->cp;
+	dd->exp[0].out	= w->m1;
+
+	/* m2 = (c mod q)^dQ mod q */
+	word_array_mod(c, key->n.words, key->q.pdata, key->q.words, w->cq);
+	dd->exp[1].m	= &key->q;
+	dd->exp[1].exp	= &key->dq;
+	dd->exp[1].r2	= &key->q_r2;
+	dd->exp[1].base	= w->cq;
+	dd->exp[1].out	= w->m2;
+
+	dd->nr_exp = 2;
+}
+
+static void csky_rsa_crt_combine(struct csky_rsa_dev *dd,
+				 struct rsa_key_obj *key, uint32_t *m)
+{
+	struct csky_rsa_work *w = dd->work;
+	uint32_t pw = key->p.words;
+	uint32_t qw = key->q.words;
+
+	/* h = qInv * (m1 - m2) mod p */
+	word_array_mod(w->m2, qw, key->p.pdata, pw, w->t);
+	if (_word_array_sub(w->m1, pw, w->t, pw, w->t))
+		word_array_add(w->t, pw, key->p.pdata, pw, w->t);
+	word_array_mul(key->qinv.pdata, pw, w->t, pw, w->prod);
+	word_array_mod(w->prod, pw << 1, key->p.pdata, pw, w->t);
+
+	/* m = m2 + h * q */
+	word_array_mul(w->t, pw, key->q.pdata, qw, w->prod);
+	word_array_add(w->prod, pw + qw, w->m2, qw, w->prod);
+
+	memset(m, 0, key->n.words << 2);
+	memcpy(m, w->prod, min(pw + qw, key->n.words) << 2);
+}
+
+static void csky_rsa_setup_exp(struct csky_rsa_dev *dd,
+			       struct rsa_key_obj *key, bool private)
+{
+	struct csky_rsa_work *w = dd->work;
+
+	dd->cur_exp = 0;
+
+	if (private && key->crt) {
+		csky_rsa_crt_split(dd, key, w->in);
+		return;
+	}
+
+	dd->exp[0].m	= &key->n;
+	dd->exp[0].exp	= private ? &key->d : &key->e;
+	dd->exp[0].r2	= &key->n_r2;
+	dd->exp[0].base	= w->in;
+	dd->exp[0].out	= w->out;
+	dd->nr_exp = 1;
 }
 
 static const uint8_t der_sha1_t[] = {
@@ -487,15 +700,15 @@ static const uint8_t der_md5_t[] = {
 	0x04, 0x10  /* Octet string, length 0x10 (16), followed by md5 hash */
 };
 
-static uint32_t RSA_padding_add_PKCS1_sha1_emsa_1024(const uint8_t *dgst,
-						     uint8_t *out,
-						     uint32_t *outlen,
-						     uint32_t type)
+static int RSA_padding_add_PKCS1_sha1_emsa(const uint8_t *dgst,
+					   uint8_t *out,
+					   uint32_t *outlen,
+					   uint32_t modulus_len,
+					   uint32_t type)
 
 {
 	uint32_t i;
 	uint8_t *p;
-	uint32_t modulus_len;
 	uint8_t *der;
 	uint32_t der_len;
 	uint32_t hashlen;
@@ -515,13 +728,13 @@ static uint32_t RSA_padding_add_PKCS1_sha1_emsa_1024(const uint8_t *dgst,
 		hashlen = MD5_HASH_SZ;
 	}
 
-	modulus_len = 1024 >> 3;
-
 	if (*outlen < modulus_len) {
 		*outlen = modulus_len;
-		return -1;
+		return -EOVERFLOW;
 	}
 
+	if (modulus_len < 11 + der_len + hashlen)
+		return -EINVAL;
 
 	p = (uint8_t *)out;
 
@@ -551,20 +764,19 @@ static uint32_t RSA_padding_add_PKCS1_sha1_emsa_1024(const uint8_t *dgst,
 	return 0;
 }
 
-static uint32_t RSA_padding_check_PKCS1_type_emsa(const uint8_t *dgst,
-						  const uint8_t *in,
-						  const uint32_t inlen,
-						  uint8_t *is_valid,
-						  uint32_t type)
+static int RSA_padding_check_PKCS1_type_emsa(const uint8_t *dgst,
+					     const uint8_t *in,
+					     const uint32_t inlen,
+					     uint8_t *is_valid,
+					     uint32_t type)
 {
 	uint32_t i;
-	uint32_t ret;
+	int ret;
 	const uint8_t *p;
 	uint8_t *der;
 	uint32_t der_len;
 	uint32_t hashlen;
 	uint32_t pslen;
-	uint32_t modulus_len;
 
 	if (type == MD5_PADDING) {
 		der	= (uint8_t *)der_md5_t;
@@ -580,15 +792,13 @@ static uint32_t RSA_padding_check_PKCS1_type_emsa(const uint8_t *dgst,
 		hashlen = MD5_HASH_SZ;
 	}
 
-	modulus_len = RSA_KEY_LEN >> 3;
+	*is_valid = 0;
 
-	if (inlen != modulus_len) {
-		return -1;
+	if (inlen < 11 + der_len + hashlen) {
+		return -EINVAL;
 	}
 
-	*is_valid = 0;
-
-	pslen = modulus_len - 3 - der_len - hashlen;
+	pslen = inlen - 3 - der_len - hashlen;
 	p = in;
 	p++;
 
@@ -637,24 +847,25 @@ _verify_fail:
 	return ret;
 }
 
-static uint32_t RSA_ES_padding_add_PKCS1_emsa_1024(const uint8_t *dgst,
-						   uint32_t dgstlen,
-						   uint8_t *out,
-						   uint32_t *outlen,
-						   uint32_t padding)
+static int RSA_ES_padding_add_PKCS1_emsa(const uint8_t *dgst,
+					 uint32_t dgstlen,
+					 uint8_t *out,
+					 uint32_t *outlen,
+					 uint32_t modulus_len,
+					 uint32_t padding)
 {
 	uint32_t i;
 	uint8_t *p;
-	uint32_t modulus_len;
 	uint32_t pslen;
 
-	modulus_len = RSA_KEY_LEN >> 3;
-
 	if (*outlen < modulus_len) {
 		*outlen = modulus_len;
-		return 1;
+		return -EOVERFLOW;
 	}
 
+	if (dgstlen + 11 > modulus_len)
+		return -EINVAL;
+
 	p = (uint8_t *)out;
 
 	*(p++) = 0x00;
@@ -679,21 +890,18 @@ static uint32_t RSA_ES_padding_add_PKCS1_emsa_1024(const uint8_t *dgst,
 	return 0;
 }
 
-static uint32_t RSA_ES_padding_check_PKCS1_type_emsa(uint8_t *out,
-						     uint32_t *out_size,
-						     uint8_t *src,
-						     uint32_t src_size,
-						     uint32_t padding)
+static int RSA_ES_padding_check_PKCS1_type_emsa(uint8_t *out,
+						uint32_t *out_size,
+						uint8_t *src,
+						uint32_t src_size,
+						uint32_t padding)
 {
 	uint32_t i;
 	uint8_t *p;
-	uint32_t modulus_len;
 	uint32_t pslen;
 
-	modulus_len = RSA_KEY_LEN >> 3;
-
-	if (src_size < modulus_len) {
-		return 1;
+	if (src_size < 11) {
+		return -EINVAL;
 	}
 
 	p = (uint8_t *)src;
@@ -701,11 +909,11 @@ static uint32_t RSA_ES_padding_check_PKCS1_type_emsa(uint8_t *out,
 
 	if (padding == PKCS1_PADDING) {
 		if (*(p++) != 0x02) {
-			return 1;
+			return -EBADMSG;
 		}
 	} else {
 		if (*(p++) != 0x01) {
-			return 1;
+			return -EBADMSG;
 		}
 	}
 
@@ -726,255 +934,179 @@ static uint32_t RSA_ES_padding_check_PKCS1_type_emsa(uint8_t *out,
 	return 0;
 }
 
-int rsa_encrypt(struct csky_rsa_dev *dd, uint8_t *n, uint8_t *e,
-		uint8_t *src, uint32_t src_size,
-		uint8_t *out, uint32_t *out_size,
-		uint32_t padding)
+static struct csky_rsa_dev *csky_rsa_find_dev(struct csky_rsa_base_ctx *ctx)
 {
-	uint32_t ret;
-	uint32_t tmp_n[32];
-	uint32_t tmp_e[32];
-	uint32_t tmp_src_padded[32];
-	uint32_t tmp_out[32];
-	uint32_t keywords = 0, keybytes = 0;
-	uint32_t tmp_src_padded_len = 0;
-
-	keywords = RSA_KEY_LEN >> 5;
-	keybytes = (keywords << 2);
-
-	convert_buf_to_bndata(n, keybytes, tmp_n, keywords);
-	convert_buf_to_bndata(e, keybytes, tmp_e, keywords);
+	struct csky_rsa_dev *rsa_dd = NULL;
+	struct csky_rsa_dev *tmp;
 
-	tmp_src_padded_len = keybytes;
-	if (padding == PKCS1_PADDING) {
-		ret = RSA_ES_padding_add_PKCS1_emsa_1024(
-			(const uint8_t *)src, src_size,
-			(uint8_t *)tmp_src_padded,
-			&tmp_src_padded_len, padding);
-		if (ret != 0) {
-			return ret;
+	spin_lock_bh(&csky_rsa.lock);
+	if (!ctx->dd) {
+		list_for_each_entry(tmp, &csky_rsa.dev_list, list) {
+			rsa_dd = tmp;
+			break;
 		}
-		convert_byte_array(
-			(uint8_t *)tmp_src_padded,
-			(uint8_t *)tmp_src_padded,
-			tmp_src_padded_len);
+		ctx->dd = rsa_dd;
 	} else {
-		convert_byte_array(
-			(uint8_t *)src,
-			(uint8_t *)tmp_src_padded,
-			tmp_src_padded_len);
-	}
-
-	ret = csky_rsa_exptmod_1024(dd, tmp_n, tmp_e, tmp_src_padded, tmp_out);
-	if (ret != 0) {
-		return ret;
+		rsa_dd = ctx->dd;
 	}
+	spin_unlock_bh(&csky_rsa.lock);
 
-	convert_bndata_to_buf(tmp_out, keywords, out, keybytes);
-	*out_size = keybytes;
-
-	return ret;
+	return rsa_dd;
 }
 
-int rsa_decrypt(struct csky_rsa_dev *dd,
-		uint8_t *n, uint8_t *d,
-		uint8_t *src, uint32_t src_size,
-		uint8_t *out, uint32_t *out_size,
-		uint32_t padding)
+static inline struct akcipher_request *akcipher_request_cast(
+	struct crypto_async_request *req)
 {
-	uint32_t ret;
-	uint32_t tmp_n[32];
-	uint32_t tmp_d[32];
-	uint32_t tmp_dst_padded[32];
-	uint32_t tmp_sig[32];
-	uint32_t keywords = 0, keybytes = 0;
-
-	keywords = RSA_KEY_LEN >> 5;
-	keybytes = (keywords << 2);
-
-	convert_buf_to_bndata(n, keybytes, tmp_n, keywords);
-	convert_buf_to_bndata(d, keybytes, tmp_d, keywords);
-	convert_buf_to_bndata(src, src_size, tmp_sig, keywords);
-
-	ret = csky_rsa_exptmod_1024(dd, tmp_n, tmp_d, tmp_sig, tmp_dst_padded);
-	if (ret != 0) {
-		return ret;
-	}
-
-	convert_byte_array((uint8_t *)tmp_dst_padded,
-			   (uint8_t *)tmp_dst_padded, keybytes);
-
-	ret = RSA_ES_padding_check_PKCS1_type_emsa(out, out_size,
-						   (uint8_t *)tmp_dst_padded,
-						   keybytes, padding);
+	return container_of(req, struct akcipher_request, base);
+}
 
-	return ret;
+static inline bool csky_rsa_is_private(unsigned long mode)
+{
+	return mode & (RSA_FLAGS_DEC | RSA_FLAGS_SIGN);
 }
 
-int rsa_sign(struct csky_rsa_dev *dd,
-	     uint8_t *n, uint8_t *d,
-	     uint8_t *src, uint32_t src_size,
-	     uint8_t *signature, uint32_t *sig_size, uint32_t type)
+/* Copy the request in and turn it into the engine's input operand */
+static int csky_rsa_prepare(struct csky_rsa_dev *dd)
 {
-	uint32_t ret;
-	uint32_t tmp_n[32];
-	uint32_t tmp_d[32];
-	uint32_t tmp_src_padded[32];
-	uint32_t tmp_sig[32];
-	uint32_t keywords = 0, keybytes = 0;
-	uint32_t tmp_src_padded_len = 0;
+	struct akcipher_request *req = akcipher_request_cast(dd->areq);
+	struct csky_rsa_reqctx *rctx = akcipher_request_ctx(req);
+	struct rsa_key_obj *key = &dd->ctx->key;
+	struct csky_rsa_work *w = dd->work;
+	uint32_t keybytes = key->n_len;
+	uint32_t padded_len = keybytes;
+	int err = 0;
 
-	keywords = RSA_KEY_LEN >> 5;
-	keybytes = (keywords << 2);
+	if (!keybytes || req->src_len > keybytes)
+		return -EINVAL;
 
-	convert_buf_to_bndata(n, keybytes, tmp_n, keywords);
-	convert_buf_to_bndata(d, keybytes, tmp_d, keywords);
+	dd->buflen = req->src_len;
+	sg_copy_to_buffer(req->src, sg_nents(req->src), dd->buf, req->src_len);
 
-	tmp_src_padded_len = keybytes;
-	ret = RSA_padding_add_PKCS1_sha1_emsa_1024((const uint8_t *)src,
-						   (uint8_t *)tmp_src_padded,
-						   &tmp_src_padded_len, type);
-	if (ret != 0) {
-		return ret;
+	switch (rctx->mode) {
+	case RSA_FLAGS_ENC:
+		err = RSA_ES_padding_add_PKCS1_emsa(dd->buf, dd->buflen, w->msg,
+						    &padded_len, keybytes,
+						    PKCS1_PADDING);
+		if (!err)
+			convert_buf_to_bndata(w->msg, keybytes, w->in,
+					      key->n.words);
+		break;
+	case RSA_FLAGS_DEC:
+		convert_buf_to_bndata(dd->buf, dd->buflen, w->in, key->n.words);
+		break;
+	case RSA_FLAGS_SIGN:
+		err = RSA_padding_add_PKCS1_sha1_emsa(dd->buf, w->msg,
+						      &padded_len, keybytes,
+						      MD5_PADDING);
+		if (!err)
+			convert_buf_to_bndata(w->msg, keybytes, w->in,
+					      key->n.words);
+		break;
+	case RSA_FLAGS_VERIFY:
+		/* The signature to check is passed in through dst */
+		sg_copy_to_buffer(req->dst, sg_nents(req->dst), w->msg,
+				  keybytes);
+		convert_buf_to_bndata(w->msg, keybytes, w->in, key->n.words);
+		break;
+	default:
+		err = -EINVAL;
+		break;
 	}
 
-	convert_byte_array((uint8_t *)tmp_src_padded,
-			   (uint8_t *)tmp_src_padded,
-			   keybytes);
-
-	ret = csky_rsa_exptmod_1024(dd, tmp_n, tmp_d, tmp_src_padded, tmp_sig);
-	if (ret != 0) {
-		return ret;
-	}
+	if (err)
+		return err;
 
-	convert_bndata_to_buf(tmp_sig, keywords, signature, keybytes);
-	*sig_size = keybytes;
+	csky_rsa_setup_exp(dd, key, csky_rsa_is_private(rctx->mode));
 
 	return 0;
 }
 
-int rsa_verify(struct csky_rsa_dev *dd,
-	       uint8_t *n, uint8_t *e,
-	       uint8_t *src, uint32_t src_size,
-	       uint8_t *signature, uint32_t sig_size,
-	       uint8_t *result, uint32_t type)
+/* Turn the engine's result into the request's output */
+static int csky_rsa_output(struct csky_rsa_dev *dd)
 {
-	uint32_t ret;
-	uint32_t tmp_n[32];
-	uint32_t tmp_e[32];
-	uint32_t tmp_dst_padded[32];
-	uint32_t tmp_sig[32];
-	uint32_t keywords = 0, keybytes = 0;
-
-	*result = 0;
-
-	keywords = RSA_KEY_LEN >> 5;
-	keybytes = (keywords << 2);
-
-	convert_buf_to_bndata(n, keybytes, tmp_n, keywords);
-	convert_buf_to_bndata(e, keybytes, tmp_e, keywords);
-	convert_buf_to_bndata(signature, sig_size, tmp_sig, keywords);
+	struct akcipher_request *req = akcipher_request_cast(dd->areq);
+	struct csky_rsa_reqctx *rctx = akcipher_request_ctx(req);
+	struct rsa_key_obj *key = &dd->ctx->key;
+	struct csky_rsa_work *w = dd->work;
+	uint32_t keybytes = key->n_len;
+	uint32_t outlen = keybytes;
+	uint8_t sign = 0;
+	int err;
 
-	ret = csky_rsa_exptmod_1024(dd, tmp_n, tmp_e, tmp_sig, tmp_dst_padded);
-	if (ret != 0) {
-		return ret;
+	if (csky_rsa_is_private(rctx->mode) && key->crt)
+		csky_rsa_crt_combine(dd, key, w->out);
+
+	switch (rctx->mode) {
+	case RSA_FLAGS_ENC:
+	case RSA_FLAGS_SIGN:
+		convert_bndata_to_buf(w->out, key->n.words, dd->buf, keybytes);
+		break;
+	case RSA_FLAGS_DEC:
+		convert_bndata_to_buf(w->out, key->n.words, w->msg, keybytes);
+		err = RSA_ES_padding_check_PKCS1_type_emsa(dd->buf, &outlen,
+							   w->msg, keybytes,
+							   PKCS1_PADDING);
+		if (err)
+			return err;
+		/* The message goes out right-aligned in a modulus-sized buffer */
+		memmove(dd->buf + keybytes - outlen, dd->buf, outlen);
+		memset(dd->buf, 0, keybytes - outlen);
+		outlen = keybytes;
+		break;
+	case RSA_FLAGS_VERIFY:
+		/* A signature that does not match yields 0; that is no error */
+		convert_bndata_to_buf(w->out, key->n.words, w->msg, keybytes);
+		RSA_padding_check_PKCS1_type_emsa(dd->buf, w->msg, keybytes,
+						  &sign, MD5_PADDING);
+		dd->buf[0] = sign;
+		outlen = 1;
+		break;
 	}
 
-	convert_byte_array((uint8_t *)tmp_dst_padded,
-			   (uint8_t *)tmp_dst_padded, keybytes);
-	ret = RSA_padding_check_PKCS1_type_emsa(
-		src,
-		(const uint8_t *)tmp_dst_padded,
-		keybytes,
-		result,
-		type);
+	req->dst_len = outlen;
+	if (!sg_copy_from_buffer(req->dst, sg_nents(req->dst), dd->buf, outlen))
+		return -EINVAL;
 
-	return ret;
+	return 0;
 }
 
-static struct csky_rsa_dev *csky_rsa_find_dev(struct csky_rsa_base_ctx *ctx)
+static inline int csky_rsa_complete(struct csky_rsa_dev *dd, int err)
 {
-	struct csky_rsa_dev *rsa_dd = NULL;
-	struct csky_rsa_dev *tmp;
-
-	spin_lock_bh(&csky_rsa.lock);
-	if (!ctx->dd) {
-		list_for_each_entry(tmp, &csky_rsa.dev_list, list) {
-			rsa_dd = tmp;
-			break;
-		}
-		ctx->dd = rsa_dd;
-	} else {
-		rsa_dd = ctx->dd;
-	}
-	spin_unlock_bh(&csky_rsa.lock);
-
-	return rsa_dd;
-}
+	struct crypto_async_request *areq = dd->areq;
+	bool is_async = dd->is_async;
+	unsigned long flags;
 
-static inline struct akcipher_request *akcipher_request_cast(
-	struct crypto_async_request *req)
-{
-	return container_of(req, struct akcipher_request, base);
-}
+	/* Once BUSY is clear, a submitter may claim the engine and dd */
+	spin_lock_irqsave(&dd->lock, flags);
+	dd->flags &= ~(RSA_FLAGS_BUSY | RSA_FLAGS_CAL_Q | RSA_FLAGS_OPR);
+	spin_unlock_irqrestore(&dd->lock, flags);
 
-static inline int csky_rsa_complete(struct csky_rsa_dev *dd, int err)
-{
-	dd->flags &= ~RSA_FLAGS_BUSY;
-	dd->flags &= ~RSA_FLAGS_OPR_MASK;
-	dd->areq->complete(dd->areq, err);
+	if (is_async)
+		areq->complete(areq, err);
 
 	tasklet_schedule(&dd->done_task);
 
 	return err;
 }
 
-static int csky_rsa_handle(struct csky_rsa_dev *dd)
+/*
+ * Run the current request's exponentiations in turn. Called first from
+ * the submitter and then, after each interrupt, from the done tasklet.
+ */
+static int csky_rsa_run(struct csky_rsa_dev *dd)
 {
-	struct csky_rsa_base_ctx *ctx = dd->ctx;
-	struct rsa_key_obj *pkey = &ctx->key;
-	int err = 0;
-	uint8_t tmpdata[128];
-	uint32_t tmplen = 0;
-	uint8_t sign = 0;
-
-	if (dd->flags & RSA_FLAGS_ENC) {
-		rsa_encrypt(dd, pkey->n, pkey->e, dd->buf, dd->buflen, dd->buf,
-			    &dd->buflen, PKCS1_PADDING);
-		if (!sg_copy_from_buffer(dd->real_dst, sg_nents(dd->real_dst),
-					 dd->buf, dd->buflen))
-			err = -EINVAL;
-
-	} else if (dd->flags && RSA_FLAGS_DEC) {
-		rsa_decrypt(dd, pkey->n, pkey->d, dd->buf, dd->buflen,
-			    (uint8_t *)tmpdata, &tmplen, PKCS1_PADDING);
-		memset(dd->buf, 0, pkey->n_len);
-		memcpy(dd->buf+pkey->n_len-tmplen, tmpdata, tmplen);
-		if (!sg_copy_from_buffer(dd->real_dst, sg_nents(dd->real_dst),
-					 dd->buf, pkey->n_len))
-			err = -EINVAL;
-
-	} else if (dd->flags && RSA_FLAGS_SIGN) {
-		rsa_sign(dd, pkey->n, pkey->d, dd->buf, dd->buflen, dd->buf,
-				&pkey->n_len,MD5_PADDING);
-		if (!sg_copy_from_buffer(dd->real_dst, sg_nents(dd->real_dst),
-					 dd->buf, pkey->n_len))
-			err = -EINVAL;
-	} else if (dd->flags && RSA_FLAGS_VERIFY) {
-		sg_copy_to_buffer(dd->real_dst, sg_nents(dd->real_dst),
-				  (void *)tmpdata, pkey->n_len);
-		rsa_verify(dd, pkey->n, pkey->e, dd->buf, dd->buflen,
-			   (uint8_t *)&tmpdata, pkey->n_len,
-			   &sign, MD5_PADDING);
-		if (!sg_copy_from_buffer(dd->real_dst, sg_nents(dd->real_dst),
-		    (void *)&sign, 1))
-			err = -EINVAL;
-	} else
-		err = -EINVAL;
+	int err;
 
-	csky_rsa_complete(dd, err);
+	while (dd->cur_exp < dd->nr_exp) {
+		err = csky_rsa_exptmod(dd, &dd->exp[dd->cur_exp]);
+		if (err == -EINPROGRESS)
+			return err;
+		if (err)
+			return csky_rsa_complete(dd, err);
+		dd->cur_exp++;
+	}
 
-	return err;
+	return csky_rsa_complete(dd, csky_rsa_output(dd));
 }
 
 static int csky_rsa_handle_queue(struct csky_rsa_dev *dd,
@@ -983,7 +1115,8 @@ static int csky_rsa_handle_queue(struct csky_rsa_dev *dd,
 	struct crypto_async_request *areq, *backlog;
 	struct csky_rsa_base_ctx	*ctx;
 	unsigned long flags;
-	int ret = 0;
+	bool start_async;
+	int err, ret = 0;
 
 	spin_lock_irqsave(&dd->lock, flags);
 	if (new_areq)
@@ -1008,22 +1141,38 @@ static int csky_rsa_handle_queue(struct csky_rsa_dev *dd,
 	dd->areq = areq;
 	dd->ctx  = ctx;
 
-	return csky_rsa_handle(dd);
+	/*
+	 * Only the caller's own request, started right away, may report its
+	 * result synchronously; everything else completes via ->complete().
+	 */
+	start_async = (areq != new_areq);
+	dd->is_async = start_async;
+
+	err = csky_rsa_prepare(dd);
+	if (err)
+		err = csky_rsa_complete(dd, err);
+	else
+		err = csky_rsa_run(dd);
+
+	return start_async ? ret : err;
 }
 
-static int csky_rsa_check_key_length(unsigned int len)
+static int csky_rsa_check_key_length(unsigned int len, bool crt)
 {
-	switch (len) {
-	case 1024:
+	if (len <= RSA_KEY_LEN)
+		return 0;
+
+	/* Wider keys only fit the engine as two CRT halves */
+	if (crt && len <= RSA_MAX_KEY_LEN)
 		return 0;
-	}
 
 	return -EINVAL;
 }
 
-static int csky_rsa_enc(struct akcipher_request *req)
+static int csky_rsa_enqueue(struct akcipher_request *req, unsigned long mode)
 {
 	struct csky_rsa_base_ctx *ctx;
+	struct csky_rsa_reqctx	 *rctx = akcipher_request_ctx(req);
 	struct csky_rsa_dev	 *dd;
 
 	ctx = akcipher_tfm_ctx(crypto_akcipher_reqtfm(req));
@@ -1031,66 +1180,100 @@ static int csky_rsa_enc(struct akcipher_request *req)
 	if (!dd)
 		return -ENODEV;
 
-	dd->flags |= RSA_FLAGS_ENC;
-	dd->buflen = req->src_len;
-	dd->real_dst = req->dst;
-	sg_copy_to_buffer(req->src, sg_nents(req->src), dd->buf, req->src_len);
+	rctx->mode = mode;
 
 	return csky_rsa_handle_queue(dd, &req->base);
 }
 
+static int csky_rsa_enc(struct akcipher_request *req)
+{
+	return csky_rsa_enqueue(req, RSA_FLAGS_ENC);
+}
+
 static int csky_rsa_dec(struct akcipher_request *req)
 {
-	struct csky_rsa_base_ctx *ctx;
-	struct csky_rsa_dev	 *dd;
+	return csky_rsa_enqueue(req, RSA_FLAGS_DEC);
+}
 
-	ctx = akcipher_tfm_ctx(crypto_akcipher_reqtfm(req));
-	dd  = csky_rsa_find_dev(ctx);
-	if (!dd)
-		return -ENODEV;
+static int csky_rsa_sign(struct akcipher_request *req)
+{
+	return csky_rsa_enqueue(req, RSA_FLAGS_SIGN);
+}
 
-	dd->flags |= RSA_FLAGS_DEC;
-	dd->buflen = req->src_len;
-	dd->real_dst = req->dst;
-	sg_copy_to_buffer(req->src, sg_nents(req->src), dd->buf, req->src_len);
+static int csky_rsa_verify(struct akcipher_request *req)
+{
+	return csky_rsa_enqueue(req, RSA_FLAGS_VERIFY);
+}
 
-	return csky_rsa_handle_queue(dd, &req->base);
+/*
+ * Load a big-endian integer from the key blob, dropping the ASN.1 sign
+ * byte. The word count is rounded up to the engine's 64-bit granule.
+ */
+static int csky_rsa_load_bn(bignum_t *bn, const uint8_t *buf, size_t len)
+{
+	while (len && !*buf) {
+		buf++;
+		len--;
+	}
+
+	if (!len || len > BN_MAX_BYTES)
+		return -EINVAL;
+
+	convert_buf_to_bndata(buf, len, bn->pdata, BN_MAX_WORDS);
+	bn->words = ALIGN(DIV_ROUND_UP(len, 4), 2);
+
+	return 0;
 }
 
-static int csky_rsa_sign(struct akcipher_request *req)
+static void csky_rsa_clear_key(struct rsa_key_obj *pkey)
 {
-	struct csky_rsa_base_ctx *ctx;
-	struct csky_rsa_dev	 *dd;
+	memzero_explicit(pkey, sizeof(*pkey));
+}
 
-	ctx = akcipher_tfm_ctx(crypto_akcipher_reqtfm(req));
-	dd  = csky_rsa_find_dev(ctx);
-	if (!dd)
-		return -ENODEV;
+static int csky_rsa_set_n_e(struct rsa_key_obj *pkey,
+			    const struct rsa_key *raw_key)
+{
+	int ret;
 
-	dd->flags |= RSA_FLAGS_SIGN;
-	dd->buflen = req->src_len;
-	dd->real_dst = req->dst;
-	sg_copy_to_buffer(req->src, sg_nents(req->src), dd->buf, req->src_len);
+	ret = csky_rsa_load_bn(&pkey->n, raw_key->n, raw_key->n_sz);
+	if (ret)
+		return ret;
 
-	return csky_rsa_handle_queue(dd, &req->base);
+	ret = csky_rsa_load_bn(&pkey->e, raw_key->e, raw_key->e_sz);
+	if (ret)
+		return ret;
+
+	pkey->n_len = DIV_ROUND_UP(get_valid_bits(pkey->n.pdata,
+						  pkey->n.words), 8);
+
+	if (pkey->n.words <= RSA_HW_MAX_WORDS)
+		csky_rsa_calc_r2(&pkey->n, &pkey->n_r2);
+
+	return 0;
 }
 
-static int csky_rsa_verify(struct akcipher_request *req)
+static int csky_rsa_set_crt(struct rsa_key_obj *pkey,
+			    const struct rsa_key *raw_key)
 {
-	struct csky_rsa_base_ctx *ctx;
-	struct csky_rsa_dev	 *dd;
+	int ret;
 
-	ctx = akcipher_tfm_ctx(crypto_akcipher_reqtfm(req));
-	dd  = csky_rsa_find_dev(ctx);
-	if (!dd)
-		return -ENODEV;
+	ret = csky_rsa_load_bn(&pkey->p, raw_key->p, raw_key->p_sz) ?:
+	      csky_rsa_load_bn(&pkey->q, raw_key->q, raw_key->q_sz) ?:
+	      csky_rsa_load_bn(&pkey->dp, raw_key->dp, raw_key->dp_sz) ?:
+	      csky_rsa_load_bn(&pkey->dq, raw_key->dq, raw_key->dq_sz) ?:
+	      csky_rsa_load_bn(&pkey->qinv, raw_key->qinv, raw_key->qinv_sz);
+	if (ret)
+		return ret;
 
-	dd->flags |= RSA_FLAGS_VERIFY;
-	dd->buflen = req->src_len;
-	dd->real_dst = req->dst;
-	sg_copy_to_buffer(req->src, sg_nents(req->src), dd->buf, req->src_len);
+	if (pkey->p.words > RSA_HW_MAX_WORDS ||
+	    pkey->q.words > RSA_HW_MAX_WORDS)
+		return -EINVAL;
 
-	return csky_rsa_handle_queue(dd, &req->base);
+	csky_rsa_calc_r2(&pkey->p, &pkey->p_r2);
+	csky_rsa_calc_r2(&pkey->q, &pkey->q_r2);
+	pkey->crt = true;
+
+	return 0;
 }
 
 static int csky_rsa_set_priv_key(struct crypto_akcipher *tfm, const void *key,
@@ -1105,23 +1288,26 @@ static int csky_rsa_set_priv_key(struct crypto_akcipher *tfm, const void *key,
 	if (ret)
 		return ret;
 
-	pkey->n_len = raw_key.n_sz;
-	memset(pkey->n, 0, pkey->n_len);
-	memcpy(pkey->n, raw_key.n, raw_key.n_sz);
+	csky_rsa_clear_key(pkey);
 
-	pkey->d_len = raw_key.d_sz;
-	memset(pkey->d, 0, pkey->n_len);
-	memcpy(pkey->d, raw_key.d, raw_key.d_sz);
+	ret = csky_rsa_set_n_e(pkey, &raw_key) ?:
+	      csky_rsa_load_bn(&pkey->d, raw_key.d, raw_key.d_sz);
+	if (ret)
+		goto err;
 
-	pkey->e_len = raw_key.e_sz;
-	memset(pkey->e, 0, pkey->n_len);
-	memcpy(&pkey->e[pkey->n_len - raw_key.e_sz], raw_key.e, raw_key.e_sz);
+	/* Keys without the CRT components still work through d */
+	if (csky_rsa_set_crt(pkey, &raw_key))
+		pkey->crt = false;
 
-	if (csky_rsa_check_key_length(pkey->n_len << 3)) {
-		return -EINVAL;
-	}
+	ret = csky_rsa_check_key_length(pkey->n_len << 3, pkey->crt);
+	if (ret)
+		goto err;
 
 	return 0;
+
+err:
+	csky_rsa_clear_key(pkey);
+	return ret;
 }
 
 static int csky_rsa_set_pub_key(struct crypto_akcipher *tfm, const void *key,
@@ -1136,16 +1322,13 @@ static int csky_rsa_set_pub_key(struct crypto_akcipher *tfm, const void *key,
 	if (ret)
 		return ret;
 
-	pkey->n_len = raw_key.n_sz;
-	memset(pkey->n, 0, pkey->n_len);
-	memcpy(pkey->n, raw_key.n, raw_key.n_sz);
-
-	pkey->e_len = raw_key.e_sz;
-	memset(pkey->e, 0, pkey->n_len);
-	memcpy(&pkey->e[pkey->n_len - raw_key.e_sz], raw_key.e, raw_key.e_sz);
+	csky_rsa_clear_key(pkey);
 
-	if (csky_rsa_check_key_length(pkey->n_len << 3)) {
-		return -EINVAL;
+	ret = csky_rsa_set_n_e(pkey, &raw_key) ?:
+	      csky_rsa_check_key_length(pkey->n_len << 3, false);
+	if (ret) {
+		csky_rsa_clear_key(pkey);
+		return ret;
 	}
 
 	return 0;
@@ -1165,37 +1348,14 @@ static int csky_rsa_max_size(struct crypto_akcipher *tfm)
 
 static int csky_rsa_init(struct crypto_akcipher *tfm)
 {
-	struct csky_rsa_ctx *ctx = akcipher_tfm_ctx(tfm);
-	struct rsa_key_obj *pkey = &ctx->base.key;
-
-	pkey->n = (void *)__get_free_pages(GFP_KERNEL, 1);
-	if (!pkey->n)
-		goto _out_n;
-	pkey->e = (void *)__get_free_pages(GFP_KERNEL, 1);
-	if (!pkey->e)
-		goto _out_e;
-	pkey->d = (void *)__get_free_pages(GFP_KERNEL, 1);
-	if (!pkey->d)
-		goto _out_d;
-
 	return 0;
-
-_out_d:
-	free_page((unsigned long)pkey->e);
-_out_e:
-	free_page((unsigned long)pkey->n);
-_out_n:
-	return -ENOMEM;
 }
 
 static void csky_rsa_exit(struct crypto_akcipher *tfm)
 {
 	struct csky_rsa_ctx *ctx = akcipher_tfm_ctx(tfm);
-	struct rsa_key_obj *pkey = &ctx->base.key;
 
-	free_page((unsigned long)pkey->n);
-	free_page((unsigned long)pkey->d);
-	free_page((unsigned long)pkey->e);
+	csky_rsa_clear_key(&ctx->base.key);
 }
 
 static struct akcipher_alg rsa_algs[] = {
@@ -1224,9 +1384,36 @@ static void csky_rsa_done_task(unsigned long data)
 {
 	struct csky_rsa_dev *dd = (struct csky_rsa_dev *)data;
 
+	/*
+	 * Only an interrupt may resume the request in flight: RSA_FLAGS_BUSY
+	 * alone is not enough, a submitter may already have claimed the
+	 * engine between csky_rsa_complete() and this tasklet running.
+	 */
+	if (test_and_clear_bit(RSA_PENDING_IRQ, &dd->pending)) {
+		/* Resumed from the interrupt: the caller has already returned */
+		dd->is_async = true;
+		csky_rsa_run(dd);
+		return;
+	}
+
 	csky_rsa_handle_queue(dd, NULL);
 }
 
+static irqreturn_t csky_rsa_irq(int irq, void *dev_id)
+{
+	struct csky_rsa_dev *dd = dev_id;
+
+	if (!readl_relaxed(&dd->reg_base->rsa_imr))
+		return IRQ_NONE;
+
+	/* The status stays in rsa_isr for the tasklet to inspect */
+	csky_rsa_irq_disable(dd);
+	set_bit(RSA_PENDING_IRQ, &dd->pending);
+	tasklet_schedule(&dd->done_task);
+
+	return IRQ_HANDLED;
+}
+
 static void csky_rsa_unregister_algs(struct csky_rsa_dev *dd)
 {
 	int i;
@@ -1251,6 +1438,220 @@ static int csky_rsa_register_algs(struct csky_rsa_dev *dd)
 	return 0;
 }
 
+static void csky_rsa_bench_done(struct crypto_async_request *areq, int err)
+{
+	struct csky_rsa_bench_wait *wait = areq->data;
+
+	if (err == -EINPROGRESS)
+		return;
+
+	wait->err = err;
+	complete(&wait->done);
+}
+
+static int csky_rsa_bench_wait(int err, struct csky_rsa_bench_wait *wait)
+{
+	if (err == -EINPROGRESS || err == -EBUSY) {
+		wait_for_completion(&wait->done);
+		reinit_completion(&wait->done);
+		err = wait->err;
+	}
+
+	return err;
+}
+
+/*
+ * Sign a digest @count times with the key written to bench_key, then
+ * verify the signature @count times, and report both rates.  The
+ * requests go one at a time through the crypto API, pinned to @dd, so
+ * the rates include the queueing and completion overhead a caller sees.
+ */
+static int csky_rsa_bench_run(struct csky_rsa_dev *dd, u32 count)
+{
+	struct csky_rsa_bench *bench = &dd->bench;
+	struct csky_rsa_bench_wait wait;
+	struct crypto_akcipher *tfm;
+	struct akcipher_request *req;
+	struct csky_rsa_ctx *ctx;
+	struct scatterlist src, dst;
+	u64 elapsed, sign_rate, verify_rate;
+	unsigned int keybytes;
+	uint8_t *dgst, *sig, *out;
+	ktime_t start;
+	u32 i;
+	int err;
+
+	if (!bench->key)
+		return -ENOKEY;
+
+	tfm = crypto_alloc_akcipher("csky-rsa", 0, 0);
+	if (IS_ERR(tfm))
+		return PTR_ERR(tfm);
+
+	ctx = akcipher_tfm_ctx(tfm);
+	ctx->base.dd = dd;
+
+	err = crypto_akcipher_set_priv_key(tfm, bench->key, bench->keylen);
+	if (err)
+		goto free_tfm;
+
+	keybytes = crypto_akcipher_maxsize(tfm);
+
+	req = akcipher_request_alloc(tfm, GFP_KERNEL);
+	dgst = kmalloc(MD5_HASH_SZ + 2 * keybytes, GFP_KERNEL);
+	if (!req || !dgst) {
+		err = -ENOMEM;
+		goto free_req;
+	}
+	sig = dgst + MD5_HASH_SZ;
+	out = sig + keybytes;
+	for (i = 0; i < MD5_HASH_SZ; i++)
+		dgst[i] = i;
+
+	init_completion(&wait.done);
+	akcipher_request_set_callback(req, CRYPTO_TFM_REQ_MAY_BACKLOG,
+				      csky_rsa_bench_done, &wait);
+	sg_init_one(&src, dgst, MD5_HASH_SZ);
+
+	sg_init_one(&dst, sig, keybytes);
+	start = ktime_get();
+	for (i = 0; i < count; i++) {
+		akcipher_request_set_crypt(req, &src, &dst, MD5_HASH_SZ,
+					   keybytes);
+		err = csky_rsa_bench_wait(crypto_akcipher_sign(req), &wait);
+		if (err)
+			goto free_req;
+	}
+	elapsed = ktime_to_ns(ktime_sub(ktime_get(), start));
+	sign_rate = div64_u64((u64)count * NSEC_PER_SEC, elapsed ? elapsed : 1);
+
+	/* Verify reads the signature from dst and leaves its verdict there */
+	sg_init_one(&dst, out, keybytes);
+	start = ktime_get();
+	for (i = 0; i < count; i++) {
+		memcpy(out, sig, keybytes);
+		akcipher_request_set_crypt(req, &src, &dst, MD5_HASH_SZ,
+					   keybytes);
+		err = csky_rsa_bench_wait(crypto_akcipher_verify(req), &wait);
+		if (err)
+			goto free_req;
+		if (out[0] != 1) {
+			err = -EBADMSG;
+			goto free_req;
+		}
+	}
+	elapsed = ktime_to_ns(ktime_sub(ktime_get(), start));
+	verify_rate = div64_u64((u64)count * NSEC_PER_SEC,
+				elapsed ? elapsed : 1);
+
+	scnprintf(bench->result, sizeof(bench->result),
+		  "key bits: %u crt: %s operations: %u\n"
+		  "sign ops/sec: %llu verify ops/sec: %llu\n",
+		  keybytes << 3, ctx->base.key.crt ? "yes" : "no", count,
+		  sign_rate, verify_rate);
+
+free_req:
+	kfree(dgst);
+	akcipher_request_free(req);
+free_tfm:
+	crypto_free_akcipher(tfm);
+
+	return err;
+}
+
+static ssize_t csky_rsa_bench_write(struct file *file,
+				    const char __user *ubuf,
+				    size_t count, loff_t *ppos)
+{
+	struct csky_rsa_dev *dd = file->private_data;
+	u32 n;
+	int err;
+
+	err = kstrtou32_from_user(ubuf, count, 0, &n);
+	if (err)
+		return err;
+	if (!n || n > RSA_BENCH_MAX_COUNT)
+		return -EINVAL;
+
+	mutex_lock(&dd->bench.lock);
+	err = csky_rsa_bench_run(dd, n);
+	mutex_unlock(&dd->bench.lock);
+
+	return err ? err : count;
+}
+
+static ssize_t csky_rsa_bench_read(struct file *file, char __user *ubuf,
+				   size_t count, loff_t *ppos)
+{
+	struct csky_rsa_dev *dd = file->private_data;
+	ssize_t ret;
+
+	mutex_lock(&dd->bench.lock);
+	ret = simple_read_from_buffer(ubuf, count, ppos, dd->bench.result,
+				      strlen(dd->bench.result));
+	mutex_unlock(&dd->bench.lock);
+
+	return ret;
+}
+
+/* A DER encoded RSAPrivateKey, as set_priv_key takes it, in one write */
+static ssize_t csky_rsa_bench_key_write(struct file *file,
+					const char __user *ubuf,
+					size_t count, loff_t *ppos)
+{
+	struct csky_rsa_dev *dd = file->private_data;
+	void *key;
+
+	if (*ppos || !count || count > RSA_BENCH_MAX_KEY)
+		return -EINVAL;
+
+	key = memdup_user(ubuf, count);
+	if (IS_ERR(key))
+		return PTR_ERR(key);
+
+	mutex_lock(&dd->bench.lock);
+	kzfree(dd->bench.key);
+	dd->bench.key = key;
+	dd->bench.keylen = count;
+	mutex_unlock(&dd->bench.lock);
+
+	return count;
+}
+
+static const struct file_operations csky_rsa_bench_ops = {
+	.write	= csky_rsa_bench_write,
+	.read	= csky_rsa_bench_read,
+	.open	= simple_open,
+	.llseek	= default_llseek,
+};
+
+static const struct file_operations csky_rsa_bench_key_ops = {
+	.write	= csky_rsa_bench_key_write,
+	.open	= simple_open,
+	.llseek	= default_llseek,
+};
+
+static void csky_rsa_add_debugfs(struct csky_rsa_dev *dd)
+{
+	if (!debugfs_initialized())
+		return;
+
+	if (!csky_rsa_debugfs_root)
+		csky_rsa_debugfs_root = debugfs_create_dir("csky_rsa", NULL);
+	if (!csky_rsa_debugfs_root)
+		return;
+
+	dd->debugfs = debugfs_create_dir(dev_name(dd->dev),
+					 csky_rsa_debugfs_root);
+	if (!dd->debugfs)
+		return;
+
+	debugfs_create_file("bench_key", 0200, dd->debugfs, dd,
+			    &csky_rsa_bench_key_ops);
+	debugfs_create_file("bench", 0600, dd->debugfs, dd,
+			    &csky_rsa_bench_ops);
+}
+
 static int csky_rsa_probe(struct platform_device *pdev)
 {
 	struct csky_rsa_dev *rsa_dd;
@@ -1271,6 +1672,7 @@ static int csky_rsa_probe(struct platform_device *pdev)
 
 	INIT_LIST_HEAD(&rsa_dd->list);
 	spin_lock_init(&rsa_dd->lock);
+	mutex_init(&rsa_dd->bench.lock);
 
 	tasklet_init(&rsa_dd->done_task,
 		     csky_rsa_done_task, (unsigned long)rsa_dd);
@@ -1289,18 +1691,41 @@ static int csky_rsa_probe(struct platform_device *pdev)
 		goto res_err;
 	}
 
+	rsa_dd->irq = platform_get_irq(pdev, 0);
+	if (rsa_dd->irq > 0) {
+		err = devm_request_irq(dev, rsa_dd->irq, csky_rsa_irq, 0,
+				       dev_name(dev), rsa_dd);
+		if (err) {
+			dev_err(dev, "unable to request irq %d.\n",
+				rsa_dd->irq);
+			goto res_err;
+		}
+	} else {
+		dev_warn(dev, "no irq, falling back to polled mode.\n");
+	}
+
 	spin_lock(&csky_rsa.lock);
 	list_add_tail(&rsa_dd->list, &csky_rsa.dev_list);
 	spin_unlock(&csky_rsa.lock);
 
+	rsa_dd->work = devm_kzalloc(dev, sizeof(*rsa_dd->work), GFP_KERNEL);
+	if (!rsa_dd->work) {
+		err = -ENOMEM;
+		goto err_algs;
+	}
+
 	rsa_dd->buf = (void *)__get_free_pages(GFP_KERNEL, 1);
-	if (!rsa_dd->buf)
+	if (!rsa_dd->buf) {
+		err = -ENOMEM;
 		goto err_algs;
+	}
 
 	err = csky_rsa_register_algs(rsa_dd);
 	if (err)
 		goto err_algs;
 
+	csky_rsa_add_debugfs(rsa_dd);
+
 	dev_info(dev, "CSKY RSA Driver Initialized\n");
 
 	return 0;
@@ -1328,6 +1753,9 @@ static int csky_rsa_remove(struct platform_device *pdev)
 	list_del(&rsa_dd->list);
 	spin_unlock(&csky_rsa.lock);
 
+	debugfs_remove_recursive(rsa_dd->debugfs);
+	kzfree(rsa_dd->bench.key);
+
 	tasklet_kill(&rsa_dd->done_task);
 	csky_rsa_unregister_algs(rsa_dd);
 	free_page((unsigned long)rsa_dd->buf);
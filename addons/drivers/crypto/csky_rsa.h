@@ -39,14 +39,24 @@ struct rsa_reg {
 	uint32_t rsa_rfr;
 };
 
-#define RSA_KEY_LEN	1024
+/* Widest modulus the 64-word register files hold */
+#define RSA_KEY_LEN	2048
+#define RSA_HW_MAX_WORDS	(RSA_KEY_LEN >> 5)
 
-#define BN_MAX_BITS	((RSA_KEY_LEN << 1) + 32)
+/* Private keys up to twice that width run through CRT on the engine */
+#define RSA_MAX_KEY_LEN	(RSA_KEY_LEN << 1)
+
+#define BN_MAX_BITS	RSA_MAX_KEY_LEN
 #define BN_MAX_BYTES	((BN_MAX_BITS + 7) >> 3)
 #define BN_MAX_WORDS	((BN_MAX_BYTES + 3) >> 2)
 
 #define MAX_RSA_LP_CNT	10000
 
+/* rsa_isr / rsa_imr bits */
+#define RSA_ISR_DONE	BIT(0)
+#define RSA_ISR_ERR	0x1E
+#define RSA_ISR_CAL_Q	BIT(5)
+
 #define UINT32_TO_UINT64(data)	\
 	((uint64_t)(((uint64_t)(data)) & 0x00000000ffffffffU))
 #define UINT64L_TO_UINT32(data)	\
@@ -32,16 +32,15 @@
 #include <crypto/sha.h>
 #include <crypto/hash.h>
 #include <crypto/internal/hash.h>
+#include <asm/unaligned.h>
 #include "csky_sha.h"
+#include "csky_engine.h"
 
 /* SHA flags */
-#define SHA_FLAGS_BUSY		BIT(0)
-#define SHA_FLAGS_OUTPUT_READY  BIT(1)
-#define SHA_FLAGS_INIT		BIT(2)
-#define SHA_FLAGS_CPU		BIT(3)
+#define SHA_FLAGS_CALC		BIT(1)
 
 #define SHA_FLAGS_FINUP		BIT(16)
-#define SHA_FLAGS_FINAL		BIT(17)
+#define SHA_FLAGS_FALLBACK	BIT(17)
 #define SHA_FLAGS_ALGO_MASK	GENMASK(22, 18)
 #define SHA_FLAGS_SHA1		BIT(18)
 #define SHA_FLAGS_SHA224	BIT(19)
@@ -50,71 +49,67 @@
 #define SHA_FLAGS_SHA512	BIT(22)
 #define SHA_FLAGS_ERROR		BIT(23)
 #define SHA_FLAGS_PAD		BIT(24)
+#define SHA_FLAGS_HMAC		BIT(25)
+#define SHA_FLAGS_HMAC_OUTER	BIT(26)
 
 #define SHA_OP_UPDATE		1
 #define SHA_OP_FINAL		2
 
-#define SHA_BUFFER_LEN		(PAGE_SIZE / 16)
-
 #define CSKY_SHA_QUEUE_LENGTH	10
 
-struct csky_sha_dev;
+/* Busy-wait iterations on SHA_CON before arming the interrupt */
+#define CSKY_SHA_POLL_CNT	32
+
+/* Chaining words H0..H7; SHA-384/512 words are stored high half first */
+#define SHA_STATE_WORDS		(SHA512_DIGEST_SIZE / sizeof(u32))
 
 struct csky_sha_reqctx {
-	struct csky_sha_dev *dd;
 	unsigned long	     flags;
 	unsigned long	     op;
 
-	uint8_t	 digest[SHA512_DIGEST_SIZE] __aligned(sizeof(u32));
-	uint64_t digcnt;
-	size_t	 bufcnt;
-	size_t	 buflen;
-	size_t	 block_size;
-
-	uint32_t endian_flag;
-	size_t	 last_left;
+	uint32_t   state[SHA_STATE_WORDS];
+	uint64_t   digcnt;
+	size_t	   bufcnt;
+	size_t	   block_size;
+	sha_mode_t mode;
 
-	struct scatterlist *sg;
-	unsigned int	    offset;
+	struct scatter_walk walk;
 	unsigned int	    total;
 
-	uint8_t  buffer[SHA_BUFFER_LEN+SHA512_BLOCK_SIZE] __aligned(sizeof(u32));
+	/* Partial block carried between updates, or the final padding */
+	uint8_t  buffer[SHA512_BLOCK_SIZE * 2] __aligned(sizeof(u32));
 
+	/* Continued hashes, see csky_sha_fallback_init(); must stay last */
+	struct shash_desc fallback;
 };
 
 struct csky_sha_ctx {
-	struct csky_sha_dev *dd;
+	unsigned long	     flags;
+
+	struct crypto_shash *fallback;
+
+	/* hmac(): the key xor'ed with ipad/opad, fed ahead of each hash */
+	struct crypto_shash *hmac_tfm;
+	uint8_t		     ipad[SHA512_BLOCK_SIZE] __aligned(sizeof(u32));
+	uint8_t		     opad[SHA512_BLOCK_SIZE] __aligned(sizeof(u32));
 };
 
 struct csky_sha_dev {
-	struct list_head	 list;
+	struct csky_engine	 engine;
 	struct device		*dev;
 	struct sha_reg __iomem  *io_base;
-	spinlock_t		 lock;
-	struct tasklet_struct	 done_task;
+	int			 irq;
 
 	unsigned long		 flags;
-	struct crypto_queue	 queue;
 	struct ahash_request	 *req;
 };
 
-struct csky_sha_drv {
-	struct list_head dev_list;
-	spinlock_t	 lock;
-};
-
-static struct csky_sha_drv csky_sha = {
-	.dev_list = LIST_HEAD_INIT(csky_sha.dev_list),
-	.lock 	  = __SPIN_LOCK_UNLOCKED(csky_sha.lock),
-};
+static struct csky_engine_class csky_sha_engines =
+	CSKY_ENGINE_CLASS_INIT(csky_sha_engines, "sha");
 
 static inline void csky_sha_set_mode(struct csky_sha_dev *dd, sha_mode_t mode)
 {
-	uint32_t tmp;
-
-	tmp  = readl_relaxed(&dd->io_base->SHA_CON);
-	tmp  = mode;
-	writel_relaxed(tmp, &dd->io_base->SHA_CON);
+	writel_relaxed(mode, &dd->io_base->SHA_CON);
 }
 
 static inline void csky_sha_enable_init(struct csky_sha_dev *dd)
@@ -144,9 +139,14 @@ static inline void csky_sha_enable_int(struct csky_sha_dev *dd)
 	writel_relaxed(tmp, &dd->io_base->SHA_CON);
 }
 
-static inline void csky_sha_message_done(struct csky_sha_dev *dd)
+static inline void csky_sha_disable_int(struct csky_sha_dev *dd)
 {
-	while((readl_relaxed(&dd->io_base->SHA_CON) & CSKY_SHA_DONE) != 0);
+	uint32_t tmp;
+
+	tmp  = readl_relaxed(&dd->io_base->SHA_CON);
+	tmp &= ~(1 << CSKY_SHA_INT);
+	writel_relaxed(tmp, &dd->io_base->SHA_CON);
+	writel_relaxed(0, &dd->io_base->SHA_INTSTATE);
 }
 
 static inline void csky_sha_set_endian(struct csky_sha_dev *dd,
@@ -159,73 +159,52 @@ static inline void csky_sha_set_endian(struct csky_sha_dev *dd,
 	writel_relaxed(tmp, &dd->io_base->SHA_CON);
 }
 
+/*
+ * Write one block into the data window. The source is only read, so it
+ * may be the caller's own page: the byte swap happens on the way out.
+ */
 static inline void csky_sha_input_data(struct csky_sha_dev *dd,
-					uint32_t *data, uint32_t length)
+					const uint32_t *data, uint32_t length)
 {
+	uint32_t __iomem *input_data = &dd->io_base->SHA_DATA1;
 	uint32_t i;
-	uint32_t input_data = (uint32_t)&dd->io_base->SHA_DATA1;
-	uint32_t tmp;
-	for (i=0; i<length; i++) {
+
+	for (i = 0; i < length; i++) {
 	#ifdef __LITTLE_ENDIAN
-		tmp = *(uint32_t *)(data + i);
-		*(uint32_t *)(data + i) = (((tmp & 0xff000000) >> 24) | \
-					   ((tmp & 0x00ff0000) >> 8)  | \
-					   ((tmp & 0x0000ff00) << 8)  | \
-					   ((tmp & 0x000000ff) << 24));
+		writel_relaxed(swab32(data[i]), input_data + i);
+	#else
+		writel_relaxed(data[i], input_data + i);
 	#endif
-		writel_relaxed(*(data + i), (void *)input_data);
-		input_data += 4;
-	}
-}
-
-static inline void csky_sha_reverse_order(uint8_t *pdata, int length)
-{
-	uint32_t wlen = length >> 2;
-	uint32_t result = 0;
-	uint32_t tmp_data[SHA512_DIGEST_SIZE>>2];
-	int i = 0;
-
-	memcpy((void *)tmp_data, (void *)pdata, length);
-	for (i = 0; i < wlen; i++) {
-		result = (((tmp_data[i] & 0xff000000) >> 24) | \
-			  ((tmp_data[i] & 0x00ff0000) >> 8)  | \
-			  ((tmp_data[i] & 0x0000ff00) << 8)  | \
-			  ((tmp_data[i] & 0x000000ff) << 24));
-
-		tmp_data[i] = result;
 	}
-	memcpy((void *)pdata, (void *)tmp_data, length);
 }
 
-static inline void csky_sha_get_data(struct csky_sha_dev *dd,
-				     uint32_t *data, uint32_t size)
+static void csky_sha_save_state(struct csky_sha_dev *dd,
+				struct csky_sha_reqctx *ctx)
 {
-	uint32_t result_l = (uint32_t)&dd->io_base->SHA_H0L;
-	uint32_t result_h = (uint32_t)&dd->io_base->SHA_H0H;
-	uint32_t i;
+	uint32_t __iomem *result_l = &dd->io_base->SHA_H0L;
+	uint32_t __iomem *result_h = &dd->io_base->SHA_H0H;
+	int i;
 
-	if (size >= (SHA384_DIGEST_SIZE/4)) {
-		for (i = 0; i < size/2; i++) {
-		    data[i << 1]       = readl_relaxed((void *)result_h);
-		    data[(i << 1) + 1] = readl_relaxed((void *)result_l);
-		    result_l += 4;
-		    result_h += 4;
+	if (ctx->block_size == SHA512_BLOCK_SIZE) {
+		for (i = 0; i < 8; i++) {
+			ctx->state[i << 1]	 = readl_relaxed(result_h + i);
+			ctx->state[(i << 1) + 1] = readl_relaxed(result_l + i);
 		}
 	} else {
-		for (i = 0; i < size; i++) {
-			data[i] = readl_relaxed((void *)result_l);
-			result_l += 4;
-		}
+		for (i = 0; i < 8; i++)
+			ctx->state[i] = readl_relaxed(result_l + i);
 	}
-
-	csky_sha_reverse_order((uint8_t *)data, size  << 2);
 }
 
-static void csky_sha_start(struct csky_sha_reqctx *ctx, sha_mode_t mode)
+/*
+ * Every hash on the engine starts from the hardware IV: there is no
+ * documented way to load a saved H0..H7, so continued hashes are left to
+ * the software fallback.
+ */
+static void csky_sha_start(struct csky_sha_dev *dd,
+			   struct csky_sha_reqctx *ctx)
 {
-	struct csky_sha_dev *dd = ctx->dd;
-
-	csky_sha_set_mode(dd, mode);
+	csky_sha_set_mode(dd, ctx->mode);
 #ifdef __LITTLE_ENDIAN
 	csky_sha_set_endian(dd, SHA_LITTLE_ENDIAN);
 #else
@@ -234,418 +213,387 @@ static void csky_sha_start(struct csky_sha_reqctx *ctx, sha_mode_t mode)
 	csky_sha_enable_init(dd);
 }
 
-static size_t csky_sha_append_sg(struct csky_sha_reqctx *ctx)
+/* hmac(): the key block opens the inner and the outer hash */
+static void csky_sha_start_hmac(struct csky_sha_dev *dd,
+				struct csky_sha_reqctx *ctx,
+				const uint8_t *pad)
 {
-	size_t count;
-
-	while ((ctx->bufcnt < ctx->buflen) && ctx->total) {
-		count = min(ctx->sg->length - ctx->offset, ctx->total);
-		count = min(count, ctx->buflen - ctx->bufcnt);
-
-		if (count <= 0) {
-			if ((ctx->sg->length == 0) && !sg_is_last(ctx->sg)) {
-				ctx->sg = sg_next(ctx->sg);
-				continue;
-			} else
-				break;
-		}
-
-		scatterwalk_map_and_copy(ctx->buffer + ctx->bufcnt, ctx->sg,
-					 ctx->offset, count, 0);
-
-		ctx->bufcnt += count;
-		ctx->offset += count;
-		ctx->total  -= count;
-
-		if (ctx->offset == ctx->sg->length) {
-			ctx->sg = sg_next(ctx->sg);
-			if (ctx->sg)
-				ctx->offset = 0;
-			else
-				ctx->total = 0;
-		}
-	}
-
-	return 0;
+	csky_sha_start(dd, ctx);
+	csky_sha_input_data(dd, (const uint32_t *)pad, ctx->block_size >> 2);
+	csky_sha_enable_calc(dd);
+	dd->flags |= SHA_FLAGS_CALC;
+	ctx->digcnt += ctx->block_size;
 }
 
-static void csky_sha_flush_padding(struct csky_sha_reqctx *ctx,
-				   uint8_t *pad_buf, uint32_t pad_size)
+static void csky_sha_walk_copy(struct csky_sha_reqctx *ctx, uint8_t *buf,
+			       size_t count)
 {
-	uint32_t block_size = ctx->block_size;
-	uint32_t left_len;
-	uint32_t left = ctx->digcnt & (block_size - 1);
-	uint32_t fill = block_size - left;
-	uint32_t len  = pad_size;
-	uint32_t i;
+	scatterwalk_copychunks(buf, &ctx->walk, count, 0);
+	ctx->total -= count;
+	scatterwalk_done(&ctx->walk, 0, ctx->total);
+}
 
-	if ((block_size == SHA512_BLOCK_SIZE) ||
-		(block_size == SHA384_BLOCK_SIZE))
-		left_len = len & 0x7F;
-	else
-		left_len = len & 0x3F;
+static void csky_sha_fill_padding(struct csky_sha_reqctx *ctx)
+{
+	size_t block_size = ctx->block_size;
+	size_t pad_rsvr = (block_size == SHA512_BLOCK_SIZE) ? 16 : 8;
+	size_t padn = (ctx->bufcnt < block_size - pad_rsvr) ?
+			block_size : block_size * 2;
+	__be64 bits = cpu_to_be64(ctx->digcnt << 3);
 
-	ctx->bufcnt += len;
+	memset(ctx->buffer + ctx->bufcnt, 0, padn - ctx->bufcnt);
+	ctx->buffer[ctx->bufcnt] = 0x80;
+	memcpy(ctx->buffer + padn - sizeof(bits), &bits, sizeof(bits));
 
-	if (len >= fill) {
-		memcpy((void *)(ctx->buffer + left), pad_buf, fill);
-		if ((len - fill) >= block_size)
-			memcpy((void *)(ctx->buffer + left + fill),
-				&pad_buf[fill], len - fill);
-	}
+	ctx->bufcnt = padn;
+	ctx->flags |= SHA_FLAGS_PAD;
 }
 
-static void csky_sha_fill_padding(struct csky_sha_reqctx *ctx)
+/*
+ * Load the next complete block into the engine. Blocks lying word-aligned
+ * within one page go straight from the caller's scatterlist; only blocks
+ * that straddle a page boundary, the partial tail and the padding pass
+ * through ctx->buffer. Returns false once no complete block is left.
+ */
+static bool csky_sha_next_block(struct csky_sha_dev *dd,
+				struct csky_sha_reqctx *ctx)
 {
-	uint32_t block_size = ctx->block_size;
-	uint32_t total_length = ctx->digcnt << 3;
-	uint32_t last = ctx->digcnt & (block_size - 1);
-	uint32_t pad_rsvr = (ctx->block_size >= SHA384_BLOCK_SIZE) ? 16 : 8;
-	uint32_t padn = (last < block_size - pad_rsvr) ?
-			(block_size - last) : (block_size * 2 - last);
-	uint32_t left = ctx->digcnt & 0x3;
-	uint8_t  temp[4];
-	uint8_t  sha_padding[SHA512_BLOCK_SIZE*2] = {0};
-	uint32_t i;
-
-	for (i = 0;  i < 4; i++)
-		temp[i] = (total_length >> (8 * i)) & 0xff;
+	size_t bs = ctx->block_size;
+	size_t count;
+	uint8_t *vaddr;
+
+	if (ctx->flags & SHA_FLAGS_PAD)
+		goto pad;
+
+	if (!ctx->bufcnt && ctx->total >= bs) {
+		if (scatterwalk_pagelen(&ctx->walk) >= bs &&
+		    IS_ALIGNED(ctx->walk.offset, sizeof(u32))) {
+			vaddr = scatterwalk_map(&ctx->walk);
+			csky_sha_input_data(dd, (uint32_t *)vaddr, bs >> 2);
+			scatterwalk_unmap(vaddr);
+			scatterwalk_advance(&ctx->walk, bs);
+			ctx->total -= bs;
+			scatterwalk_done(&ctx->walk, 0, ctx->total);
+		} else {
+			csky_sha_walk_copy(ctx, ctx->buffer, bs);
+			csky_sha_input_data(dd, (uint32_t *)ctx->buffer, bs >> 2);
+		}
+		ctx->digcnt += bs;
+		return true;
+	}
 
-	memset(sha_padding, 0x0, SHA512_BLOCK_SIZE*2);
+	count = min_t(size_t, ctx->total, bs - ctx->bufcnt);
+	if (count) {
+		csky_sha_walk_copy(ctx, ctx->buffer + ctx->bufcnt, count);
+		ctx->bufcnt += count;
+		ctx->digcnt += count;
+	}
 
-	sha_padding[0] = 0x80;
+	if (ctx->bufcnt == bs) {
+		csky_sha_input_data(dd, (uint32_t *)ctx->buffer, bs >> 2);
+		ctx->bufcnt = 0;
+		return true;
+	}
 
-	for (i = 0; i < 4; i++)
-		sha_padding[padn - 4 + i] = temp[3 - i];
+	if (!(ctx->flags & SHA_FLAGS_FINUP))
+		return false;
 
-	csky_sha_flush_padding(ctx, sha_padding, padn);
+	csky_sha_fill_padding(ctx);
+pad:
+	if (!ctx->bufcnt)
+		return false;
 
-	ctx->flags |= SHA_FLAGS_PAD;
+	csky_sha_input_data(dd, (uint32_t *)ctx->buffer, bs >> 2);
+	ctx->bufcnt -= bs;
+	if (ctx->bufcnt)
+		memcpy(ctx->buffer, ctx->buffer + bs, bs);
 
+	return true;
 }
 
-static int csky_sha_init(struct ahash_request *req)
+static int csky_sha_setup_reqctx(struct ahash_request *req)
 {
 	struct crypto_ahash *tfm = crypto_ahash_reqtfm(req);
 	struct csky_sha_ctx *tctx = crypto_ahash_ctx(tfm);
 	struct csky_sha_reqctx *ctx = ahash_request_ctx(req);
-	struct csky_sha_dev *dd = NULL;
-	struct csky_sha_dev *tmp;
-	sha_mode_t mode;
 
-	spin_lock_bh(&csky_sha.lock);
-	if (!tctx->dd) {
-		list_for_each_entry(tmp, &csky_sha.dev_list, list) {
-			dd = tmp;
-			break;
-		}
-		tctx->dd = dd;
-	} else
-		dd = tctx->dd;
-	spin_unlock_bh(&csky_sha.lock);
-
-	ctx->dd = dd;
-	ctx->flags = 0;
-
-	dev_dbg(dd->dev, "digest size: %d\n", crypto_ahash_digestsize(tfm));
+	ctx->flags &= ~(SHA_FLAGS_ALGO_MASK | SHA_FLAGS_HMAC);
+	ctx->flags |= tctx->flags & SHA_FLAGS_HMAC;
 
 	switch (crypto_ahash_digestsize(tfm)) {
 	case SHA1_DIGEST_SIZE:
 		ctx->flags 	|= SHA_FLAGS_SHA1;
 		ctx->block_size  = SHA1_BLOCK_SIZE;
-		mode 		 = SHA_1;
+		ctx->mode 	 = SHA_1;
 		break;
 	case SHA224_DIGEST_SIZE:
 		ctx->flags 	|= SHA_FLAGS_SHA224;
 		ctx->block_size  = SHA224_BLOCK_SIZE;
-		mode 		 = SHA_224;
+		ctx->mode 	 = SHA_224;
 		break;
 	case SHA256_DIGEST_SIZE:
 		ctx->flags 	|= SHA_FLAGS_SHA256;
 		ctx->block_size  = SHA256_BLOCK_SIZE;
-		mode 		 = SHA_256;
+		ctx->mode 	 = SHA_256;
 		break;
 	case SHA384_DIGEST_SIZE:
 		ctx->flags 	|= SHA_FLAGS_SHA384;
 		ctx->block_size  = SHA384_BLOCK_SIZE;
-		mode 		 = SHA_384;
+		ctx->mode 	 = SHA_384;
 		break;
 	case SHA512_DIGEST_SIZE:
 		ctx->flags 	|= SHA_FLAGS_SHA512;
 		ctx->block_size  = SHA512_BLOCK_SIZE;
-		mode 		 = SHA_512;
+		ctx->mode 	 = SHA_512;
 		break;
 	default:
 		return -EINVAL;
-		break;
 	}
 
+	return 0;
+}
+
+static int csky_sha_init(struct ahash_request *req)
+{
+	struct csky_sha_reqctx *ctx = ahash_request_ctx(req);
+
+	ctx->flags  = 0;
 	ctx->bufcnt = 0;
 	ctx->digcnt = 0;
-	ctx->buflen = ctx->block_size;
-	ctx->last_left = 0;
 	ctx->total  = 0;
 
-	csky_sha_start(ctx, mode);
-
-	return 0;
+	return csky_sha_setup_reqctx(req);
 }
 
-static int csky_sha_xmit_cpu(struct csky_sha_dev *dd, const uint8_t *buf,
-			     size_t length, int final)
+/*
+ * The engine only hashes messages it sees whole, from one request. Once
+ * a caller goes beyond what fits in ctx->buffer before finishing, or
+ * exports the state, the hash moves to the generic implementation and
+ * stays there; the bytes buffered so far are replayed into it.
+ */
+static int csky_sha_fallback_init(struct ahash_request *req)
 {
-	struct csky_sha_reqctx *ctx = ahash_request_ctx(dd->req);
-	int count, len32;
-
-	dev_dbg(dd->dev, "xmit_cpu: digcnt: 0x%llx, length: %d, final: %d\n",
-		 ctx->digcnt, length, final);
+	struct csky_sha_ctx *tctx = crypto_tfm_ctx(req->base.tfm);
+	struct csky_sha_reqctx *ctx = ahash_request_ctx(req);
+	struct shash_desc *desc = &ctx->fallback;
+	int err;
 
-	if (final)
-		dd->flags |= SHA_FLAGS_FINAL;
+	if (ctx->flags & SHA_FLAGS_FALLBACK)
+		return 0;
 
-	len32 = DIV_ROUND_UP(length, sizeof(u32));
+	desc->tfm   = tctx->fallback;
+	desc->flags = req->base.flags & CRYPTO_TFM_REQ_MAY_SLEEP;
 
-	dd->flags |= SHA_FLAGS_CPU;
+	err = crypto_shash_init(desc) ?:
+	      crypto_shash_update(desc, ctx->buffer, ctx->bufcnt);
+	if (err)
+		return err;
 
-	for (count = 0; count < length; count += ctx->block_size) {
-		csky_sha_input_data(dd, (uint32_t *)&ctx->buffer[count],
-				    ctx->block_size >> 2);
-		csky_sha_enable_calc(dd);
-		csky_sha_message_done(dd);
-	}
+	ctx->flags |= SHA_FLAGS_FALLBACK;
+	ctx->bufcnt = 0;
 
 	return 0;
 }
 
-static int csky_sha_update_req(struct csky_sha_dev *dd)
+static void csky_sha_copy_ready_hash(struct ahash_request *req)
 {
-	struct ahash_request   *req = dd->req;
 	struct csky_sha_reqctx *ctx = ahash_request_ctx(req);
-	int err = 0;
-	int bufcnt;
-	uint32_t last_total = 0;
-
-	if (ctx->flags & SHA_FLAGS_FINUP) {
-		ctx->digcnt += ctx->total;
-		while (ctx->total >= ctx->buflen) {
-			csky_sha_append_sg(ctx);
-			bufcnt = ctx->bufcnt;
-			ctx->bufcnt = 0;
-			err = csky_sha_xmit_cpu(dd, ctx->buffer, bufcnt, 0);
-			if (err != 0)
-				return err;
-		}
-	} else {
-		while ((ctx->total + ctx->bufcnt) >= ctx->buflen) {
-			last_total = ctx->total;
-			csky_sha_append_sg(ctx);
-			bufcnt = ctx->bufcnt;
-			ctx->bufcnt = 0;
-			ctx->digcnt += bufcnt?(last_total-ctx->total):bufcnt;
-			last_total = ctx->total;
-			err = csky_sha_xmit_cpu(dd, ctx->buffer, bufcnt, 0);
-			if (err != 0)
-				return err;
-		}
+	unsigned int ds = crypto_ahash_digestsize(crypto_ahash_reqtfm(req));
+	int i;
 
-		if (ctx->total > 0) {
-			ctx->digcnt += ctx->total;
-			csky_sha_append_sg(ctx);
-		}
-	}
+	if (!req->result)
+		return;
 
-	return err;
+	for (i = 0; i < ds / sizeof(u32); i++)
+		put_unaligned_be32(ctx->state[i], req->result + i * sizeof(u32));
 }
 
-static int csky_sha_final_req(struct csky_sha_dev *dd)
+/*
+ * hmac(): once the inner hash is padded and done, turn the same request
+ * into the outer hash. The engine restarts on the opad block and the
+ * inner digest becomes the message, so no second request is needed.
+ */
+static bool csky_sha_hmac_outer(struct csky_sha_dev *dd,
+				struct csky_sha_reqctx *ctx)
 {
-	struct ahash_request   *req = dd->req;
-	struct csky_sha_reqctx *ctx = ahash_request_ctx(req);
-	int err = 0;
-	int bufcnt;
-
-	if (ctx->total != 0)
-		csky_sha_append_sg(ctx);
-
-	csky_sha_fill_padding(ctx);
-
-	bufcnt = ctx->bufcnt;
-	ctx->bufcnt = 0;
-	err = csky_sha_xmit_cpu(dd, ctx->buffer, bufcnt, 1);
-
-	dd->flags |= SHA_FLAGS_OUTPUT_READY;
+	struct ahash_request *req = dd->req;
+	struct csky_sha_ctx *tctx = crypto_tfm_ctx(req->base.tfm);
+	unsigned int ds = crypto_ahash_digestsize(crypto_ahash_reqtfm(req));
+	int i;
 
-	tasklet_schedule(&dd->done_task);
+	if ((ctx->flags & (SHA_FLAGS_HMAC | SHA_FLAGS_PAD |
+			   SHA_FLAGS_HMAC_OUTER)) !=
+	    (SHA_FLAGS_HMAC | SHA_FLAGS_PAD))
+		return false;
 
-	return err;
-}
+	for (i = 0; i < ds / sizeof(u32); i++)
+		put_unaligned_be32(ctx->state[i], ctx->buffer + i * sizeof(u32));
 
-static void csky_sha_copy_hash(struct ahash_request *req)
-{
-	struct csky_sha_reqctx *ctx = ahash_request_ctx(req);
-	uint32_t *hash = (uint32_t *)ctx->digest;
-	uint32_t hashsize;
+	ctx->bufcnt = ds;
+	ctx->digcnt = ds;
+	ctx->flags &= ~SHA_FLAGS_PAD;
+	ctx->flags |= SHA_FLAGS_HMAC_OUTER;
 
-	switch (ctx->flags & SHA_FLAGS_ALGO_MASK) {
-	case SHA_FLAGS_SHA1:
-		hashsize = SHA1_DIGEST_SIZE;
-		break;
-	case SHA_FLAGS_SHA224:
-		hashsize = SHA224_DIGEST_SIZE;
-		break;
-	case SHA_FLAGS_SHA256:
-		hashsize = SHA256_DIGEST_SIZE;
-		break;
-	case SHA_FLAGS_SHA384:
-		hashsize = SHA384_DIGEST_SIZE;
-		break;
-	case SHA_FLAGS_SHA512:
-		hashsize = SHA512_DIGEST_SIZE;
-		break;
-	default:
-		hashsize = SHA1_DIGEST_SIZE;
-		break;
-	}
+	csky_sha_start_hmac(dd, ctx, tctx->opad);
 
-	csky_sha_get_data(ctx->dd, hash, hashsize >> 2);
+	return true;
 }
 
-static void csky_sha_copy_ready_hash(struct ahash_request *req)
+static inline bool csky_sha_busy(struct csky_sha_dev *dd)
 {
-	struct csky_sha_reqctx *ctx = ahash_request_ctx(req);
-
-	if (!req->result)
-		return;
-
-	if (ctx->flags & SHA_FLAGS_SHA1)
-		memcpy(req->result, ctx->digest, SHA1_DIGEST_SIZE);
-	else if (ctx->flags & SHA_FLAGS_SHA224)
-		memcpy(req->result, ctx->digest, SHA224_DIGEST_SIZE);
-	else if (ctx->flags & SHA_FLAGS_SHA256)
-		memcpy(req->result, ctx->digest, SHA256_DIGEST_SIZE);
-	else if (ctx->flags & SHA_FLAGS_SHA384)
-		memcpy(req->result, ctx->digest, SHA384_DIGEST_SIZE);
-	else
-		memcpy(req->result, ctx->digest, SHA512_DIGEST_SIZE);
+	return readl_relaxed(&dd->io_base->SHA_CON) & CSKY_SHA_DONE;
 }
 
-static int csky_sha_finish(struct ahash_request *req)
+/*
+ * Poll briefly, then arm the interrupt. The block may complete just
+ * before the interrupt is enabled, so the status is read again under
+ * the engine lock, which csky_sha_irq() takes as well: if the engine
+ * went idle meanwhile, the interrupt is taken back and the caller
+ * carries on inline.
+ */
+static int csky_sha_wait(struct csky_sha_dev *dd)
 {
-	struct csky_sha_reqctx *ctx = ahash_request_ctx(req);
-	struct csky_sha_dev 	*dd = ctx->dd;
-
-	csky_sha_copy_ready_hash(req);
-
-	dev_dbg(dd->dev, "digcnt: 0x%llx, bufcnt: %d\n", ctx->digcnt, ctx->bufcnt);
+	int cnt = CSKY_SHA_POLL_CNT;
+	unsigned long flags;
+	bool busy;
+
+	while (csky_sha_busy(dd)) {
+		if (dd->irq > 0 && !--cnt) {
+			spin_lock_irqsave(&dd->engine.lock, flags);
+			csky_sha_enable_int(dd);
+			busy = csky_sha_busy(dd);
+			if (!busy)
+				csky_sha_disable_int(dd);
+			spin_unlock_irqrestore(&dd->engine.lock, flags);
+
+			return busy ? -EINPROGRESS : 0;
+		}
+		cpu_relax();
+	}
 
 	return 0;
 }
 
-static void csky_sha_finish_req(struct ahash_request *req, int err)
+static int csky_sha_finish_req(struct csky_sha_dev *dd, int err)
 {
+	struct ahash_request   *req = dd->req;
 	struct csky_sha_reqctx *ctx = ahash_request_ctx(req);
-	struct csky_sha_dev 	*dd = ctx->dd;
 
-	if (!err) {
-		csky_sha_copy_hash(req);
-		if (SHA_FLAGS_FINAL & dd->flags)
-			err = csky_sha_finish(req);
-	} else
+	if (err)
 		ctx->flags |= SHA_FLAGS_ERROR;
+	else if (ctx->flags & SHA_FLAGS_PAD)
+		csky_sha_copy_ready_hash(req);
 
-	dd->flags &= ~(SHA_FLAGS_BUSY | SHA_FLAGS_FINAL | SHA_FLAGS_CPU |
-		       SHA_FLAGS_OUTPUT_READY);
+	dev_dbg(dd->dev, "digcnt: 0x%llx, bufcnt: %zu, err: %d\n",
+		ctx->digcnt, ctx->bufcnt, err);
 
-	if (req->base.complete)
-		req->base.complete(&req->base, err);
+	dd->flags &= ~SHA_FLAGS_CALC;
+
+	return csky_engine_complete(&dd->engine, err);
 }
 
-static int csky_sha_handle_queue(struct csky_sha_dev *dd,
-				 struct ahash_request *req)
+/*
+ * Run the current request block by block. Called first from the
+ * submitter and then, after each interrupt, from the done tasklet; it
+ * returns -EINPROGRESS whenever it has to wait for the engine.
+ */
+static int csky_sha_process(struct csky_sha_dev *dd)
 {
-	struct crypto_async_request *async_req, *backlog;
-	struct csky_sha_reqctx *ctx;
-	unsigned long flags;
-	int err = 0, ret = 0;
+	struct csky_sha_reqctx *ctx = ahash_request_ctx(dd->req);
+	int err;
 
-	spin_lock_irqsave(&dd->lock, flags);
-	if (req)
-		ret = ahash_enqueue_request(&dd->queue, req);
+	for (;;) {
+		if (dd->flags & SHA_FLAGS_CALC) {
+			err = csky_sha_wait(dd);
+			if (err)
+				return err;
+			dd->flags &= ~SHA_FLAGS_CALC;
+		}
 
-	if (SHA_FLAGS_BUSY & dd->flags) {
-		spin_unlock_irqrestore(&dd->lock, flags);
-		return ret;
-	}
+		if (csky_sha_next_block(dd, ctx)) {
+			csky_sha_enable_calc(dd);
+			dd->flags |= SHA_FLAGS_CALC;
+			continue;
+		}
 
-	backlog = crypto_get_backlog(&dd->queue);
-	async_req = crypto_dequeue_request(&dd->queue);
-	if (async_req)
-		dd->flags |= SHA_FLAGS_BUSY;
-	spin_unlock_irqrestore(&dd->lock, flags);
+		csky_sha_save_state(dd, ctx);
+		if (!csky_sha_hmac_outer(dd, ctx))
+			break;
+	}
 
-	if (!async_req)
-		return ret;
+	return csky_sha_finish_req(dd, 0);
+}
 
-	if (backlog)
-		backlog->complete(backlog, -EINPROGRESS);
+static int csky_sha_start_req(struct csky_engine *eng,
+			      struct crypto_async_request *areq)
+{
+	struct csky_sha_dev *dd = container_of(eng, struct csky_sha_dev,
+					       engine);
+	struct csky_sha_ctx *tctx = crypto_tfm_ctx(areq->tfm);
+	struct csky_sha_reqctx *ctx;
 
-	req = ahash_request_cast(async_req);
-	dd->req = req;
-	ctx = ahash_request_ctx(req);
+	dd->req = ahash_request_cast(areq);
+	ctx = ahash_request_ctx(dd->req);
 
 	dev_dbg(dd->dev, "handling new req, op: %lu, nbytes: %d\n",
-						ctx->op, req->nbytes);
-
-	if (ctx->op == SHA_OP_UPDATE) {
-		err = csky_sha_update_req(dd);
-		if (err != -EINPROGRESS && (ctx->flags & SHA_FLAGS_FINUP))
-			err = csky_sha_final_req(dd);
-		else {
-			dd->flags &= ~SHA_FLAGS_BUSY;
-			return 0;
-		}
-	} else if (ctx->op == SHA_OP_FINAL)
-		err = csky_sha_final_req(dd);
+						ctx->op, dd->req->nbytes);
 
-	if (err != -EINPROGRESS)
-		csky_sha_finish_req(req, err);
+	if (ctx->flags & SHA_FLAGS_HMAC)
+		csky_sha_start_hmac(dd, ctx, tctx->ipad);
+	else
+		csky_sha_start(dd, ctx);
 
-	dev_dbg(dd->dev, "exit, err: %d\n", err);
+	return csky_sha_process(dd);
+}
 
-	return ret;
+static int csky_sha_resume(struct csky_engine *eng)
+{
+	return csky_sha_process(container_of(eng, struct csky_sha_dev,
+					     engine));
 }
 
+static const struct csky_engine_ops csky_sha_engine_ops = {
+	.start	= csky_sha_start_req,
+	.resume	= csky_sha_resume,
+};
+
 static int csky_sha_enqueue(struct ahash_request *req, unsigned int op)
 {
 	struct csky_sha_reqctx *ctx = ahash_request_ctx(req);
-	struct csky_sha_ctx   *tctx = crypto_tfm_ctx(req->base.tfm);
-	struct csky_sha_dev     *dd = tctx->dd;
+	struct csky_engine *eng;
+
+	eng = csky_engine_select(&csky_sha_engines);
+	if (!eng)
+		return -ENODEV;
 
 	ctx->op = op;
 
-	return csky_sha_handle_queue(dd, req);
+	return csky_engine_enqueue(eng, &req->base);
 }
 
 static int csky_sha_update(struct ahash_request *req)
 {
 	struct csky_sha_reqctx *ctx = ahash_request_ctx(req);
+	int err;
 
 	if (!req->nbytes)
 		return 0;
 
-	ctx->total  = req->nbytes;
-	ctx->sg	    = req->src;
-	ctx->offset = 0;
-
-	if (ctx->flags & SHA_FLAGS_FINUP)
-		ctx->flags |= SHA_FLAGS_CPU;
-	else if (ctx->bufcnt + ctx->total < ctx->buflen) {
-		ctx->digcnt += ctx->total;
-		csky_sha_append_sg(ctx);
+	/* Less than a block in total: just carry it to the next call */
+	if (!(ctx->flags & SHA_FLAGS_FALLBACK) &&
+	    ctx->bufcnt + req->nbytes < ctx->block_size) {
+		scatterwalk_map_and_copy(ctx->buffer + ctx->bufcnt, req->src,
+					 0, req->nbytes, 0);
+		ctx->bufcnt += req->nbytes;
+		ctx->digcnt += req->nbytes;
 		return 0;
 	}
 
-	return csky_sha_enqueue(req, SHA_OP_UPDATE);
+	err = csky_sha_fallback_init(req);
+	if (err)
+		return err;
+
+	return shash_ahash_update(req, &ctx->fallback);
 }
 
 static int csky_sha_final(struct ahash_request *req)
@@ -657,23 +605,31 @@ static int csky_sha_final(struct ahash_request *req)
 	if (ctx->flags & SHA_FLAGS_ERROR)
 		return 0;
 
+	if (ctx->flags & SHA_FLAGS_FALLBACK)
+		return crypto_shash_final(&ctx->fallback, req->result);
+
+	ctx->total = 0;
+
 	return csky_sha_enqueue(req, SHA_OP_FINAL);
 }
 
 static int csky_sha_finup(struct ahash_request *req)
 {
 	struct csky_sha_reqctx *ctx = ahash_request_ctx(req);
-	int err1, err2;
 
 	ctx->flags |= SHA_FLAGS_FINUP;
 
-	err1 = csky_sha_update(req);
-	if (err1 == -EINPROGRESS || err1 == -EBUSY)
-		return err1;
+	if (ctx->flags & SHA_FLAGS_ERROR)
+		return 0;
+
+	if (ctx->flags & SHA_FLAGS_FALLBACK)
+		return shash_ahash_finup(req, &ctx->fallback);
 
-	err2 = csky_sha_final(req);
+	ctx->total = req->nbytes;
+	if (ctx->total)
+		scatterwalk_start(&ctx->walk, req->src);
 
-	return err1 ?: err2;
+	return csky_sha_enqueue(req, SHA_OP_FINAL);
 }
 
 static int csky_sha_digest(struct ahash_request *req)
@@ -683,28 +639,162 @@ static int csky_sha_digest(struct ahash_request *req)
 
 static int csky_sha_export(struct ahash_request *req, void *out)
 {
-	const struct csky_sha_reqctx *ctx = ahash_request_ctx(req);
+	struct csky_sha_reqctx *ctx = ahash_request_ctx(req);
+	int err;
 
-	memcpy(out, ctx, sizeof(*ctx));
-	return 0;
+	err = csky_sha_fallback_init(req);
+	if (err)
+		return err;
+
+	return crypto_shash_export(&ctx->fallback, out);
 }
 
 static int csky_sha_import(struct ahash_request *req, const void *in)
 {
+	struct csky_sha_ctx *tctx = crypto_tfm_ctx(req->base.tfm);
 	struct csky_sha_reqctx *ctx = ahash_request_ctx(req);
+	int err;
+
+	err = csky_sha_init(req);
+	if (err)
+		return err;
+
+	ctx->fallback.tfm   = tctx->fallback;
+	ctx->fallback.flags = req->base.flags & CRYPTO_TFM_REQ_MAY_SLEEP;
+	ctx->flags |= SHA_FLAGS_FALLBACK;
+
+	return crypto_shash_import(&ctx->fallback, in);
+}
+
+static const char *csky_sha_generic_name(unsigned int digestsize)
+{
+	switch (digestsize) {
+	case SHA1_DIGEST_SIZE:
+		return "sha1-generic";
+	case SHA224_DIGEST_SIZE:
+		return "sha224-generic";
+	case SHA256_DIGEST_SIZE:
+		return "sha256-generic";
+	case SHA384_DIGEST_SIZE:
+		return "sha384-generic";
+	case SHA512_DIGEST_SIZE:
+		return "sha512-generic";
+	default:
+		return NULL;
+	}
+}
+
+static int csky_sha_init_fallback(struct crypto_tfm *tfm,
+				  const char *alg_name)
+{
+	struct csky_sha_ctx *tctx = crypto_tfm_ctx(tfm);
+
+	tctx->fallback = crypto_alloc_shash(alg_name, 0, 0);
+	if (IS_ERR(tctx->fallback))
+		return PTR_ERR(tctx->fallback);
+
+	crypto_ahash_set_reqsize(__crypto_ahash_cast(tfm),
+				 sizeof(struct csky_sha_reqctx) +
+				 crypto_shash_descsize(tctx->fallback));
 
-	memcpy(ctx, in, sizeof(*ctx));
 	return 0;
 }
 
 static int csky_sha_cra_init(struct crypto_tfm *tfm)
 {
-	crypto_ahash_set_reqsize(__crypto_ahash_cast(tfm),
-				 sizeof(struct csky_sha_reqctx));
+	const char *alg_name;
+
+	alg_name = csky_sha_generic_name(
+			crypto_ahash_digestsize(__crypto_ahash_cast(tfm)));
+	if (!alg_name)
+		return -EINVAL;
+
+	return csky_sha_init_fallback(tfm, alg_name);
+}
+
+static void csky_sha_cra_exit(struct crypto_tfm *tfm)
+{
+	struct csky_sha_ctx *tctx = crypto_tfm_ctx(tfm);
+
+	crypto_free_shash(tctx->fallback);
+}
+
+/*
+ * setkey runs outside the engine queue, so a key longer than a block is
+ * hashed in software; the pad blocks are then fed to the engine ahead of
+ * every request. The fallback gets the same key for continued hashes.
+ */
+static int csky_sha_hmac_setkey(struct crypto_ahash *tfm, const uint8_t *key,
+				unsigned int keylen)
+{
+	struct csky_sha_ctx *tctx = crypto_ahash_ctx(tfm);
+	unsigned int bs = crypto_tfm_alg_blocksize(crypto_ahash_tfm(tfm));
+	SHASH_DESC_ON_STACK(shash, tctx->hmac_tfm);
+	int i, err;
+
+	err = crypto_shash_setkey(tctx->fallback, key, keylen);
+	if (err)
+		return err;
+
+	shash->tfm   = tctx->hmac_tfm;
+	shash->flags = crypto_ahash_get_flags(tfm) & CRYPTO_TFM_REQ_MAY_SLEEP;
+
+	memset(tctx->ipad, 0, sizeof(tctx->ipad));
+	if (keylen > bs) {
+		err = crypto_shash_digest(shash, key, keylen, tctx->ipad);
+		shash_desc_zero(shash);
+		if (err)
+			return err;
+	} else {
+		memcpy(tctx->ipad, key, keylen);
+	}
+
+	for (i = 0; i < bs; i++) {
+		tctx->opad[i] = tctx->ipad[i] ^ 0x5c;
+		tctx->ipad[i] ^= 0x36;
+	}
 
 	return 0;
 }
 
+static int csky_sha_hmac_cra_init(struct crypto_tfm *tfm)
+{
+	struct csky_sha_ctx *tctx = crypto_tfm_ctx(tfm);
+	char hmac_name[CRYPTO_MAX_ALG_NAME];
+	const char *alg_name;
+	int err;
+
+	alg_name = csky_sha_generic_name(
+			crypto_ahash_digestsize(__crypto_ahash_cast(tfm)));
+	if (!alg_name)
+		return -EINVAL;
+
+	tctx->hmac_tfm = crypto_alloc_shash(alg_name, 0, 0);
+	if (IS_ERR(tctx->hmac_tfm))
+		return PTR_ERR(tctx->hmac_tfm);
+
+	snprintf(hmac_name, sizeof(hmac_name), "hmac(%s)", alg_name);
+	err = csky_sha_init_fallback(tfm, hmac_name);
+	if (err) {
+		crypto_free_shash(tctx->hmac_tfm);
+		return err;
+	}
+
+	tctx->flags = SHA_FLAGS_HMAC;
+
+	return 0;
+}
+
+static void csky_sha_hmac_cra_exit(struct crypto_tfm *tfm)
+{
+	struct csky_sha_ctx *tctx = crypto_tfm_ctx(tfm);
+
+	crypto_free_shash(tctx->fallback);
+	crypto_free_shash(tctx->hmac_tfm);
+	memzero_explicit(tctx->ipad, sizeof(tctx->ipad));
+	memzero_explicit(tctx->opad, sizeof(tctx->opad));
+}
+
 static struct ahash_alg sha_1_256_algs[] = {
 	{
 		.init	= csky_sha_init,
@@ -716,7 +806,7 @@ static struct ahash_alg sha_1_256_algs[] = {
 		.import = csky_sha_import,
 		.halg = {
 			.digestsize = SHA1_DIGEST_SIZE,
-			.statesize  = sizeof(struct csky_sha_reqctx),
+			.statesize  = sizeof(struct sha1_state),
 			.base = {
 				.cra_name	 = "sha1",
 				.cra_driver_name = "csky-sha1",
@@ -727,6 +817,7 @@ static struct ahash_alg sha_1_256_algs[] = {
 				.cra_alignmask	 = 0,
 				.cra_module	 = THIS_MODULE,
 				.cra_init	 = csky_sha_cra_init,
+				.cra_exit	 = csky_sha_cra_exit,
 			}
 		}
 	},
@@ -740,7 +831,7 @@ static struct ahash_alg sha_1_256_algs[] = {
 		.import	= csky_sha_import,
 		.halg = {
 			.digestsize = SHA256_DIGEST_SIZE,
-			.statesize  = sizeof(struct csky_sha_reqctx),
+			.statesize  = sizeof(struct sha256_state),
 			.base = {
 				.cra_name	 = "sha256",
 				.cra_driver_name = "csky-sha256",
@@ -751,6 +842,7 @@ static struct ahash_alg sha_1_256_algs[] = {
 				.cra_alignmask	 = 0,
 				.cra_module	 = THIS_MODULE,
 				.cra_init	 = csky_sha_cra_init,
+				.cra_exit	 = csky_sha_cra_exit,
 			}
 		}
 	},
@@ -766,7 +858,7 @@ static struct ahash_alg sha_224_alg = {
 	.import	= csky_sha_import,
 	.halg = {
 		.digestsize = SHA224_DIGEST_SIZE,
-		.statesize  = sizeof(struct csky_sha_reqctx),
+		.statesize  = sizeof(struct sha256_state),
 		.base   = {
 			.cra_name	 = "sha224",
 			.cra_driver_name = "csky-sha224",
@@ -777,6 +869,7 @@ static struct ahash_alg sha_224_alg = {
 			.cra_alignmask	 = 0,
 			.cra_module	 = THIS_MODULE,
 			.cra_init	 = csky_sha_cra_init,
+			.cra_exit	 = csky_sha_cra_exit,
 		}
 	}
 };
@@ -792,7 +885,7 @@ static struct ahash_alg sha_384_512_algs[] = {
 		.import	= csky_sha_import,
 		.halg = {
 			.digestsize = SHA384_DIGEST_SIZE,
-			.statesize  = sizeof(struct csky_sha_reqctx),
+			.statesize  = sizeof(struct sha512_state),
 			.base = {
 				.cra_name	 = "sha384",
 				.cra_driver_name = "csky-sha384",
@@ -803,6 +896,7 @@ static struct ahash_alg sha_384_512_algs[] = {
 				.cra_alignmask	 = 0x3,
 				.cra_module	 = THIS_MODULE,
 				.cra_init	 = csky_sha_cra_init,
+				.cra_exit	 = csky_sha_cra_exit,
 			}
 		}
 	},
@@ -816,7 +910,7 @@ static struct ahash_alg sha_384_512_algs[] = {
 		.import	= csky_sha_import,
 		.halg = {
 			.digestsize = SHA512_DIGEST_SIZE,
-			.statesize  = sizeof(struct csky_sha_reqctx),
+			.statesize  = sizeof(struct sha512_state),
 			.base = {
 				.cra_name	 = "sha512",
 				.cra_driver_name = "csky-sha512",
@@ -827,21 +921,160 @@ static struct ahash_alg sha_384_512_algs[] = {
 				.cra_alignmask	 = 0x3,
 				.cra_module	 = THIS_MODULE,
 				.cra_init	 = csky_sha_cra_init,
+				.cra_exit	 = csky_sha_cra_exit,
 			}
 		}
 	},
 };
 
-static void csky_sha_done_task(unsigned long data)
-{
-	struct csky_sha_dev *dd = (struct csky_sha_dev *)data;
+static struct ahash_alg sha_hmac_algs[] = {
+	{
+		.init	= csky_sha_init,
+		.update	= csky_sha_update,
+		.final	= csky_sha_final,
+		.finup	= csky_sha_finup,
+		.digest	= csky_sha_digest,
+		.export	= csky_sha_export,
+		.import	= csky_sha_import,
+		.setkey	= csky_sha_hmac_setkey,
+		.halg = {
+			.digestsize = SHA1_DIGEST_SIZE,
+			.statesize  = sizeof(struct sha1_state),
+			.base = {
+				.cra_name	 = "hmac(sha1)",
+				.cra_driver_name = "csky-hmac-sha1",
+				.cra_priority	 = 100,
+				.cra_flags	 = CRYPTO_ALG_ASYNC,
+				.cra_blocksize	 = SHA1_BLOCK_SIZE,
+				.cra_ctxsize	 = sizeof(struct csky_sha_ctx),
+				.cra_alignmask	 = 0,
+				.cra_module	 = THIS_MODULE,
+				.cra_init	 = csky_sha_hmac_cra_init,
+				.cra_exit	 = csky_sha_hmac_cra_exit,
+			}
+		}
+	},
+	{
+		.init	= csky_sha_init,
+		.update	= csky_sha_update,
+		.final	= csky_sha_final,
+		.finup	= csky_sha_finup,
+		.digest	= csky_sha_digest,
+		.export	= csky_sha_export,
+		.import	= csky_sha_import,
+		.setkey	= csky_sha_hmac_setkey,
+		.halg = {
+			.digestsize = SHA224_DIGEST_SIZE,
+			.statesize  = sizeof(struct sha256_state),
+			.base = {
+				.cra_name	 = "hmac(sha224)",
+				.cra_driver_name = "csky-hmac-sha224",
+				.cra_priority	 = 100,
+				.cra_flags	 = CRYPTO_ALG_ASYNC,
+				.cra_blocksize	 = SHA224_BLOCK_SIZE,
+				.cra_ctxsize	 = sizeof(struct csky_sha_ctx),
+				.cra_alignmask	 = 0,
+				.cra_module	 = THIS_MODULE,
+				.cra_init	 = csky_sha_hmac_cra_init,
+				.cra_exit	 = csky_sha_hmac_cra_exit,
+			}
+		}
+	},
+	{
+		.init	= csky_sha_init,
+		.update	= csky_sha_update,
+		.final	= csky_sha_final,
+		.finup	= csky_sha_finup,
+		.digest	= csky_sha_digest,
+		.export	= csky_sha_export,
+		.import	= csky_sha_import,
+		.setkey	= csky_sha_hmac_setkey,
+		.halg = {
+			.digestsize = SHA256_DIGEST_SIZE,
+			.statesize  = sizeof(struct sha256_state),
+			.base = {
+				.cra_name	 = "hmac(sha256)",
+				.cra_driver_name = "csky-hmac-sha256",
+				.cra_priority	 = 100,
+				.cra_flags	 = CRYPTO_ALG_ASYNC,
+				.cra_blocksize	 = SHA256_BLOCK_SIZE,
+				.cra_ctxsize	 = sizeof(struct csky_sha_ctx),
+				.cra_alignmask	 = 0,
+				.cra_module	 = THIS_MODULE,
+				.cra_init	 = csky_sha_hmac_cra_init,
+				.cra_exit	 = csky_sha_hmac_cra_exit,
+			}
+		}
+	},
+	{
+		.init	= csky_sha_init,
+		.update	= csky_sha_update,
+		.final	= csky_sha_final,
+		.finup	= csky_sha_finup,
+		.digest	= csky_sha_digest,
+		.export	= csky_sha_export,
+		.import	= csky_sha_import,
+		.setkey	= csky_sha_hmac_setkey,
+		.halg = {
+			.digestsize = SHA384_DIGEST_SIZE,
+			.statesize  = sizeof(struct sha512_state),
+			.base = {
+				.cra_name	 = "hmac(sha384)",
+				.cra_driver_name = "csky-hmac-sha384",
+				.cra_priority	 = 100,
+				.cra_flags	 = CRYPTO_ALG_ASYNC,
+				.cra_blocksize	 = SHA384_BLOCK_SIZE,
+				.cra_ctxsize	 = sizeof(struct csky_sha_ctx),
+				.cra_alignmask	 = 0x3,
+				.cra_module	 = THIS_MODULE,
+				.cra_init	 = csky_sha_hmac_cra_init,
+				.cra_exit	 = csky_sha_hmac_cra_exit,
+			}
+		}
+	},
+	{
+		.init	= csky_sha_init,
+		.update	= csky_sha_update,
+		.final	= csky_sha_final,
+		.finup	= csky_sha_finup,
+		.digest	= csky_sha_digest,
+		.export	= csky_sha_export,
+		.import	= csky_sha_import,
+		.setkey	= csky_sha_hmac_setkey,
+		.halg = {
+			.digestsize = SHA512_DIGEST_SIZE,
+			.statesize  = sizeof(struct sha512_state),
+			.base = {
+				.cra_name	 = "hmac(sha512)",
+				.cra_driver_name = "csky-hmac-sha512",
+				.cra_priority	 = 100,
+				.cra_flags	 = CRYPTO_ALG_ASYNC,
+				.cra_blocksize	 = SHA512_BLOCK_SIZE,
+				.cra_ctxsize	 = sizeof(struct csky_sha_ctx),
+				.cra_alignmask	 = 0x3,
+				.cra_module	 = THIS_MODULE,
+				.cra_init	 = csky_sha_hmac_cra_init,
+				.cra_exit	 = csky_sha_hmac_cra_exit,
+			}
+		}
+	},
+};
 
-	if (SHA_FLAGS_CPU & dd->flags) {
-		if (SHA_FLAGS_OUTPUT_READY & dd->flags)
-			dd->flags &= ~SHA_FLAGS_OUTPUT_READY;
+static irqreturn_t csky_sha_irq(int irq, void *dev_id)
+{
+	struct csky_sha_dev *dd = dev_id;
+	irqreturn_t ret = IRQ_NONE;
+
+	/* Serialised against csky_sha_wait() taking the interrupt back */
+	spin_lock(&dd->engine.lock);
+	if (readl_relaxed(&dd->io_base->SHA_CON) & (1 << CSKY_SHA_INT)) {
+		csky_sha_disable_int(dd);
+		csky_engine_irq(&dd->engine);
+		ret = IRQ_HANDLED;
 	}
+	spin_unlock(&dd->engine.lock);
 
-	return;
+	return ret;
 }
 
 static void csky_sha_unregister_algs(struct csky_sha_dev *dd)
@@ -855,6 +1088,9 @@ static void csky_sha_unregister_algs(struct csky_sha_dev *dd)
 
 	for (i = 0; i < ARRAY_SIZE(sha_384_512_algs); i++)
 		crypto_unregister_ahash(&sha_384_512_algs[i]);
+
+	for (i = 0; i < ARRAY_SIZE(sha_hmac_algs); i++)
+		crypto_unregister_ahash(&sha_hmac_algs[i]);
 }
 
 static int csky_sha_register_algs(struct csky_sha_dev *dd)
@@ -877,8 +1113,18 @@ static int csky_sha_register_algs(struct csky_sha_dev *dd)
 			goto err_sha_384_512_algs;
 	}
 
+	for (i = 0; i < ARRAY_SIZE(sha_hmac_algs); i++) {
+		err = crypto_register_ahash(&sha_hmac_algs[i]);
+		if (err)
+			goto err_sha_hmac_algs;
+	}
+
 	return 0;
 
+err_sha_hmac_algs:
+	for (j = 0; j < i; j++)
+		crypto_unregister_ahash(&sha_hmac_algs[j]);
+	i = ARRAY_SIZE(sha_384_512_algs);
 err_sha_384_512_algs:
 	for (j = 0; j < i; j++)
 		crypto_unregister_ahash(&sha_384_512_algs[j]);
@@ -911,13 +1157,8 @@ static int csky_sha_probe(struct platform_device *pdev)
 
 	platform_set_drvdata(pdev, sha_dd);
 
-	INIT_LIST_HEAD(&sha_dd->list);
-	spin_lock_init(&sha_dd->lock);
-
-	tasklet_init(&sha_dd->done_task, csky_sha_done_task,
-					(unsigned long)sha_dd);
-
-	crypto_init_queue(&sha_dd->queue, CSKY_SHA_QUEUE_LENGTH);
+	csky_engine_init(&sha_dd->engine, dev, &csky_sha_engine_ops,
+			 CSKY_SHA_QUEUE_LENGTH);
 
 	sha_res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
 	if (!sha_res) {
@@ -933,25 +1174,34 @@ static int csky_sha_probe(struct platform_device *pdev)
 		goto res_err;
 	}
 
-	spin_lock(&csky_sha.lock);
-	list_add_tail(&sha_dd->list, &csky_sha.dev_list);
-	spin_unlock(&csky_sha.lock);
+	sha_dd->irq = platform_get_irq(pdev, 0);
+	if (sha_dd->irq > 0) {
+		err = devm_request_irq(dev, sha_dd->irq, csky_sha_irq, 0,
+				       dev_name(dev), sha_dd);
+		if (err) {
+			dev_err(dev, "unable to request irq %d.\n",
+				sha_dd->irq);
+			goto res_err;
+		}
+	} else {
+		dev_warn(dev, "no irq, falling back to polled mode.\n");
+	}
 
-	err = csky_sha_register_algs(sha_dd);
-	if (err)
-		goto err_algs;
+	if (csky_engine_add(&csky_sha_engines, &sha_dd->engine) == 1) {
+		err = csky_sha_register_algs(sha_dd);
+		if (err)
+			goto err_algs;
+	}
 
 	dev_info(dev, "CSKY SHA Driver Initialized\n");
 
 	return 0;
 
 err_algs:
-	spin_lock(&csky_sha.lock);
-	list_del(&sha_dd->list);
-	spin_unlock(&csky_sha.lock);
+	csky_engine_del(&csky_sha_engines, &sha_dd->engine);
 
 res_err:
-	tasklet_kill(&sha_dd->done_task);
+	csky_engine_exit(&sha_dd->engine);
 sha_dd_err:
 	dev_err(dev, "initialization failed.\n");
 
@@ -966,13 +1216,10 @@ static int csky_sha_remove(struct platform_device *pdev)
 	if (!sha_dd)
 		return -ENODEV;
 
-	spin_lock(&csky_sha.lock);
-	list_del(&sha_dd->list);
-	spin_unlock(&csky_sha.lock);
-
-	csky_sha_unregister_algs(sha_dd);
+	if (!csky_engine_del(&csky_sha_engines, &sha_dd->engine))
+		csky_sha_unregister_algs(sha_dd);
 
-	tasklet_kill(&sha_dd->done_task);
+	csky_engine_exit(&sha_dd->engine);
 
 	return 0;
 }
@@ -995,6 +1242,6 @@ static struct platform_driver csky_sha_driver = {
 
 module_platform_driver(csky_sha_driver);
 
-MODULE_DESCRIPTION("CSKY SHA (1/256/224/384/512) hw acceleration support.");
+MODULE_DESCRIPTION("CSKY SHA (1/256/224/384/512) and HMAC hw acceleration support.");
 MODULE_LICENSE("GPL v2");
 MODULE_AUTHOR("Vincent Cui <xiaoxia_cui@c-sky.com>");
@@ -29,6 +29,7 @@
 #include <crypto/algapi.h>
 #include <crypto/des.h>
 #include "csky_tdes.h"
+#include "csky_engine.h"
 
 #define CSKY_TDES_BUFFER_ORDER	2
 #define CSKY_TDES_BUFFER_SIZE	(PAGE_SIZE << CSKY_TDES_BUFFER_ORDER)
@@ -39,7 +40,6 @@
 #define TDES_FLAGS_CBC		BIT(3)
 
 #define TDES_FLAGS_INIT		BIT(8)
-#define TDES_FLAGS_BUSY		BIT(9)
 
 #define CSKY_TDES_QUEUE_LENGTH	10
 
@@ -51,7 +51,6 @@
 struct csky_tdes_dev;
 
 struct csky_tdes_base_ctx {
-	struct csky_tdes_dev *dd;
 	int keylen;
 	u32 key[3*DES_KEY_SIZE / sizeof(u32)];
 	u32 block_size;
@@ -71,53 +70,24 @@ struct csky_tdes_reqctx {
 };
 
 struct csky_tdes_dev {
-	struct list_head		list;
+	struct csky_engine		engine;
 	struct crypto_async_request	*areq;
 	struct csky_tdes_base_ctx	*ctx;
 	struct device			*dev;
 	struct tdes_reg __iomem		*reg_base;
-	struct tasklet_struct		done_task;
 
-	struct crypto_queue 		queue;
 	struct scatterlist 		*real_dst;
 	unsigned long			flags;
-	spinlock_t			lock;
 	size_t				total;
 	size_t				datalen;
+	size_t				done;
 	u32				*data;
 	size_t				buflen;
 	void				*buf;
 };
 
-struct csky_tdes_drv {
-	struct list_head dev_list;
-	spinlock_t	 lock;
-};
-
-static struct csky_tdes_drv csky_tdes = {
-	.dev_list = LIST_HEAD_INIT(csky_tdes.dev_list),
-	.lock	  = __SPIN_LOCK_UNLOCKED(csky_tdes.lock),
-};
-
-static struct csky_tdes_dev *csky_tdes_find_dev(struct csky_tdes_base_ctx *ctx)
-{
-	struct csky_tdes_dev *tdes_dd = NULL;
-	struct csky_tdes_dev *tmp;
-
-	spin_lock_bh(&csky_tdes.lock);
-	if (!ctx->dd) {
-		list_for_each_entry(tmp, &csky_tdes.dev_list, list) {
-			tdes_dd = tmp;
-			break;
-		}
-		ctx->dd = tdes_dd;
-	} else {
-		tdes_dd = ctx->dd;
-	}
-	spin_unlock_bh(&csky_tdes.lock);
-
-	return tdes_dd;
-}
+static struct csky_engine_class csky_tdes_engines =
+	CSKY_ENGINE_CLASS_INIT(csky_tdes_engines, "tdes");
 
 static inline void csky_tdes_setopcode(struct csky_tdes_dev *dd)
 {
@@ -217,31 +187,31 @@ static inline void csky_tdes_out_block(struct csky_tdes_dev *dd,
 	}
 }
 
-static inline int csky_tdes_complete(struct csky_tdes_dev *dd, int err)
+static void csky_tdes_wait(struct csky_tdes_dev *dd)
 {
-	dd->flags &= ~TDES_FLAGS_BUSY;
-	dd->areq->complete(dd->areq, err);
-
-	tasklet_schedule(&dd->done_task);
+	while (csky_tdes_check_int_status(dd, TDES_IT_BUSY))
+		cpu_relax();
+}
 
-	return err;
+static inline int csky_tdes_complete(struct csky_tdes_dev *dd, int err)
+{
+	return csky_engine_complete(&dd->engine, err);
 }
 
 static int csky_tdes_engine_op(struct csky_tdes_dev *dd)
 {
-	int i;
 	int err = 0;
 	int len;
 
-	for (i = 0; i < dd->datalen; i += DES_BLOCK_SIZE) {
+	while (dd->done < dd->datalen) {
 		csky_tdes_in_block(dd, dd->data);
-
 		csky_tdes_enable(dd);
-		csky_tdes_check_int_status(dd, TDES_IT_BUSY);
+		csky_tdes_wait(dd);
 		csky_tdes_disable(dd);
 
 		csky_tdes_out_block(dd, dd->data);
 		dd->data += SIZE_IN_WORDS(DES_BLOCK_SIZE);
+		dd->done += DES_BLOCK_SIZE;
 	}
 
 	if (dd->flags & TDES_FLAGS_ENC)
@@ -269,7 +239,7 @@ static int csky_tdes_start(struct csky_tdes_dev *dd,
 		return -EACCES;
 	}
 
-	if (unlikely(len == 0))
+	if (unlikely(len == 0 || len + padlen > dd->buflen))
 		return -EINVAL;
 
 	sg_copy_to_buffer(src, sg_nents(src), dd->buf, len);
@@ -277,6 +247,7 @@ static int csky_tdes_start(struct csky_tdes_dev *dd,
 	dd->real_dst = dst;
 	dd->total    = len;
 	dd->datalen  = len + padlen;
+	dd->done     = 0;
 	dd->data     = (u32 *)dd->buf;
 
 	return 0;
@@ -323,62 +294,43 @@ static int csky_tdes_handle(struct csky_tdes_dev *dd)
 	csky_tdes_init(dd);
 	ret = csky_tdes_start(dd, req->src, req->dst, req->nbytes);
 	if (ret)
-		return ret;
+		return csky_tdes_complete(dd, ret);
 
 	ret = csky_tdes_set_key(dd, req->info);
 	if (ret)
-		return ret;
+		return csky_tdes_complete(dd, ret);
 
-	ret = csky_tdes_engine_op(dd);
-	return ret;
+	return csky_tdes_engine_op(dd);
 }
 
-static int csky_tdes_handle_queue(struct csky_tdes_dev *dd,
-				  struct crypto_async_request *new_areq)
+static int csky_tdes_start_req(struct csky_engine *eng,
+			       struct crypto_async_request *areq)
 {
-	struct crypto_async_request *areq, *backlog;
-	struct csky_tdes_base_ctx	*ctx;
-	unsigned long flags;
-	int ret = 0;
-
-	spin_lock_irqsave(&dd->lock, flags);
-	if (new_areq)
-		ret = crypto_enqueue_request(&dd->queue, new_areq);
-	if (dd->flags & TDES_FLAGS_BUSY) {
-		spin_unlock_irqrestore(&dd->lock, flags);
-		return ret;
-	}
-	backlog = crypto_get_backlog(&dd->queue);
-	areq = crypto_dequeue_request(&dd->queue);
-	if (areq)
-		dd->flags |= TDES_FLAGS_BUSY;
-	spin_unlock_irqrestore(&dd->lock, flags);
-
-	if (!areq)
-		return ret;
+	struct csky_tdes_dev *dd = container_of(eng, struct csky_tdes_dev,
+						engine);
 
-	if (backlog)
-		backlog->complete(backlog, -EINPROGRESS);
-
-	ctx	 = crypto_tfm_ctx(areq->tfm);
 	dd->areq = areq;
-	dd->ctx  = ctx;
+	dd->ctx  = crypto_tfm_ctx(areq->tfm);
 
 	return csky_tdes_handle(dd);
 }
 
+static const struct csky_engine_ops csky_tdes_engine_ops = {
+	.start	= csky_tdes_start_req,
+};
+
 static int csky_tdes_crypt(struct ablkcipher_request *req, unsigned long mode)
 {
 	struct csky_tdes_base_ctx *ctx;
 	struct csky_tdes_reqctx   *rctx;
-	struct csky_tdes_dev	  *dd;
+	struct csky_engine	  *eng;
 
 	ctx = crypto_ablkcipher_ctx(crypto_ablkcipher_reqtfm(req));
 	if (!ctx)
 		return -ENOMEM;
 
-	dd  = csky_tdes_find_dev(ctx);
-	if (!dd)
+	eng = csky_engine_select(&csky_tdes_engines);
+	if (!eng)
 		return -ENODEV;
 
 	rctx	   = ablkcipher_request_ctx(req);
@@ -387,7 +339,7 @@ static int csky_tdes_crypt(struct ablkcipher_request *req, unsigned long mode)
 	if ((mode & TDES_FLAGS_ECB) || (mode & TDES_FLAGS_CBC))
 		ctx->block_size = DES_BLOCK_SIZE;
 
-	return csky_tdes_handle_queue(dd, &req->base);
+	return csky_engine_enqueue(eng, &req->base);
 }
 
 static int csky_tdes_setkey(struct crypto_ablkcipher *tfm, const u8 *key,
@@ -501,13 +453,6 @@ static void csky_tdes_buff_cleanup(struct csky_tdes_dev *dd)
 		free_pages((unsigned long)dd->buf, CSKY_TDES_BUFFER_ORDER);
 }
 
-static void csky_tdes_done_task(unsigned long data)
-{
-	struct csky_tdes_dev *dd = (struct csky_tdes_dev *)data;
-
-	csky_tdes_handle_queue(dd, NULL);
-}
-
 static void csky_tdes_unregister_algs(struct csky_tdes_dev *dd)
 {
 	int i;
@@ -550,13 +495,8 @@ static int csky_tdes_probe(struct platform_device *pdev)
 
 	platform_set_drvdata(pdev, tdes_dd);
 
-	INIT_LIST_HEAD(&tdes_dd->list);
-	spin_lock_init(&tdes_dd->lock);
-
-	tasklet_init(&tdes_dd->done_task, csky_tdes_done_task,
-		     (unsigned long)tdes_dd);
-
-	crypto_init_queue(&tdes_dd->queue, CSKY_TDES_QUEUE_LENGTH);
+	csky_engine_init(&tdes_dd->engine, dev, &csky_tdes_engine_ops,
+			 CSKY_TDES_QUEUE_LENGTH);
 
 	tdes_res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
 	if (!tdes_res) {
@@ -574,24 +514,21 @@ static int csky_tdes_probe(struct platform_device *pdev)
 	if (err)
 		goto res_err;
 
-	spin_lock(&csky_tdes.lock);
-	list_add_tail(&tdes_dd->list, &csky_tdes.dev_list);
-	spin_unlock(&csky_tdes.lock);
-
-	err = csky_tdes_register_algs(tdes_dd);
-	if (err)
-		goto err_algs;
+	if (csky_engine_add(&csky_tdes_engines, &tdes_dd->engine) == 1) {
+		err = csky_tdes_register_algs(tdes_dd);
+		if (err)
+			goto err_algs;
+	}
 
 	dev_info(dev, "CSKY TDES Driver Initialized\n");
 
 	return 0;
 
 err_algs:
-	spin_lock(&csky_tdes.lock);
-	list_del(&tdes_dd->list);
-	spin_unlock(&csky_tdes.lock);
+	csky_engine_del(&csky_tdes_engines, &tdes_dd->engine);
+	csky_tdes_buff_cleanup(tdes_dd);
 res_err:
-	tasklet_kill(&tdes_dd->done_task);
+	csky_engine_exit(&tdes_dd->engine);
 tdes_dd_err:
 
 	return err;
@@ -605,15 +542,12 @@ static int csky_tdes_remove(struct platform_device *pdev)
 	if (!tdes_dd)
 		return -ENODEV;
 
-	spin_lock(&csky_tdes.lock);
-	list_del(&tdes_dd->list);
-	spin_unlock(&csky_tdes.lock);
+	if (!csky_engine_del(&csky_tdes_engines, &tdes_dd->engine))
+		csky_tdes_unregister_algs(tdes_dd);
+	csky_engine_exit(&tdes_dd->engine);
 
 	csky_tdes_buff_cleanup(tdes_dd);
 
-	tasklet_kill(&tdes_dd->done_task);
-	csky_tdes_unregister_algs(tdes_dd);
-
 	return 0;
 }
 
@@ -25,6 +25,7 @@
 #include <linux/of_graph.h>
 #include <linux/component.h>
 #include <linux/console.h>
+#include <linux/seq_file.h>
 
 #include "csky-drm-drv.h"
 #include "csky-drm-fbdev.h"
@@ -107,6 +108,80 @@ static void csky_drm_lastclose(struct drm_device *dev)
 	//drm_fb_helper_restore_fbdev_mode_unlocked(&priv->fbdev_helper);
 }
 
+#ifdef CONFIG_DEBUG_FS
+static int csky_drm_flips_show(struct seq_file *m, void *data)
+{
+	struct drm_info_node *node = m->private;
+	struct csky_drm_private *priv = node->minor->dev->dev_private;
+	struct csky_drm_crtc *csky_crtc = priv->csky_crtc;
+	struct csky_crtc_flip_stats st;
+
+	if (!csky_crtc)
+		return -ENODEV;
+
+	spin_lock_irq(&csky_crtc->irq_lock);
+	st = csky_crtc->stats;
+	spin_unlock_irq(&csky_crtc->irq_lock);
+
+	seq_printf(m, "flips:           %llu\n", st.flips);
+	seq_printf(m, "async flips:     %llu\n", st.async_flips);
+	seq_printf(m, "missed vblanks:  %llu\n", st.missed_vblanks);
+	seq_printf(m, "avg latency ns:  %llu\n",
+		   st.flips ? div64_u64(st.latency_ns, st.flips) : 0);
+	seq_printf(m, "max latency ns:  %llu\n", st.max_latency_ns);
+
+	return 0;
+}
+
+static int csky_drm_refresh_show(struct seq_file *m, void *data)
+{
+	struct drm_info_node *node = m->private;
+	struct csky_drm_private *priv = node->minor->dev->dev_private;
+	struct csky_drm_crtc *csky_crtc = priv->csky_crtc;
+	struct csky_crtc_refresh_stats st;
+	unsigned int div;
+	u64 full;
+
+	if (!csky_crtc)
+		return -ENODEV;
+
+	spin_lock_irq(&csky_crtc->irq_lock);
+	st = csky_crtc->refresh_stats;
+	div = csky_crtc->refresh.div;
+	spin_unlock_irq(&csky_crtc->irq_lock);
+
+	full = st.fetched_bytes + st.saved_bytes;
+	seq_printf(m, "refresh divider: %u\n", div);
+	seq_printf(m, "dirty calls:     %llu\n", st.dirty_calls);
+	seq_printf(m, "dirty pixels:    %llu\n", st.dirty_pixels);
+	seq_printf(m, "full frames:     %llu\n", st.full_frames);
+	seq_printf(m, "idle frames:     %llu\n", st.idle_frames);
+	seq_printf(m, "fetched bytes:   %llu\n", st.fetched_bytes);
+	seq_printf(m, "saved bytes:     %llu (%llu%%)\n", st.saved_bytes,
+		   full ? div64_u64(st.saved_bytes * 100, full) : 0);
+
+	return 0;
+}
+
+static const struct drm_info_list csky_drm_debugfs_list[] = {
+	{ "flips", csky_drm_flips_show, 0 },
+	{ "refresh", csky_drm_refresh_show, 0 },
+};
+
+static int csky_drm_debugfs_init(struct drm_minor *minor)
+{
+	return drm_debugfs_create_files(csky_drm_debugfs_list,
+					ARRAY_SIZE(csky_drm_debugfs_list),
+					minor->debugfs_root, minor);
+}
+
+static void csky_drm_debugfs_cleanup(struct drm_minor *minor)
+{
+	drm_debugfs_remove_files(csky_drm_debugfs_list,
+				 ARRAY_SIZE(csky_drm_debugfs_list), minor);
+}
+#endif
+
 static const struct file_operations csky_drm_driver_fops = {
 	.owner = THIS_MODULE,
 	.open = drm_open,
@@ -137,9 +212,14 @@ static struct drm_driver csky_drm_driver = {
 	.gem_prime_import	= drm_gem_prime_import,
 	.gem_prime_export	= drm_gem_prime_export,
 	.gem_prime_get_sg_table = csky_gem_prime_get_sg_table,
+	.gem_prime_import_sg_table = csky_gem_prime_import_sg_table,
 	.gem_prime_vmap		= csky_gem_prime_vmap,
 	.gem_prime_vunmap = csky_gem_prime_vunmap,
 	.gem_prime_mmap		= csky_gem_mmap_buf,
+#ifdef CONFIG_DEBUG_FS
+	.debugfs_init		= csky_drm_debugfs_init,
+	.debugfs_cleanup	= csky_drm_debugfs_cleanup,
+#endif
 
 	.fops			= &csky_drm_driver_fops,
 	.name	= DRIVER_NAME,
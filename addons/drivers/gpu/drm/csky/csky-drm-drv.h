@@ -24,7 +24,7 @@
 #include <linux/module.h>
 #include <linux/component.h>
 
-#define CSKY_MAX_FB_BUFFER	1
+#define CSKY_MAX_FB_BUFFER	3
 #define CSKY_MAX_CONNECTOR	1
 #define CSKY_MAX_CRTC		1
 
@@ -33,6 +33,54 @@ struct drm_connector;
 
 #define to_csky_crtc(x)		container_of(x, struct csky_drm_crtc, base)
 
+#define CSKY_MAX_PBASE		3	/* Y (or RGB), U, V */
+
+/*
+ * A flip waiting for the vblank interrupt to write its scanout addresses,
+ * so a new frame never starts mid-scanout.  Built by the plane update,
+ * armed by the CRTC flush.
+ */
+struct csky_crtc_flip {
+	dma_addr_t pbase[CSKY_MAX_PBASE];
+	u32 format;		/* CSKY_LCDCON_DFS_* */
+	u32 frame_bytes;	/* Fetched per frame */
+	bool update;		/* pbase and format are new */
+	struct drm_pending_vblank_event *event;
+	ktime_t queued;
+	u32 queued_vblank;
+};
+
+struct csky_crtc_flip_stats {
+	u64 flips;
+	u64 async_flips;
+	u64 missed_vblanks;	/* Late or superseded before their vblank */
+	u64 latency_ns;		/* Flush to latch, summed */
+	u64 max_latency_ns;
+};
+
+/*
+ * The LCDC fetches every frame in full whatever changed, so the only
+ * bandwidth an idle screen can give back is whole frames.  Once
+ * idle_frames vblanks passed without a flip or a dirty report the pixel
+ * clock is divided down, the next change restores it.
+ */
+struct csky_crtc_refresh {
+	u32 timing2;		/* As set for the mode */
+	u32 frame_bytes;	/* Of the latched framebuffer */
+	unsigned int idle;	/* vblanks without a change */
+	unsigned int div;	/* Current slowdown, 1 at full rate */
+	bool activity;		/* Changed since the last vblank */
+};
+
+struct csky_crtc_refresh_stats {
+	u64 dirty_calls;
+	u64 dirty_pixels;
+	u64 full_frames;
+	u64 idle_frames;
+	u64 fetched_bytes;
+	u64 saved_bytes;	/* Versus full rate all along */
+};
+
 struct csky_drm_crtc {
 	struct drm_crtc base;
 	void __iomem *regs;
@@ -46,6 +94,14 @@ struct csky_drm_crtc {
 	spinlock_t reg_lock;
 	/* lock vop irq reg */
 	spinlock_t irq_lock;
+
+	struct csky_crtc_flip next;	/* Being built by the commit */
+	struct csky_crtc_flip armed;	/* Waiting for vblank, irq_lock */
+	bool async_flip;		/* Legacy DRM_MODE_PAGE_FLIP_ASYNC */
+	u32 format;			/* Last latched, irq_lock */
+	struct csky_crtc_flip_stats stats;
+	struct csky_crtc_refresh refresh;	/* irq_lock */
+	struct csky_crtc_refresh_stats refresh_stats;
 };
 
 struct csky_drm_plane {
@@ -56,16 +112,22 @@ struct csky_drm_plane {
  * Csky drm private crtc funcs.
  * @enable_vblank: enable crtc vblank irq.
  * @disable_vblank: disable crtc vblank irq.
+ * @dirty: report damage to a framebuffer, see drm_framebuffer_funcs.
+ *	   Called with the CRTC and its primary plane locked.
  */
 struct csky_crtc_funcs {
 	int (*enable_vblank)(struct drm_crtc *crtc);
 	void (*disable_vblank)(struct drm_crtc *crtc);
+	void (*dirty)(struct drm_crtc *crtc, struct drm_framebuffer *fb,
+		      unsigned int flags, struct drm_clip_rect *clips,
+		      unsigned int num_clips);
 };
 
 struct csky_crtc_state {
 	struct drm_crtc_state base;
 	int output_type;
 	int output_mode;
+	bool async;		/* Latch at once, tearing allowed */
 };
 #define to_csky_crtc_state(s) \
 		container_of(s, struct csky_crtc_state, base)
@@ -91,4 +153,8 @@ int csky_register_crtc_funcs(struct drm_crtc *crtc,
 				 const struct csky_crtc_funcs *crtc_funcs);
 void csky_unregister_crtc_funcs(struct drm_crtc *crtc);
 
+void csky_crtc_set_scanout(struct drm_crtc *crtc,
+			   const dma_addr_t pbase[CSKY_MAX_PBASE], u32 format,
+			   u32 frame_bytes);
+
 #endif /* _CSKY_DRM_DRV_H_ */
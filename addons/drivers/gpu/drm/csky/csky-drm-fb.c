@@ -72,7 +72,26 @@ static int csky_drm_fb_dirty(struct drm_framebuffer *fb,
 				 struct drm_clip_rect *clips,
 				 unsigned int num_clips)
 {
-	//csky_drm_psr_flush_all(fb->dev);
+	struct csky_drm_private *private = fb->dev->dev_private;
+	const struct csky_crtc_funcs *funcs;
+	struct drm_crtc *crtc;
+
+	if (!private->csky_crtc)
+		return 0;
+
+	crtc = &private->csky_crtc->base;
+	funcs = private->crtc_funcs[drm_crtc_index(crtc)];
+	if (!funcs || !funcs->dirty)
+		return 0;
+
+	/*
+	 * DIRTYFB comes without any modeset lock, the hook looks at the
+	 * primary plane's framebuffer and the CRTC's mode.
+	 */
+	drm_modeset_lock_crtc(crtc, crtc->primary);
+	funcs->dirty(crtc, fb, flags, clips, num_clips);
+	drm_modeset_unlock_crtc(crtc);
+
 	return 0;
 }
 
@@ -176,27 +195,6 @@ static void csky_drm_output_poll_changed(struct drm_device *dev)
 		drm_fb_helper_hotplug_event(fb_helper);
 }
 
-static void csky_atomic_commit_hw_done(struct drm_atomic_state *state)
-{
-	struct drm_pending_vblank_event *event;
-	struct drm_device *drm = state->dev;
-	struct csky_drm_private *csky_drm = drm->dev_private;
-	struct drm_crtc *crtc = &csky_drm->csky_crtc->base;
-
-	event = crtc->state->event;
-	if (event) {
-		crtc->state->event = NULL;
-
-		spin_lock_irq(&drm->event_lock);
-		if (drm_crtc_vblank_get(crtc) == 0)
-			drm_crtc_arm_vblank_event(crtc, event);
-		else
-			drm_crtc_send_vblank_event(crtc, event);
-		spin_unlock_irq(&drm->event_lock);
-	}
-	drm_atomic_helper_commit_hw_done(state);
-}
-
 static void csky_atomic_commit_tail(struct drm_atomic_state *state)
 {
 	struct drm_device *dev = state->dev;
@@ -209,7 +207,8 @@ static void csky_atomic_commit_tail(struct drm_atomic_state *state)
 	drm_atomic_helper_commit_planes(dev, state,
 					DRM_PLANE_COMMIT_ACTIVE_ONLY);
 
-    csky_atomic_commit_hw_done(state);
+	/* The CRTC flush armed the flip and its event for the next vblank */
+	drm_atomic_helper_commit_hw_done(state);
 
 	drm_atomic_helper_wait_for_vblanks(dev, state);
 
@@ -265,6 +264,9 @@ void csky_drm_mode_config_init(struct drm_device *dev)
 	dev->mode_config.max_width = 4096;
 	dev->mode_config.max_height = 4096;
 
+	/* Legacy flips only, see csky_crtc_page_flip() */
+	dev->mode_config.async_page_flip = true;
+
 	dev->mode_config.funcs = &csky_drm_mode_config_funcs;
 	dev->mode_config.helper_private = &csky_mode_config_helpers;
 }
@@ -15,6 +15,8 @@
  *
  */
 
+#include <linux/dma-buf.h>
+#include <linux/vmalloc.h>
 #include <drm/drm.h>
 #include <drm/drmP.h>
 #include <drm/drm_gem.h>
@@ -62,16 +64,22 @@ static int csky_drm_gem_object_mmap(struct drm_gem_object *obj,
 	struct csky_gem_object *ck_obj = to_csky_obj(obj);
 	struct drm_device *drm = obj->dev;
 
+	/* The exporter knows how to map its own memory */
+	if (obj->import_attach) {
+		drm_gem_vm_close(vma);
+		return dma_buf_mmap(obj->import_attach->dmabuf, vma, 0);
+	}
+
 	/*
 	 * dma_alloc_attrs() allocated a struct page table for ck_obj, so clear
 	 * VM_PFNMAP flag that was set by drm_gem_mmap_obj()/drm_gem_mmap().
+	 * The allocation attributes are still needed to free the buffer.
 	 */
 	vma->vm_flags &= ~VM_PFNMAP;
 	vma->vm_pgoff = 0;
-	ck_obj->dma_attrs = 0;
 
 	ret = dma_mmap_attrs(drm->dev, vma, ck_obj->cookie, ck_obj->dma_addr,
-			     obj->size, ck_obj->dma_attrs);
+			     obj->size, 0);
 	if (ret)
 		drm_gem_vm_close(vma);
 
@@ -150,8 +158,12 @@ void csky_gem_free_object(struct drm_gem_object *obj)
 
 	ck_obj = to_csky_obj(obj);
 
-	csky_gem_free_buf(ck_obj);
+	if (obj->import_attach)
+		drm_prime_gem_destroy(obj, ck_obj->sgt);
+	else
+		csky_gem_free_buf(ck_obj);
 
+	drm_gem_object_release(obj);
 	kfree(ck_obj);
 }
 
@@ -277,12 +289,89 @@ struct sg_table *csky_gem_prime_get_sg_table(struct drm_gem_object *obj)
 	return sgt;
 }
 
+/*
+ * Import a dma-buf the display can scan out: the LCDC has no IOMMU, so
+ * the buffer must be contiguous in the display's DMA address space.
+ */
+struct drm_gem_object *
+csky_gem_prime_import_sg_table(struct drm_device *drm,
+			       struct dma_buf_attachment *attach,
+			       struct sg_table *sgt)
+{
+	struct csky_gem_object *ck_obj;
+	struct scatterlist *s;
+	dma_addr_t next;
+	int i;
+
+	next = sg_dma_address(sgt->sgl);
+	for_each_sg(sgt->sgl, s, sgt->nents, i) {
+		if (sg_dma_address(s) != next) {
+			DRM_DEBUG_PRIME("dma-buf is not contiguous\n");
+			return ERR_PTR(-EINVAL);
+		}
+		next = sg_dma_address(s) + sg_dma_len(s);
+	}
+
+	if (next - sg_dma_address(sgt->sgl) < attach->dmabuf->size)
+		return ERR_PTR(-EINVAL);
+
+	ck_obj = kzalloc(sizeof(*ck_obj), GFP_KERNEL);
+	if (!ck_obj)
+		return ERR_PTR(-ENOMEM);
+
+	drm_gem_private_object_init(drm, &ck_obj->base, attach->dmabuf->size);
+	ck_obj->dma_addr = sg_dma_address(sgt->sgl);
+	ck_obj->sgt = sgt;
+
+	return &ck_obj->base;
+}
+
 void *csky_gem_prime_vmap(struct drm_gem_object *obj)
 {
-	return NULL;
+	struct csky_gem_object *ck_obj = to_csky_obj(obj);
+	struct sg_page_iter iter;
+	struct sg_table *sgt;
+	struct page **pages;
+	unsigned int i = 0;
+	void *vaddr;
+
+	if (obj->import_attach)
+		return dma_buf_vmap(obj->import_attach->dmabuf);
+
+	if (!(ck_obj->dma_attrs & DMA_ATTR_NO_KERNEL_MAPPING))
+		return ck_obj->cookie;
+
+	/* dma-buf only calls us for its first user, no refcount needed */
+	sgt = csky_gem_prime_get_sg_table(obj);
+	if (IS_ERR(sgt))
+		return NULL;
+
+	pages = kcalloc(obj->size >> PAGE_SHIFT, sizeof(*pages), GFP_KERNEL);
+	if (!pages) {
+		vaddr = NULL;
+		goto out;
+	}
+
+	for_each_sg_page(sgt->sgl, &iter, sgt->nents, 0)
+		pages[i++] = sg_page_iter_page(&iter);
+
+	vaddr = vmap(pages, i, VM_MAP, pgprot_writecombine(PAGE_KERNEL));
+	ck_obj->kvaddr = vaddr;
+	kfree(pages);
+out:
+	sg_free_table(sgt);
+	kfree(sgt);
+	return vaddr;
 }
 
 void csky_gem_prime_vunmap(struct drm_gem_object *obj, void *vaddr)
 {
-	/* Nothing to do */
+	struct csky_gem_object *ck_obj = to_csky_obj(obj);
+
+	if (obj->import_attach) {
+		dma_buf_vunmap(obj->import_attach->dmabuf, vaddr);
+	} else if (ck_obj->kvaddr) {
+		vunmap(ck_obj->kvaddr);
+		ck_obj->kvaddr = NULL;
+	}
 }
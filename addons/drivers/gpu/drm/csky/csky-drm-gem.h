@@ -27,12 +27,14 @@ struct csky_gem_object {
 	void __iomem *kvaddr;
 	dma_addr_t dma_addr;
 	unsigned long dma_attrs;
+	struct sg_table *sgt;		/* Imported */
 };
 
 struct sg_table *csky_gem_prime_get_sg_table(struct drm_gem_object *obj);
 struct drm_gem_object *
-csky_gem_prime_import_sg_table(struct drm_device *dev, size_t size,
-				   struct sg_table *sgt);
+csky_gem_prime_import_sg_table(struct drm_device *dev,
+			       struct dma_buf_attachment *attach,
+			       struct sg_table *sgt);
 void *csky_gem_prime_vmap(struct drm_gem_object *obj);
 void csky_gem_prime_vunmap(struct drm_gem_object *obj, void *vaddr);
 
@@ -15,6 +15,8 @@
  *
  */
 
+#include <linux/dma-buf.h>
+#include <linux/reservation.h>
 #include <drm/drm_atomic_helper.h>
 #include <drm/drm_plane_helper.h>
 #include <drm/drm_fb_cma_helper.h>
@@ -24,6 +26,35 @@
 #include "csky-drm-plane.h"
 #include "csky-drm-fb.h"
 #include "csky-drm-gem.h"
+#include "csky-lcdc-crtc.h"
+
+/* YUV is planar only, Y then U then V unless swapped */
+struct csky_plane_format {
+	u32 fourcc;
+	u32 dfs;
+	bool swap_uv;
+};
+
+static const struct csky_plane_format csky_plane_formats[] = {
+	{ DRM_FORMAT_XRGB8888, CSKY_LCDCON_DFS_RGB,	false },
+	{ DRM_FORMAT_YUV420,   CSKY_LCDCON_DFS_YUV420,	false },
+	{ DRM_FORMAT_YVU420,   CSKY_LCDCON_DFS_YUV420,	true },
+	{ DRM_FORMAT_YUV422,   CSKY_LCDCON_DFS_YUV422,	false },
+	{ DRM_FORMAT_YVU422,   CSKY_LCDCON_DFS_YUV422,	true },
+	{ DRM_FORMAT_YUV444,   CSKY_LCDCON_DFS_YUV444,	false },
+	{ DRM_FORMAT_YVU444,   CSKY_LCDCON_DFS_YUV444,	true },
+};
+
+static const struct csky_plane_format *csky_plane_find_format(u32 fourcc)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(csky_plane_formats); i++)
+		if (csky_plane_formats[i].fourcc == fourcc)
+			return &csky_plane_formats[i];
+
+	return NULL;
+}
 
 /* If a modeset involves changing the setup of a plane, the atomic
  * infrastructure will call this to validate a proposed plane setup.
@@ -35,6 +66,9 @@
 static int csky_plane_atomic_check(struct drm_plane *plane,
 				  struct drm_plane_state *state)
 {
+	struct drm_framebuffer *fb = state->fb;
+	struct drm_crtc_state *crtc_state;
+	unsigned int hsub, vsub, i;
 	u32 src_w, src_h;
 
 	src_w = state->src_w >> 16;
@@ -44,27 +78,73 @@ static int csky_plane_atomic_check(struct drm_plane *plane,
 	if ((src_w != state->crtc_w) || (src_h != state->crtc_h))
 		return -EINVAL;
 
+	if (!fb || !state->crtc)
+		return 0;
+
+	if (!csky_plane_find_format(fb->pixel_format))
+		return -EINVAL;
+
+	crtc_state = drm_atomic_get_crtc_state(state->state, state->crtc);
+	if (IS_ERR(crtc_state))
+		return PTR_ERR(crtc_state);
+
+	/* nor position it, the plane covers the whole mode */
+	if (crtc_state->enable &&
+	    (state->crtc_x || state->crtc_y ||
+	     state->crtc_w != crtc_state->mode.hdisplay ||
+	     state->crtc_h != crtc_state->mode.vdisplay))
+		return -EINVAL;
+
+	hsub = drm_format_horz_chroma_subsampling(fb->pixel_format);
+	vsub = drm_format_vert_chroma_subsampling(fb->pixel_format);
+	if (((state->src_x >> 16) % hsub) || ((state->src_y >> 16) % vsub))
+		return -EINVAL;
+
+	/* there is no stride register either: lines must be back to back */
+	for (i = 0; i < drm_format_num_planes(fb->pixel_format); i++)
+		if (fb->pitches[i] != (src_w / (i ? hsub : 1)) *
+		    drm_format_plane_cpp(fb->pixel_format, i))
+			return -EINVAL;
+
 	return 0;
 }
 
+/* Where the visible part of a plane of @fb starts */
+static dma_addr_t csky_plane_pbase(struct drm_plane_state *state,
+				   unsigned int i)
+{
+	struct drm_framebuffer *fb = state->fb;
+	struct drm_gem_object *obj;
+	unsigned int x = state->src_x >> 16;
+	unsigned int y = state->src_y >> 16;
+
+	/* all planes may live in the first object */
+	obj = csky_fb_get_gem_obj(fb, i);
+	if (!obj)
+		obj = csky_fb_get_gem_obj(fb, 0);
+
+	if (i) {
+		x /= drm_format_horz_chroma_subsampling(fb->pixel_format);
+		y /= drm_format_vert_chroma_subsampling(fb->pixel_format);
+	}
+
+	return to_csky_obj(obj)->dma_addr + fb->offsets[i] +
+	       y * fb->pitches[i] +
+	       x * drm_format_plane_cpp(fb->pixel_format, i);
+}
+
 static void csky_plane_atomic_update(struct drm_plane *plane,
 				      struct drm_plane_state *old_state)
 {
 	struct csky_drm_private *private = plane->dev->dev_private;
 	struct csky_drm_crtc *csky_crtc = private->csky_crtc;
-	struct drm_fb_helper *helper;
-	struct fb_info *fbi;
-	struct drm_gem_object *obj;
-	struct csky_gem_object *ck_obj;
-	dma_addr_t scanout_start;
+	const struct csky_plane_format *format;
+	dma_addr_t pbase[CSKY_MAX_PBASE];
 	struct drm_plane_state *state = plane->state;
 	struct drm_framebuffer *fb = state->fb;
-	struct drm_gem_cma_object *cma_obj;
-	u32 width, height;
-	
-	width = csky_crtc->base.mode.hdisplay;
-	height = csky_crtc->base.mode.vdisplay;
-	printk("csky_plane_atomic_update\n");
+	unsigned int i, num_planes, vsub;
+	u32 frame_bytes = 0;
+
 	/*
 	 * can't update plane when vop is disabled.
 	 */
@@ -74,19 +154,73 @@ static void csky_plane_atomic_update(struct drm_plane *plane,
 	if (WARN_ON(!csky_crtc->is_enabled))
 		return;
 
-	obj = csky_fb_get_gem_obj(fb, 0);
-    	if (obj) {
-    		ck_obj = to_csky_obj(obj);
-        	scanout_start = ck_obj->dma_addr;
-    		/* set pbase */
-    		iowrite32(scanout_start, csky_crtc->regs + CSKY_LCD_PBASE_Y);
-    		iowrite32(scanout_start + width * height, csky_crtc->regs + CSKY_LCD_PBASE_U);
-    		iowrite32(scanout_start + width * height + width * height / 4, csky_crtc->regs + CSKY_LCD_PBASE_V);
-    	}
+	if (!fb || !csky_fb_get_gem_obj(fb, 0))
+		return;
+
+	format = csky_plane_find_format(fb->pixel_format);
+	num_planes = drm_format_num_planes(fb->pixel_format);
+	for (i = 0; i < CSKY_MAX_PBASE; i++)
+		pbase[i] = csky_plane_pbase(state, i < num_planes ? i : 0);
 
+	/* lines are back to back, see csky_plane_atomic_check() */
+	vsub = drm_format_vert_chroma_subsampling(fb->pixel_format);
+	for (i = 0; i < num_planes; i++)
+		frame_bytes += fb->pitches[i] * (state->src_h >> 16) /
+			       (i ? vsub : 1);
+
+	if (format->swap_uv)
+		swap(pbase[1], pbase[2]);
+
+	/* latched into pbase at the next vblank */
+	csky_crtc_set_scanout(&csky_crtc->base, pbase, format->dfs,
+			      frame_bytes);
+}
+
+/*
+ * Don't scan out a shared buffer before its producer is done with it.
+ * The commit waits on the fence of the first dma-buf backed object, the
+ * planes in other objects are waited for here.
+ */
+static int csky_plane_prepare_fb(struct drm_plane *plane,
+				 struct drm_plane_state *state)
+{
+	struct drm_gem_object *obj, *fenced = NULL;
+	struct dma_buf *dmabuf;
+	long ret;
+	int i;
+
+	if (!state->fb)
+		return 0;
+
+	for (i = 0; i < CSKY_MAX_FB_BUFFER; i++) {
+		obj = csky_fb_get_gem_obj(state->fb, i);
+		if (!obj || obj == fenced)
+			continue;
+
+		dmabuf = obj->import_attach ? obj->import_attach->dmabuf :
+					      obj->dma_buf;
+		if (!dmabuf)
+			continue;
+
+		if (!fenced) {
+			state->fence =
+				reservation_object_get_excl_rcu(dmabuf->resv);
+			fenced = obj;
+			continue;
+		}
+
+		ret = reservation_object_wait_timeout_rcu(dmabuf->resv, false,
+							  true,
+							  MAX_SCHEDULE_TIMEOUT);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
 }
 
 static const struct drm_plane_helper_funcs csky_plane_helper_funcs = {
+	.prepare_fb = csky_plane_prepare_fb,
 	.atomic_check = csky_plane_atomic_check,
 	.atomic_update = csky_plane_atomic_update,
 };
@@ -108,6 +242,12 @@ static const struct drm_plane_funcs csky_plane_funcs = {
 
 static const u32 csky_primary_plane_formats[] = {
 	DRM_FORMAT_XRGB8888,
+	DRM_FORMAT_YUV420,
+	DRM_FORMAT_YVU420,
+	DRM_FORMAT_YUV422,
+	DRM_FORMAT_YVU422,
+	DRM_FORMAT_YUV444,
+	DRM_FORMAT_YVU444,
 };
 
 struct drm_plane *csky_plane_init(struct drm_device *dev,
@@ -134,6 +274,13 @@ struct drm_plane *csky_plane_init(struct drm_device *dev,
 				       type, NULL);
 	drm_plane_helper_add(plane, &csky_plane_helper_funcs);
 
+	/*
+	 * The LCDC scans out a single layer and has no blending or colour
+	 * key, so there are no overlay or cursor planes to offer; say so
+	 * to compositors that look for a layer stack.
+	 */
+	drm_plane_create_zpos_immutable_property(plane, 0);
+
 	return plane;
 fail:
 	if (plane)
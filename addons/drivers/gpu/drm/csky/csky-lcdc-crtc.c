@@ -26,6 +26,16 @@
 #include "csky-drm-drv.h"
 #include "csky-drm-plane.h"
 
+static unsigned int idle_frames = 60;
+module_param(idle_frames, uint, 0644);
+MODULE_PARM_DESC(idle_frames,
+		 "vblanks without a flip or dirty report before the refresh rate is lowered");
+
+static unsigned int idle_refresh_div;
+module_param(idle_refresh_div, uint, 0644);
+MODULE_PARM_DESC(idle_refresh_div,
+		 "Divide the pixel clock by this much while idle, 0 or 1 to keep it (panel must cope)");
+
 static u32 crtc_readb(struct csky_drm_crtc *csky_crtc, u32 offset)
 {
 	return ioread32(csky_crtc->regs + (offset));
@@ -36,6 +46,131 @@ static void crtc_writeb(struct csky_drm_crtc *csky_crtc, u32 offset, u32 val)
 	iowrite32(val, csky_crtc->regs + (offset));
 }
 
+/* Write the addresses of an armed flip, irq_lock held */
+static void csky_crtc_write_pbase(struct csky_drm_crtc *csky_crtc,
+				  const struct csky_crtc_flip *flip)
+{
+	u32 control;
+
+	crtc_writeb(csky_crtc, CSKY_LCD_PBASE_Y, flip->pbase[0]);
+	crtc_writeb(csky_crtc, CSKY_LCD_PBASE_U, flip->pbase[1]);
+	crtc_writeb(csky_crtc, CSKY_LCD_PBASE_V, flip->pbase[2]);
+
+	if (flip->format != csky_crtc->format) {
+		control = crtc_readb(csky_crtc, CSKY_LCD_CONTROL);
+		control &= ~CSKY_LCDCON_DFS_MASK_SHIFTED;
+		crtc_writeb(csky_crtc, CSKY_LCD_CONTROL,
+			    control | flip->format);
+		csky_crtc->format = flip->format;
+	}
+}
+
+static void csky_crtc_flip_account(struct csky_drm_crtc *csky_crtc,
+				   const struct csky_crtc_flip *flip,
+				   u32 vblank)
+{
+	struct csky_crtc_flip_stats *st = &csky_crtc->stats;
+	u64 latency = ktime_to_ns(ktime_sub(ktime_get(), flip->queued));
+
+	st->flips++;
+	st->latency_ns += latency;
+	if (latency > st->max_latency_ns)
+		st->max_latency_ns = latency;
+	/* Due at the first vblank after the flush */
+	if (vblank != flip->queued_vblank)
+		st->missed_vblanks += vblank - flip->queued_vblank;
+}
+
+/*
+ * Take the armed flip out, writing its addresses if it has any.  Returns
+ * its event, which the caller sends once the vblank has been handled.
+ */
+static struct drm_pending_vblank_event *
+csky_crtc_latch(struct csky_drm_crtc *csky_crtc)
+{
+	struct csky_crtc_flip *flip = &csky_crtc->armed;
+	struct drm_pending_vblank_event *event = flip->event;
+
+	if (!flip->update && !event)
+		return NULL;
+
+	if (flip->update) {
+		csky_crtc_write_pbase(csky_crtc, flip);
+		csky_crtc->refresh.frame_bytes = flip->frame_bytes;
+	}
+	csky_crtc_flip_account(csky_crtc, flip,
+			       drm_crtc_vblank_count(&csky_crtc->base));
+
+	flip->update = false;
+	flip->event = NULL;
+
+	return event;
+}
+
+static void csky_crtc_send_event(struct drm_crtc *crtc,
+				 struct drm_pending_vblank_event *event,
+				 bool put)
+{
+	unsigned long flags;
+
+	if (!event)
+		return;
+
+	spin_lock_irqsave(&crtc->dev->event_lock, flags);
+	drm_crtc_send_vblank_event(crtc, event);
+	if (put)
+		drm_crtc_vblank_put(crtc);
+	spin_unlock_irqrestore(&crtc->dev->event_lock, flags);
+}
+
+void csky_crtc_set_scanout(struct drm_crtc *crtc,
+			   const dma_addr_t pbase[CSKY_MAX_PBASE], u32 format,
+			   u32 frame_bytes)
+{
+	struct csky_crtc_flip *next = &to_csky_crtc(crtc)->next;
+
+	memcpy(next->pbase, pbase, sizeof(next->pbase));
+	next->format = format;
+	next->frame_bytes = frame_bytes;
+	next->update = true;
+}
+
+/* Account the frame that just ended and pick the rate of the next one */
+static void csky_crtc_refresh_vblank(struct csky_drm_crtc *csky_crtc)
+{
+	struct csky_crtc_refresh *r = &csky_crtc->refresh;
+	struct csky_crtc_refresh_stats *st = &csky_crtc->refresh_stats;
+	unsigned int div = READ_ONCE(idle_refresh_div);
+	u32 pcd, slow_pcd;
+
+	st->fetched_bytes += r->frame_bytes;
+	if (r->div > 1) {
+		st->idle_frames++;
+		st->saved_bytes += (u64)(r->div - 1) * r->frame_bytes;
+	} else {
+		st->full_frames++;
+	}
+
+	if (r->activity || div < 2) {
+		r->activity = false;
+		r->idle = 0;
+		if (r->div > 1) {
+			crtc_writeb(csky_crtc, CSKY_LCD_TIMING2, r->timing2);
+			r->div = 1;
+		}
+		return;
+	}
+
+	if (r->div > 1 || ++r->idle < READ_ONCE(idle_frames))
+		return;
+
+	pcd = (r->timing2 & 0xff) + 1;
+	slow_pcd = min_t(u32, pcd * div, 0x100);
+	crtc_writeb(csky_crtc, CSKY_LCD_TIMING2,
+		    (r->timing2 & ~0xff) | (slow_pcd - 1));
+	r->div = slow_pcd / pcd;
+}
+
 static void csky_drm_crtc_mode_set_nofb(struct drm_crtc *crtc)
 {
 	struct csky_drm_crtc *csky_crtc = to_csky_crtc(crtc);
@@ -55,13 +190,8 @@ static void csky_drm_crtc_mode_set_nofb(struct drm_crtc *crtc)
 	crtc_writeb(csky_crtc, CSKY_LCD_CONTROL, control);
 
 	csky_crtc->is_enabled = true;
-#if 0
-	if (crtc->primary->state->fb->pixel_format == DRM_FORMAT_YUYV)
-		pixel_format = CSKY_LCDCON_DFS_YUV420;
-	else
-		pixel_format = CSKY_LCDCON_DFS_RGB;
-#endif
-	pixel_format = CSKY_LCDCON_DFS_YUV420;
+	/* The flips latch the format of their framebuffer */
+	pixel_format = csky_crtc->format;
 
 	tmp = mode->vsync_start - mode->vdisplay;
 	vm.vback_porch = mode->vsync_start - mode->vdisplay;
@@ -98,6 +228,12 @@ static void csky_drm_crtc_mode_set_nofb(struct drm_crtc *crtc)
 	if (vm.vactive > 1024)
 		timing2 |= CSKY_LCDTIM2_LPP_MSB;
 
+	spin_lock_irq(&csky_crtc->irq_lock);
+	csky_crtc->refresh.timing2 = timing2;
+	csky_crtc->refresh.div = 1;
+	csky_crtc->refresh.idle = 0;
+	spin_unlock_irq(&csky_crtc->irq_lock);
+
 	crtc_writeb(csky_crtc, CSKY_LCD_TIMING0, timing0);
 	crtc_writeb(csky_crtc, CSKY_LCD_TIMING1, timing1);
 	crtc_writeb(csky_crtc, CSKY_LCD_TIMING2, timing2);
@@ -131,6 +267,15 @@ static void csky_drm_crtc_enable(struct drm_crtc *crtc)
 static void csky_drm_crtc_disable(struct drm_crtc *crtc)
 {
 	struct csky_drm_crtc *csky_crtc = to_csky_crtc(crtc);
+	struct drm_pending_vblank_event *event;
+
+	/* No vblank will come to complete a flip still armed */
+	spin_lock_irq(&csky_crtc->irq_lock);
+	event = csky_crtc->armed.event;
+	csky_crtc->armed.event = NULL;
+	csky_crtc->armed.update = false;
+	spin_unlock_irq(&csky_crtc->irq_lock);
+	csky_crtc_send_event(crtc, event, true);
 
 	csky_crtc->is_enabled = false;
 	drm_crtc_vblank_off(crtc);
@@ -139,7 +284,11 @@ static void csky_drm_crtc_disable(struct drm_crtc *crtc)
 static int csky_crtc_atomic_check(struct drm_crtc *crtc,
 				     struct drm_crtc_state *state)
 {
-	/* struct csky_drm_crtc *csky_crtc = to_csky_crtc(crtc); */
+	struct csky_drm_crtc *csky_crtc = to_csky_crtc(crtc);
+
+	/* Only set while csky_crtc_page_flip() holds the CRTC lock */
+	to_csky_crtc_state(state)->async = csky_crtc->async_flip;
+
 	if (!state->enable)
 		return 0;
 
@@ -149,18 +298,9 @@ static int csky_crtc_atomic_check(struct drm_crtc *crtc,
 static void csky_crtc_atomic_begin(struct drm_crtc *crtc,
 				     struct drm_crtc_state *old_crtc_state)
 {
-	struct drm_pending_vblank_event *event = crtc->state->event;
-	if (event) {
-		crtc->state->event = NULL;
-
-		spin_lock_irq(&crtc->dev->event_lock);
-		if (drm_crtc_vblank_get(crtc) == 0)
-			drm_crtc_arm_vblank_event(crtc, event);
-		else
-			drm_crtc_send_vblank_event(crtc, event);
-		spin_unlock_irq(&crtc->dev->event_lock);
-	}
+	struct csky_drm_crtc *csky_crtc = to_csky_crtc(crtc);
 
+	csky_crtc->next.update = false;
 }
 
 #if 0
@@ -173,9 +313,83 @@ static const struct drm_crtc_helper_funcs vop_crtc_helper_funcs = {
 };
 #endif
 
+/*
+ * Arm what the plane updates built for the next vblank, or write it right
+ * away for an async flip.  A flip still armed from the previous commit is
+ * superseded: its frame is never shown, its event goes out with this one.
+ */
 static void csky_crtc_atomic_flush(struct drm_crtc *crtc,
 				  struct drm_crtc_state *old_crtc_state)
 {
+	struct csky_drm_crtc *csky_crtc = to_csky_crtc(crtc);
+	struct csky_crtc_flip *next = &csky_crtc->next;
+	struct drm_pending_vblank_event *event = crtc->state->event;
+	struct drm_pending_vblank_event *stale = NULL;
+	bool async = to_csky_crtc_state(crtc->state)->async;
+
+	crtc->state->event = NULL;
+	next->event = NULL;
+	next->queued = ktime_get();
+	next->queued_vblank = drm_crtc_vblank_count(crtc);
+
+	if (event && !async && csky_crtc->is_enabled &&
+	    drm_crtc_vblank_get(crtc) == 0) {
+		next->event = event;
+		event = NULL;
+	}
+
+	spin_lock_irq(&csky_crtc->irq_lock);
+	csky_crtc->refresh.activity = true;
+	if (async || !csky_crtc->is_enabled) {
+		if (next->update && csky_crtc->is_enabled) {
+			csky_crtc_write_pbase(csky_crtc, next);
+			csky_crtc->refresh.frame_bytes = next->frame_bytes;
+			/* Older addresses must not be latched over these */
+			csky_crtc->armed.update = false;
+		}
+		if (async)
+			csky_crtc->stats.async_flips++;
+	} else if (next->update || next->event) {
+		if (csky_crtc->armed.update || csky_crtc->armed.event) {
+			csky_crtc->stats.missed_vblanks++;
+			stale = csky_crtc->armed.event;
+			if (!next->update) {
+				memcpy(next->pbase, csky_crtc->armed.pbase,
+				       sizeof(next->pbase));
+				next->format = csky_crtc->armed.format;
+				next->frame_bytes = csky_crtc->armed.frame_bytes;
+				next->update = csky_crtc->armed.update;
+			}
+		}
+		csky_crtc->armed = *next;
+	}
+	spin_unlock_irq(&csky_crtc->irq_lock);
+
+	next->update = false;
+	csky_crtc_send_event(crtc, stale, true);
+	/* Async, disabled, or no vblank reference: complete right away */
+	csky_crtc_send_event(crtc, event, false);
+}
+
+static int csky_crtc_page_flip(struct drm_crtc *crtc,
+			       struct drm_framebuffer *fb,
+			       struct drm_pending_vblank_event *event,
+			       uint32_t flags)
+{
+	struct csky_drm_crtc *csky_crtc = to_csky_crtc(crtc);
+	int ret;
+
+	/*
+	 * The atomic helper refuses async flips, pass the request on to
+	 * csky_crtc_atomic_check() instead.  The ioctl holds the CRTC lock,
+	 * so no other commit sees the flag.
+	 */
+	csky_crtc->async_flip = flags & DRM_MODE_PAGE_FLIP_ASYNC;
+	ret = drm_atomic_helper_page_flip(crtc, fb, event,
+					  flags & ~DRM_MODE_PAGE_FLIP_ASYNC);
+	csky_crtc->async_flip = false;
+
+	return ret;
 }
 
 
@@ -190,6 +404,7 @@ static const struct drm_crtc_helper_funcs csky_crtc_helper_funcs = {
 	.commit 	= csky_drm_crtc_enable,
 	.atomic_check	= csky_crtc_atomic_check,
 	.atomic_begin	= csky_crtc_atomic_begin,
+	.atomic_flush	= csky_crtc_atomic_flush,
 //#endif
 #if 0
 	.enable = csky_drm_crtc_enable,
@@ -230,6 +445,7 @@ static struct drm_crtc_state *csky_crtc_duplicate_state(struct drm_crtc *crtc)
 		return NULL;
 
 	__drm_atomic_helper_crtc_duplicate_state(crtc, &csky_state->base);
+	csky_state->async = false;
 	return &csky_state->base;
 }
 
@@ -244,7 +460,7 @@ static void csky_crtc_destroy_state(struct drm_crtc *crtc,
 
 static const struct drm_crtc_funcs csky_crtc_funcs = {
 	.set_config	= drm_atomic_helper_set_config,
-	.page_flip	= drm_atomic_helper_page_flip,
+	.page_flip	= csky_crtc_page_flip,
 	.destroy	= csky_drm_crtc_destroy,
 	.reset = csky_crtc_reset,
 	.atomic_duplicate_state = csky_crtc_duplicate_state,
@@ -281,9 +497,51 @@ static void csky_crtc_disable_vblank(struct drm_crtc *crtc)
 }
 
 
+/*
+ * Damage reported through DRM_IOCTL_MODE_DIRTYFB.  The LCDC cannot fetch
+ * part of a frame, the damage only tells an idle screen to go back to
+ * full rate.
+ */
+static void csky_crtc_dirty(struct drm_crtc *crtc, struct drm_framebuffer *fb,
+			    unsigned int flags, struct drm_clip_rect *clips,
+			    unsigned int num_clips)
+{
+	struct csky_drm_crtc *csky_crtc = to_csky_crtc(crtc);
+	struct drm_display_mode *mode = &crtc->state->adjusted_mode;
+	unsigned int i, inc = 1;
+	u64 pixels = 0;
+	u32 w, h;
+
+	if (!crtc->primary->state || crtc->primary->state->fb != fb)
+		return;
+
+	/* copies come in pairs, only the destination changed */
+	if (flags & DRM_MODE_FB_DIRTY_ANNOTATE_COPY) {
+		inc = 2;
+		clips++;
+	}
+
+	if (!num_clips)
+		pixels = (u64)mode->hdisplay * mode->vdisplay;
+
+	for (i = 0; i < num_clips; i += inc) {
+		w = min_t(u32, clips[i].x2, mode->hdisplay);
+		h = min_t(u32, clips[i].y2, mode->vdisplay);
+		if (w > clips[i].x1 && h > clips[i].y1)
+			pixels += (u64)(w - clips[i].x1) * (h - clips[i].y1);
+	}
+
+	spin_lock_irq(&csky_crtc->irq_lock);
+	csky_crtc->refresh.activity = true;
+	csky_crtc->refresh_stats.dirty_calls++;
+	csky_crtc->refresh_stats.dirty_pixels += pixels;
+	spin_unlock_irq(&csky_crtc->irq_lock);
+}
+
 static const struct csky_crtc_funcs private_crtc_funcs = {
 	.enable_vblank = csky_crtc_enable_vblank,
 	.disable_vblank = csky_crtc_disable_vblank,
+	.dirty = csky_crtc_dirty,
 };
 
 struct csky_drm_crtc *csky_drm_crtc_create(struct drm_device *drm_dev,
@@ -300,6 +558,10 @@ struct csky_drm_crtc *csky_drm_crtc_create(struct drm_device *drm_dev,
 		return ERR_PTR(-ENOMEM);
 
 	csky_crtc->pipe = pipe;
+	spin_lock_init(&csky_crtc->reg_lock);
+	spin_lock_init(&csky_crtc->irq_lock);
+	csky_crtc->format = CSKY_LCDCON_DFS_YUV420;
+	csky_crtc->refresh.div = 1;
 	crtc = &csky_crtc->base;
 	private->csky_crtc = csky_crtc;
 
@@ -321,30 +583,26 @@ err_crtc:
 
 static irqreturn_t csky_lcdc_crtc_irq(int irq, void *dev_id)
 {
-	u32 tmp;
 	unsigned long status;
-	unsigned long flags;
 	struct csky_drm_crtc *csky_crtc = dev_id;
 	struct drm_crtc *crtc = &csky_crtc->base;
-	struct drm_device *dev = crtc->dev;
-	struct drm_pending_vblank_event *event = crtc->state->event;
+	struct drm_pending_vblank_event *event;
 
 	status = crtc_readb(csky_crtc, CSKY_LCD_INT_STAT);
 	/* clear interrupts */
 	crtc_writeb(csky_crtc, CSKY_LCD_INT_STAT, status);
 
-
+	/*
+	 * Latch before handling the vblank: a commit waiting for it may
+	 * release the old framebuffer as soon as the count moves.
+	 */
+	spin_lock(&csky_crtc->irq_lock);
+	event = csky_crtc_latch(csky_crtc);
+	csky_crtc_refresh_vblank(csky_crtc);
+	spin_unlock(&csky_crtc->irq_lock);
 
 	drm_crtc_handle_vblank(crtc);
-//#if 0
-	spin_lock_irqsave(&dev->event_lock, flags);
-	if (event) {
-		drm_crtc_send_vblank_event(crtc, event);
-		drm_crtc_vblank_put(crtc);
-		crtc->state->event = NULL;
-	}
-	spin_unlock_irqrestore(&dev->event_lock, flags);
-//#endif
+	csky_crtc_send_event(crtc, event, true);
 
 	return IRQ_HANDLED;
 }
@@ -11,12 +11,16 @@
  * warranty of any kind, whether express or implied.
  */
 
+#include <linux/debugfs.h>
 #include <linux/io.h>
 #include <linux/irq.h>
 #include <linux/irqchip.h>
 #include <linux/irqchip/chained_irq.h>
+#include <linux/ktime.h>
+#include <linux/moduleparam.h>
 #include <linux/of_address.h>
 #include <linux/of_irq.h>
+#include <linux/seq_file.h>
 #include <asm/irq.h>
 
 #define APB_INT_ENABLE_L	0x00
@@ -27,34 +31,141 @@
 #define APB_INT_FINALSTATUS_H	0x34
 #define APB_INT_BASE_OFFSET	0x04
 
+#define APB_INT_MAX_IRQS	64
+#define APB_INT_NR_PRIO		4
+
+/* Order in which the sources pending in one status read are handled */
+enum {
+	DEMUX_ASCENDING,	/* Lowest hwirq first */
+	DEMUX_PRIORITY,		/* Highest "snps,irq-priority" first */
+	DEMUX_ROUND_ROBIN,	/* Starting after the last source served */
+};
+
+static unsigned int demux = DEMUX_ASCENDING;
+module_param(demux, uint, 0644);
+MODULE_PARM_DESC(demux,
+		 "Dispatch order: 0 ascending hwirq, 1 by snps,irq-priority, 2 round robin");
+
+static unsigned int rescan_budget;
+module_param(rescan_budget, uint, 0644);
+MODULE_PARM_DESC(rescan_budget,
+		 "Status re-reads per exception before returning and letting it retrigger, 0 for no limit");
+
+static bool stats = true;
+module_param(stats, bool, 0644);
+MODULE_PARM_DESC(stats, "Account per source counts and times for debugfs");
+
+struct dw_apb_ictl_stat {
+	u64 count;
+	u64 time_ns;		/* In the handlers */
+	u64 max_ns;
+	u64 max_wait_ns;	/* From the exception to the handler */
+};
+
 static void __iomem *irq_base;
 static struct irq_domain *root_domain;
+static unsigned int nr_hwirqs;
+
+static u8 irq_prio[APB_INT_MAX_IRQS];
+static u64 prio_mask[APB_INT_NR_PRIO];
+static unsigned int rr_next;
 
-static inline int handle_irq_perbit(struct pt_regs *regs, u32 hwirq, u32 irq_base)
+/*
+ * Updated without locking from whichever CPU takes the exception, good
+ * enough for spotting the sources that dominate.
+ */
+static struct dw_apb_ictl_stat irq_stats[APB_INT_MAX_IRQS];
+static u64 budget_exhausted;
+
+static inline u64 dw_apb_ictl_pending(void)
 {
-	u32 irq;
+	return readl_relaxed(irq_base + APB_INT_FINALSTATUS_L) |
+	       (u64)readl_relaxed(irq_base + APB_INT_FINALSTATUS_H) << 32;
+}
 
-	if (hwirq == 0) return 0;
+static void dw_apb_ictl_dispatch(struct pt_regs *regs, u32 hwirq, u64 entry)
+{
+	struct dw_apb_ictl_stat *st = &irq_stats[hwirq];
+	u64 start, delta;
 
-	while (hwirq) {
-		irq = __ffs(hwirq);
-		hwirq &= ~BIT(irq);
-		handle_domain_irq(root_domain, irq_base + irq, regs);
+	if (!entry) {
+		handle_domain_irq(root_domain, hwirq, regs);
+		return;
 	}
 
-	return 1;
-}
+	start = ktime_get_ns();
+	handle_domain_irq(root_domain, hwirq, regs);
+	delta = ktime_get_ns() - start;
 
+	st->count++;
+	st->time_ns += delta;
+	if (delta > st->max_ns)
+		st->max_ns = delta;
+	if (start - entry > st->max_wait_ns)
+		st->max_wait_ns = start - entry;
+}
 
-static void dw_apb_ictl_handler(struct pt_regs *regs)
+static void dw_apb_ictl_demux(struct pt_regs *regs, u64 pending, u64 entry)
 {
-	int ret;
+	unsigned int first = rr_next;
+	u64 set;
+	u32 hwirq;
+	int p;
+
+	switch (READ_ONCE(demux)) {
+	case DEMUX_PRIORITY:
+		for (p = APB_INT_NR_PRIO - 1; p >= 0; p--) {
+			set = pending & prio_mask[p];
+			while (set) {
+				hwirq = __ffs64(set);
+				set &= ~BIT_ULL(hwirq);
+				dw_apb_ictl_dispatch(regs, hwirq, entry);
+			}
+		}
+		break;
+
+	case DEMUX_ROUND_ROBIN:
+		/* Rotate so bit 0 is the source after the one served first */
+		set = first ? pending >> first | pending << (64 - first) :
+			      pending;
+		rr_next = (first + __ffs64(set) + 1) % APB_INT_MAX_IRQS;
+		while (set) {
+			hwirq = __ffs64(set);
+			set &= ~BIT_ULL(hwirq);
+			dw_apb_ictl_dispatch(regs, (hwirq + first) %
+					     APB_INT_MAX_IRQS, entry);
+		}
+		break;
 
-	do {
-		ret  = handle_irq_perbit(regs ,readl_relaxed(irq_base + APB_INT_FINALSTATUS_L), 0);
-		ret |= handle_irq_perbit(regs ,readl_relaxed(irq_base + APB_INT_FINALSTATUS_H), 32);
-	} while(ret);
+	default:
+		while (pending) {
+			hwirq = __ffs64(pending);
+			pending &= ~BIT_ULL(hwirq);
+			dw_apb_ictl_dispatch(regs, hwirq, entry);
+		}
+		break;
+	}
+}
 
+/*
+ * Handle what is pending, then look again, at most rescan_budget times.
+ * Sources still pending when the budget runs out raise the exception
+ * again as soon as we return, after irq_exit() had a chance to run
+ * softirqs, so a source that never goes quiet cannot hold the CPU here.
+ */
+static void dw_apb_ictl_handler(struct pt_regs *regs)
+{
+	unsigned int budget = READ_ONCE(rescan_budget), pass = 0;
+	u64 entry = READ_ONCE(stats) ? ktime_get_ns() : 0;
+	u64 pending;
+
+	while ((pending = dw_apb_ictl_pending())) {
+		if (budget && pass++ == budget) {
+			budget_exhausted++;
+			break;
+		}
+		dw_apb_ictl_demux(regs, pending, entry);
+	}
 }
 
 /*static void dw_apb_ictl_handler(struct irq_desc *desc)
@@ -97,6 +208,21 @@ static void dw_apb_ictl_resume(struct irq_data *d)
 #define dw_apb_ictl_resume	NULL
 #endif /* CONFIG_PM */
 
+/* "snps,irq-priority" holds one level per hwirq, 0 (default) to 3 */
+static void __init dw_apb_ictl_init_prio(struct device_node *np)
+{
+	u32 prio;
+	int i;
+
+	for (i = 0; i < nr_hwirqs; i++) {
+		if (of_property_read_u32_index(np, "snps,irq-priority", i,
+					       &prio))
+			prio = 0;
+		irq_prio[i] = min_t(u32, prio, APB_INT_NR_PRIO - 1);
+		prio_mask[irq_prio[i]] |= BIT_ULL(i);
+	}
+}
+
 static int __init dw_apb_ictl_init(struct device_node *np,
 				   struct device_node *parent)
 {
@@ -177,6 +303,9 @@ static int __init dw_apb_ictl_init(struct device_node *np,
 		gc->chip_types[0].chip.irq_unmask = irq_gc_mask_clr_bit;
 		gc->chip_types[0].chip.irq_resume = dw_apb_ictl_resume;
 	}
+
+	nr_hwirqs = nrirqs;
+	dw_apb_ictl_init_prio(np);
 	set_handle_irq(dw_apb_ictl_handler);
 
 	//irq_set_chained_handler_and_data(irq, dw_apb_ictl_handler, domain);
@@ -191,3 +320,75 @@ err_release:
 }
 IRQCHIP_DECLARE(dw_apb_ictl_dh,
 		"snps,dw-apb-ictl-dh", dw_apb_ictl_init);
+
+#ifdef CONFIG_DEBUG_FS
+static int dw_apb_ictl_stats_show(struct seq_file *s, void *unused)
+{
+	struct dw_apb_ictl_stat *st;
+	unsigned int virq;
+	int i;
+
+	seq_printf(s, "demux %u, rescan budget %u, exhausted %llu\n",
+		   demux, rescan_budget, budget_exhausted);
+	seq_printf(s, "%5s %5s %4s %12s %14s %10s %10s %10s\n", "hwirq",
+		   "irq", "prio", "count", "time_ns", "avg_ns", "max_ns",
+		   "max_wait");
+
+	for (i = 0; i < nr_hwirqs; i++) {
+		virq = irq_find_mapping(root_domain, i);
+		if (!virq)
+			continue;
+
+		st = &irq_stats[i];
+		seq_printf(s, "%5d %5u %4u %12llu %14llu %10llu %10llu %10llu\n",
+			   i, virq, irq_prio[i], st->count, st->time_ns,
+			   st->count ? div64_u64(st->time_ns, st->count) : 0,
+			   st->max_ns, st->max_wait_ns);
+	}
+
+	return 0;
+}
+
+static int dw_apb_ictl_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dw_apb_ictl_stats_show, inode->i_private);
+}
+
+/* Any write clears the statistics */
+static ssize_t dw_apb_ictl_stats_write(struct file *file,
+				       const char __user *buf,
+				       size_t count, loff_t *ppos)
+{
+	memset(irq_stats, 0, sizeof(irq_stats));
+	budget_exhausted = 0;
+
+	return count;
+}
+
+static const struct file_operations dw_apb_ictl_stats_fops = {
+	.open		= dw_apb_ictl_stats_open,
+	.read		= seq_read,
+	.write		= dw_apb_ictl_stats_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/* The controller comes up long before debugfs does */
+static int __init dw_apb_ictl_debugfs_init(void)
+{
+	struct dentry *dir;
+
+	if (!root_domain)
+		return 0;
+
+	dir = debugfs_create_dir("irq-dw-apb-ictl-dh", NULL);
+	if (!dir)
+		return -ENOMEM;
+
+	debugfs_create_file("stats", 0600, dir, NULL,
+			    &dw_apb_ictl_stats_fops);
+
+	return 0;
+}
+late_initcall(dw_apb_ictl_debugfs_init);
+#endif /* CONFIG_DEBUG_FS */
@@ -40,8 +40,6 @@ static struct dentry *root_debugfs_dir;
 
 struct mbox_client_csky_device {
 	struct device		*dev;
-	void __iomem		*tx_mmio;
-	void __iomem		*rx_mmio;
 	struct mbox_chan	*tx_channel;
 	struct mbox_chan	*rx_channel;
 	char			*rx_buffer;
@@ -194,31 +192,16 @@ static void mbox_client_csky_receive_message(struct mbox_client *client,
 	struct mbox_client_csky_device *tdev = dev_get_drvdata(client->dev);
 	unsigned long flags;
 
-	if (tdev->rx_mmio == NULL) {
-		dev_err(client->dev, "rx_mmio is NULL\n");
-		return;
-	}
-
 	spin_lock_irqsave(&tdev->lock, flags);
-	memcpy_fromio(tdev->rx_buffer, tdev->rx_mmio, MBOX_MAX_MSG_LEN);
+	memcpy(tdev->rx_buffer, message, MBOX_MAX_MSG_LEN);
 #ifdef DEBUG
-	print_hex_dump_bytes("Client: Received [MMIO]: ",
+	print_hex_dump_bytes("Client: Received: ",
 			     DUMP_PREFIX_ADDRESS,
 			     tdev->rx_buffer, MBOX_MAX_MSG_LEN);
 #endif
 	spin_unlock_irqrestore(&tdev->lock, flags);
 }
 
-static void mbox_client_csky_prepare_message(struct mbox_client *client,
-					     void *message)
-{
-	struct mbox_client_csky_device *tdev = dev_get_drvdata(client->dev);
-
-	if (tdev->tx_mmio) {
-		memcpy_toio(tdev->tx_mmio, message, MBOX_MAX_MSG_LEN);
-	}
-}
-
 static void mbox_client_csky_message_sent(struct mbox_client *client,
 					  void *message, int r)
 {
@@ -246,7 +229,6 @@ mbox_client_csky_request_channel(struct platform_device *pdev,
 
 	client->dev		= &pdev->dev;
 	client->rx_callback	= mbox_client_csky_receive_message;
-	client->tx_prepare	= mbox_client_csky_prepare_message;
 	client->tx_done		= mbox_client_csky_message_sent;
 	client->tx_block	= true;
 	client->knows_txdone	= true;
@@ -264,7 +246,6 @@ mbox_client_csky_request_channel(struct platform_device *pdev,
 
 static int mbox_client_csky_probe(struct platform_device *pdev)
 {
-	struct device_node *node = pdev->dev.of_node;
 	struct mbox_client_csky_device *tdev;
 	int ret;
 
@@ -272,9 +253,6 @@ static int mbox_client_csky_probe(struct platform_device *pdev)
 	if (!tdev)
 		return -ENOMEM;
 
-	tdev->tx_mmio = of_iomap(node, 0);
-	tdev->rx_mmio = of_iomap(node, 1);
-
 	tdev->tx_channel = mbox_client_csky_request_channel(pdev, "channel");
 	if (!tdev->tx_channel) {
 		dev_err(&pdev->dev, "Request channel failed\n");
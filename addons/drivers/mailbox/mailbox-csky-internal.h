@@ -21,6 +21,9 @@
 enum mbox_csky_mssg_type {
 	CSKY_MBOX_MSSG_DATA = 'd',	/* Data to receiver */
 	CSKY_MBOX_MSSG_ACK  = 'a',	/* ACK to sender */
+	CSKY_MBOX_MSSG_TEST = 't',	/* Ring loopback test, never delivered */
+	CSKY_MBOX_MSSG_BUF  = 'b',	/* Shared buffer handed to receiver */
+	CSKY_MBOX_MSSG_BUF_DONE = 'f',	/* Shared buffer handed back to owner */
 };
 
 #define MBOX_CSKY_MSSG_HEAD_LENGTH 4
@@ -28,17 +31,81 @@ enum mbox_csky_mssg_type {
  * struct mbox_message - Description of a message that send to mailbox
  * @mssg_type:	The message type that transfer, refer to mbox_csky_mssg_type
  * @length:	Then data length, must <= CSKY_MBOX_MAX_DATA_LENGTH
- * @reserved0:	Undefined
+ * @chan:	Logical channel the message belongs to, 0 for a peer that
+ *		predates them
  * @reserved1:	Undefined
  * @data:	The transfer data. Ignore if mssg_type is CSKY_MBOX_MSSG_ACK
  */
 struct mbox_message {
 	u8 mssg_type;
 	u8 length;
-	u8 reserved0;
+	u8 chan;
 	u8 reserved1;
 	u8 data[CSKY_MBOX_MAX_DATA_LENGTH];
 };
 
+/**
+ * struct mbox_buf_desc - Payload of CSKY_MBOX_MSSG_BUF(_DONE) messages
+ * @addr:	Bus address of the buffer in its owner's pool
+ * @len:	Bytes of payload in the buffer
+ * @cookie:	Owner's tag for the buffer, echoed back with BUF_DONE
+ */
+struct mbox_buf_desc {
+	u32 addr;
+	u32 len;
+	u32 cookie;
+};
+
+/**
+ * struct mbox_ring - One direction of the shared-memory message ring
+ * @head:	Next slot the producer fills, free running, producer owned
+ * @tail:	Next slot the consumer drains, free running, consumer owned
+ * @slots:	Number of slots, a power of two, written by the producer
+ * @tx_wait:	Set by a producer that found the ring full, the consumer
+ *		clears it and rings the doorbell once it has freed slots
+ * @reserved:	Pads the header to the size of one message
+ * @slot:	The messages
+ *
+ * The producer rings the doorbell only when its message turned an empty
+ * ring into a non-empty one; a consumer re-reads @head after publishing
+ * @tail, so nothing posted while it drains is left behind.
+ */
+struct mbox_ring {
+	u32 head;
+	u32 tail;
+	u32 slots;
+	u32 tx_wait;
+	u32 reserved[12];
+	struct mbox_message slot[0];
+};
+
+#define CSKY_RPMSG_MAGIC	0x47534d52	/* "RMSG" */
+
+/**
+ * struct mbox_rpmsg_table - How the rpmsg transport finds its vrings
+ * @magic:	CSKY_RPMSG_MAGIC once the rest is valid
+ * @status:	virtio status byte, the peer starts on VIRTIO_CONFIG_S_DRIVER_OK
+ * @features:	virtio features Linux accepted
+ * @num:	Entries per vring
+ * @align:	vring alignment
+ * @vring:	Bus addresses of the vrings, [0] carries messages to Linux,
+ *		[1] messages from Linux
+ *
+ * A kick is a CSKY_MBOX_MSSG_DATA message with the index of the vring;
+ * the index is a hint only, a kicked side always looks at both vrings.
+ */
+struct mbox_rpmsg_table {
+	u32 magic;
+	u32 status;
+	u32 features;
+	u32 num;
+	u32 align;
+	u32 vring[2];
+};
+
+struct mbox_chan;
+
+bool csky_mbox_chan_has_ring(struct mbox_chan *chan);
+
 #endif /* __MAILBOX_CSKY_INTERNAL_H */
 
@@ -15,15 +15,22 @@
  *
  */
 
+#include <linux/debugfs.h>
 #include <linux/device.h>
 #include <linux/interrupt.h>
 #include <linux/io.h>
 #include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
 #include <linux/mailbox_controller.h>
 #include <linux/module.h>
 #include <linux/of.h>
 #include <linux/of_address.h>
 #include <linux/platform_device.h>
+#include <linux/sort.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
 
 #include "mailbox-csky.h"
 #include "mailbox-csky-internal.h"
@@ -55,8 +62,62 @@
 #define RX_ENABLE_INTERRUPT(mbox)	writel(1, MBOX_INTENB_ADDR(mbox))
 #define RX_DISABLE_INTERRUPT(mbox)	writel(0, MBOX_INTENB_ADDR(mbox))
 
+#define MBOX_RING_MIN_SLOTS	2
+#define MBOX_RING_RESERVE(mbox)	((mbox)->slots / 4)
+#define MBOX_TEST_MAX_COUNT	(1 << 18)
+#define MBOX_TEST_TIMEOUT	(10 * HZ)
+#define MBOX_TEST_BULK_CHAN	0
+#define MBOX_TEST_CTRL_CHAN	1
+
+static bool loopback;
+module_param(loopback, bool, 0444);
+MODULE_PARM_DESC(loopback,
+		 "Feed the ring transport back to this side instead of the peer");
+
+static bool wrr;
+module_param(wrr, bool, 0644);
+MODULE_PARM_DESC(wrr,
+		 "Share the transport by weighted round robin instead of strict priority");
+
+static struct dentry *csky_mbox_debugfs_root;
+
+/*
+ * A logical channel.  The framework hands us one message per channel at
+ * a time; csky_mbox_tx_schedule() decides which channel's message takes
+ * the transport next.
+ */
 struct csky_mbox_chan {
 	struct csky_mbox *parent;
+	u32 index;
+	u32 prio;		/* 0 (bulk) to CSKY_MBOX_MAX_PRIO */
+	int credit;		/* Messages left in this round, wrr only */
+	bool active;		/* Started, counts towards top_prio */
+	void *pending;		/* Message waiting for the transport */
+	ktime_t queued;		/* When it started waiting */
+	bool done;		/* Posted, txdone not reported yet */
+
+	/* statistics, see csky_mbox_add_debugfs() */
+	u64 tx_mssgs;
+	u64 rx_mssgs;
+	u64 wait_ns;
+	u64 max_wait_ns;
+	struct dentry *debugfs;
+};
+
+/* Loopback throughput and latency test, see csky_mbox_test_run() */
+struct csky_mbox_test {
+	struct mutex lock;
+	wait_queue_head_t wq;
+	bool running;
+	bool bulk;		/* Control messages under a bulk stream */
+	u32 count;
+	u32 sent;
+	u32 received;
+	u64 bulk_received;
+	u64 *lat_ns;
+	struct mbox_message mssg[2];	/* Queued on the test channels */
+	u32 prio[2];			/* Their own priorities */
+	char result[256];
 };
 
 struct csky_mbox {
@@ -69,6 +130,34 @@ struct csky_mbox {
 	struct csky_mbox_chan *mchans;
 	struct mbox_chan *chans;
 	struct mbox_controller controller;
+	struct mbox_message rx_mssg;
+	u32 users;		/* Channels started, under cfg_lock */
+
+	/* Transmit scheduling, under tx_lock */
+	spinlock_t tx_lock;
+	struct csky_mbox_chan *tx_active;	/* Awaiting ACK, legacy only */
+	u32 rr_next;
+	u32 top_prio;		/* Highest priority of the active channels */
+
+	/* Ring transport, only when the node has a shared memory region */
+	struct mbox_ring __iomem *tx_ring;
+	struct mbox_ring __iomem *rx_ring;
+	u32 slots;
+	u32 tx_head;
+	u32 rx_tail;
+	bool tx_full;
+	spinlock_t rx_lock;
+	struct tasklet_struct txdone_task;
+	struct tasklet_struct loop_task;
+	struct csky_mbox_test test;
+
+	/* statistics, see csky_mbox_add_debugfs() */
+	u64 tx_mssgs;
+	u64 rx_mssgs;
+	u64 doorbells;
+	u64 doorbells_saved;
+	u64 tx_ring_full;
+	struct dentry *debugfs;
 };
 
 #ifdef __LITTLE_ENDIAN
@@ -83,16 +172,319 @@ struct csky_mbox {
 #define	BYTE3(w)	((w) & 0xFF)
 #endif
 
+static void csky_mbox_test_recv(struct csky_mbox *mbox,
+				const struct mbox_message *mssg);
+
+/* Hand a message, already copied out of shared memory, to its client */
+static void csky_mbox_deliver(struct csky_mbox *mbox,
+			      struct mbox_message *mssg)
+{
+	struct mbox_chan *chan;
+
+	mbox->rx_mssgs++;
+
+	if (mssg->mssg_type == CSKY_MBOX_MSSG_TEST) {
+		csky_mbox_test_recv(mbox, mssg);
+		return;
+	}
+
+	if (mssg->chan >= mbox->chan_num) {
+		dev_err(mbox->dev, "Message for unknown channel %d\n",
+			mssg->chan);
+		return;
+	}
+
+	chan = &(mbox->chans[mssg->chan]);
+	mbox->mchans[mssg->chan].rx_mssgs++;
+	if (chan->cl)
+		mbox_chan_received_data(chan, (void *)mssg);
+}
+
+static void csky_mbox_kick(struct csky_mbox *mbox)
+{
+	mbox->doorbells++;
+
+	if (loopback)
+		tasklet_schedule(&mbox->loop_task);
+	else
+		TX_GENERATE_INTERRUPT(mbox);
+}
+
+static u32 csky_mbox_ring_space(struct csky_mbox *mbox)
+{
+	return mbox->slots - (mbox->tx_head - readl(&mbox->tx_ring->tail));
+}
+
+/* Post one message, with tx_lock held so there is a single producer */
+static int csky_mbox_ring_send(struct csky_mbox *mbox,
+			       const struct mbox_message *mssg)
+{
+	struct mbox_ring __iomem *ring = mbox->tx_ring;
+	u32 head = mbox->tx_head;
+
+	if (!csky_mbox_ring_space(mbox))
+		return -EBUSY;
+
+	memcpy_toio(&ring->slot[head & (mbox->slots - 1)], mssg,
+		    sizeof(*mssg));
+	wmb();
+	writel(head + 1, &ring->head);
+	mbox->tx_head = head + 1;
+	mbox->tx_mssgs++;
+
+	/* A consumer still draining re-reads head before it goes idle */
+	mb();
+	if (readl(&ring->tail) == head)
+		csky_mbox_kick(mbox);
+	else
+		mbox->doorbells_saved++;
+
+	return 0;
+}
+
+/* Recompute top_prio from the channels in use, with tx_lock held */
+static void csky_mbox_update_top_prio(struct csky_mbox *mbox)
+{
+	u32 i, top = 0;
+
+	for (i = 0; i < mbox->chan_num; i++)
+		if (mbox->mchans[i].active)
+			top = max(top, mbox->mchans[i].prio);
+
+	mbox->top_prio = top;
+}
+
+/* May @mchan's message take the transport, which has @space slots free? */
+static bool csky_mbox_tx_allowed(struct csky_mbox *mbox,
+				 struct csky_mbox_chan *mchan, u32 space)
+{
+	if (!mchan->pending || !space)
+		return false;
+
+	/* The last slots of the ring are kept for the most urgent channels */
+	return mchan->prio >= mbox->top_prio ||
+	       space > MBOX_RING_RESERVE(mbox);
+}
+
+/*
+ * Choose the next channel to send, by strict priority, or with wrr by
+ * weighted round robin, a channel getting prio + 1 messages per round.
+ * Channels that tie take turns.
+ */
+static struct csky_mbox_chan *csky_mbox_tx_pick(struct csky_mbox *mbox)
+{
+	struct csky_mbox_chan *mchan, *best = NULL;
+	u32 n = mbox->chan_num;
+	u32 space, i;
+	int round;
+
+	if (mbox->tx_ring)
+		space = csky_mbox_ring_space(mbox);
+	else
+		space = mbox->tx_active ? 0 : 1;
+
+	if (!wrr) {
+		for (i = 0; i < n; i++) {
+			mchan = &mbox->mchans[(mbox->rr_next + i) % n];
+			if (csky_mbox_tx_allowed(mbox, mchan, space) &&
+			    (!best || mchan->prio > best->prio))
+				best = mchan;
+		}
+		if (best)
+			mbox->rr_next = (best->index + 1) % n;
+		return best;
+	}
+
+	for (round = 0; round < 2; round++) {
+		for (i = 0; i < n; i++) {
+			mchan = &mbox->mchans[(mbox->rr_next + i) % n];
+			if (mchan->credit <= 0 ||
+			    !csky_mbox_tx_allowed(mbox, mchan, space))
+				continue;
+
+			if (--mchan->credit)
+				mbox->rr_next = mchan->index;
+			else
+				mbox->rr_next = (mchan->index + 1) % n;
+			return mchan;
+		}
+
+		/* Everyone waiting has had its share: start a new round */
+		for (i = 0; i < n; i++)
+			mbox->mchans[i].credit = mbox->mchans[i].prio + 1;
+	}
+
+	return NULL;
+}
+
+static bool csky_mbox_tx_pending(struct csky_mbox *mbox)
+{
+	u32 i;
+
+	for (i = 0; i < mbox->chan_num; i++)
+		if (mbox->mchans[i].pending)
+			return true;
+
+	return false;
+}
+
+static void csky_mbox_tx_account(struct csky_mbox_chan *mchan)
+{
+	u64 wait = ktime_to_ns(ktime_sub(ktime_get(), mchan->queued));
+
+	mchan->tx_mssgs++;
+	mchan->wait_ns += wait;
+	if (wait > mchan->max_wait_ns)
+		mchan->max_wait_ns = wait;
+}
+
+/*
+ * Move waiting messages onto the transport for as long as it has room.
+ * On the ring, a message is done once posted; the legacy window holds
+ * one message until the peer's ACK.
+ */
+static void csky_mbox_tx_schedule(struct csky_mbox *mbox)
+{
+	struct csky_mbox_chan *mchan;
+	struct mbox_message mssg;
+	unsigned long flags;
+	bool done = false, waited = false;
+
+	spin_lock_irqsave(&mbox->tx_lock, flags);
+	for (;;) {
+		while ((mchan = csky_mbox_tx_pick(mbox))) {
+			memcpy(&mssg, mchan->pending, sizeof(mssg));
+			mssg.chan = mchan->index;
+
+			if (mbox->tx_ring) {
+				if (csky_mbox_ring_send(mbox, &mssg))
+					break;
+				mchan->done = true;
+				done = true;
+			} else {
+				memcpy_toio(MBOX_TX_MSSG_ADDR(mbox), &mssg,
+					    sizeof(mssg));
+				mbox->tx_mssgs++;
+				mbox->tx_active = mchan;
+				TX_GENERATE_INTERRUPT(mbox);
+			}
+
+			csky_mbox_tx_account(mchan);
+			mchan->pending = NULL;
+		}
+
+		if (!mbox->tx_ring || waited || !csky_mbox_tx_pending(mbox))
+			break;
+
+		/* Ask for a doorbell, then look again in case we just missed it */
+		writel(1, &mbox->tx_ring->tx_wait);
+		mb();
+		mbox->tx_full = true;
+		mbox->tx_ring_full++;
+		waited = true;
+	}
+	spin_unlock_irqrestore(&mbox->tx_lock, flags);
+
+	if (done)
+		tasklet_schedule(&mbox->txdone_task);
+}
+
+/*
+ * Drain the receive ring and restart a sender that found its ring full.
+ * Returns whether there was anything to deliver.
+ */
+static bool csky_mbox_ring_poll(struct csky_mbox *mbox)
+{
+	struct mbox_ring __iomem *ring = mbox->rx_ring;
+	unsigned long flags;
+	u32 tail, head;
+	bool delivered;
+
+	spin_lock_irqsave(&mbox->rx_lock, flags);
+
+	tail = mbox->rx_tail;
+	head = readl(&ring->head);
+	while (tail != head) {
+		rmb();
+		do {
+			memcpy_fromio(&mbox->rx_mssg,
+				      &ring->slot[tail & (mbox->slots - 1)],
+				      sizeof(mbox->rx_mssg));
+			/* The slot is ours until tail moves past it */
+			mb();
+			writel(++tail, &ring->tail);
+			csky_mbox_deliver(mbox, &mbox->rx_mssg);
+		} while (tail != head);
+
+		mb();
+		head = readl(&ring->head);
+	}
+	delivered = tail != mbox->rx_tail;
+	mbox->rx_tail = tail;
+
+	if (readl(&ring->tx_wait)) {
+		writel(0, &ring->tx_wait);
+		csky_mbox_kick(mbox);
+	}
+
+	spin_unlock_irqrestore(&mbox->rx_lock, flags);
+
+	if (mbox->tx_full && csky_mbox_ring_space(mbox)) {
+		mbox->tx_full = false;
+		csky_mbox_tx_schedule(mbox);
+	}
+
+	if (mbox->test.running)
+		wake_up(&mbox->test.wq);
+
+	return delivered;
+}
+
+static void csky_mbox_txdone_task(unsigned long data)
+{
+	struct csky_mbox *mbox = (struct csky_mbox *)data;
+	unsigned long flags;
+	bool done;
+	u32 i;
+
+	for (i = 0; i < mbox->chan_num; i++) {
+		spin_lock_irqsave(&mbox->tx_lock, flags);
+		done = mbox->mchans[i].done;
+		mbox->mchans[i].done = false;
+		spin_unlock_irqrestore(&mbox->tx_lock, flags);
+
+		/*
+		 * Completes the posted message and submits the next one.
+		 * ring_test traffic has no client to complete.
+		 */
+		if (done && mbox->chans[i].cl)
+			mbox_chan_txdone(&mbox->chans[i], 0);
+	}
+}
+
+static void csky_mbox_loop_task(unsigned long data)
+{
+	csky_mbox_ring_poll((struct csky_mbox *)data);
+}
+
 static irqreturn_t csky_mbox_interrupt(int irq, void *p)
 {
 	struct csky_mbox *mbox = (struct csky_mbox *)p;
-	struct mbox_chan *chan = &(mbox->chans[0]);
-	struct mbox_message *mssg_rx =
-		(struct mbox_message *)(MBOX_RX_MSSG_ADDR(mbox));
+	struct mbox_message *mssg_rx = &mbox->rx_mssg;
+	struct csky_mbox_chan *mchan;
 
 	RX_CLEAR_INTERRUPT(mbox);
 
-	if (mssg_rx->mssg_type == CSKY_MBOX_MSSG_DATA) {
+	if (mbox->rx_ring) {
+		csky_mbox_ring_poll(mbox);
+		return IRQ_HANDLED;
+	}
+
+	memcpy_fromio(mssg_rx, MBOX_RX_MSSG_ADDR(mbox), sizeof(*mssg_rx));
+
+	if (mssg_rx->mssg_type == CSKY_MBOX_MSSG_DATA ||
+	    mssg_rx->mssg_type == CSKY_MBOX_MSSG_BUF ||
+	    mssg_rx->mssg_type == CSKY_MBOX_MSSG_BUF_DONE) {
 		struct mbox_message *mssg_tx =
 			(struct mbox_message *)MBOX_TX_MSSG_ADDR(mbox);
 #ifdef DEBUG
@@ -106,14 +498,21 @@ static irqreturn_t csky_mbox_interrupt(int irq, void *p)
 #endif
 
 		/* Receive message's data to upper */
-		mbox_chan_received_data(chan, (void*)(mssg_rx));
+		csky_mbox_deliver(mbox, mssg_rx);
 
 		/* Send ACK back */
 		mssg_tx->mssg_type = CSKY_MBOX_MSSG_ACK;
 		TX_GENERATE_INTERRUPT(mbox);
 	}
 	else if (mssg_rx->mssg_type == CSKY_MBOX_MSSG_ACK) {
-		mbox_chan_txdone(chan, 0);	/* Notify tx done */
+		spin_lock(&mbox->tx_lock);
+		mchan = mbox->tx_active;
+		mbox->tx_active = NULL;
+		spin_unlock(&mbox->tx_lock);
+
+		if (mchan)	/* Notify tx done */
+			mbox_chan_txdone(&mbox->chans[mchan->index], 0);
+		csky_mbox_tx_schedule(mbox);
 	}
 	else {
 		dev_err(mbox->dev, "Undefined mssg_type:%02x",
@@ -127,12 +526,29 @@ static struct mbox_chan *csky_mbox_xlate(struct mbox_controller *controller,
 					 const struct of_phandle_args *spec)
 {
 	struct csky_mbox *mbox = dev_get_drvdata(controller->dev);
+	struct csky_mbox_chan *mchan;
 	u32 i = spec->args[0];
-	if (i > CSKY_MBOX_MAX_CHAN) {
+	unsigned long flags;
+	u32 prio = 0;
+
+	if (i >= mbox->chan_num) {
 		dev_err(mbox->dev, "Failed to get chans[%d]\n", i);
-		return NULL;
+		return ERR_PTR(-EINVAL);
 	}
 
+	/*
+	 * The optional second cell is the channel's priority.  It counts
+	 * towards top_prio from csky_mbox_startup() on.
+	 */
+	if (spec->args_count > 1)
+		prio = min_t(u32, spec->args[1], CSKY_MBOX_MAX_PRIO);
+
+	mchan = &mbox->mchans[i];
+	spin_lock_irqsave(&mbox->tx_lock, flags);
+	mchan->prio = prio;
+	mchan->credit = prio + 1;
+	spin_unlock_irqrestore(&mbox->tx_lock, flags);
+
 	return &mbox->chans[i];
 }
 
@@ -140,6 +556,7 @@ static int csky_mbox_send_data(struct mbox_chan *chan, void *data)
 {
 	struct csky_mbox_chan *mchan = chan->con_priv;
 	struct csky_mbox *mbox = mchan->parent;
+	unsigned long flags;
 
 #ifdef DEBUG
 	char *bytes = (char *)data;
@@ -148,7 +565,12 @@ static int csky_mbox_send_data(struct mbox_chan *chan, void *data)
 		bytes[0], bytes[1], bytes[2], bytes[3],
 		bytes[4], bytes[5], bytes[6], bytes[7]);
 #endif
-	TX_GENERATE_INTERRUPT(mbox);
+	spin_lock_irqsave(&mbox->tx_lock, flags);
+	mchan->pending = data;
+	mchan->queued = ktime_get();
+	spin_unlock_irqrestore(&mbox->tx_lock, flags);
+
+	csky_mbox_tx_schedule(mbox);
 	return 0;
 }
 
@@ -156,22 +578,60 @@ static int csky_mbox_startup(struct mbox_chan *chan)
 {
 	struct csky_mbox_chan *mchan = chan->con_priv;
 	struct csky_mbox *mbox = mchan->parent;
+	unsigned long flags;
+
+	spin_lock_irqsave(&mbox->tx_lock, flags);
+	mchan->active = true;
+	csky_mbox_update_top_prio(mbox);
+	spin_unlock_irqrestore(&mbox->tx_lock, flags);
 
 	/* enable and ummask interrupt */
-	RX_ENABLE_INTERRUPT(mbox);
-	RX_UNMASK_INTERRUPT(mbox);
+	mutex_lock(&mbox->cfg_lock);
+	if (!mbox->users++) {
+		RX_ENABLE_INTERRUPT(mbox);
+		RX_UNMASK_INTERRUPT(mbox);
+	}
+	mutex_unlock(&mbox->cfg_lock);
+
+	/* Pick up whatever the peer posted before the channel was opened */
+	if (mbox->rx_ring)
+		csky_mbox_ring_poll(mbox);
 	return 0;
 }
 
+/* Lets a busy client collect ring messages ahead of the doorbell */
+static bool csky_mbox_peek_data(struct mbox_chan *chan)
+{
+	struct csky_mbox_chan *mchan = chan->con_priv;
+	struct csky_mbox *mbox = mchan->parent;
+
+	if (!mbox->rx_ring)
+		return false;
+
+	return csky_mbox_ring_poll(mbox);
+}
+
 static void csky_mbox_shutdown(struct mbox_chan *chan)
 {
 	struct csky_mbox_chan *mchan = chan->con_priv;
 	struct csky_mbox *mbox = mchan->parent;
+	unsigned long flags;
 
-	/* disable interrupts */
-	RX_CLEAR_INTERRUPT(mbox);
-	RX_DISABLE_INTERRUPT(mbox);
-	RX_MASK_INTERRUPT(mbox);
+	spin_lock_irqsave(&mbox->tx_lock, flags);
+	mchan->pending = NULL;
+	mchan->done = false;
+	mchan->active = false;
+	csky_mbox_update_top_prio(mbox);
+	spin_unlock_irqrestore(&mbox->tx_lock, flags);
+
+	/* disable interrupts with the last channel */
+	mutex_lock(&mbox->cfg_lock);
+	if (!--mbox->users) {
+		RX_CLEAR_INTERRUPT(mbox);
+		RX_DISABLE_INTERRUPT(mbox);
+		RX_MASK_INTERRUPT(mbox);
+	}
+	mutex_unlock(&mbox->cfg_lock);
 }
 
 static const struct mbox_chan_ops csky_mbox_ops = {
@@ -179,9 +639,438 @@ static const struct mbox_chan_ops csky_mbox_ops = {
 	.startup	= csky_mbox_startup,
 	.shutdown	= csky_mbox_shutdown,
 	.last_tx_done	= NULL,	/* Not needed, only txdone_poll mode needs */
-	.peek_data	= NULL, /* Not needed, interrupt will handle it */
+	.peek_data	= csky_mbox_peek_data,
+};
+
+/*
+ * Whether @chan, a channel of this controller, runs over the ring
+ * transport.  The legacy window also carries the ACK of every received
+ * message, so a client that sends from its rx callback needs the ring:
+ * the ACK would overwrite that message.
+ */
+bool csky_mbox_chan_has_ring(struct mbox_chan *chan)
+{
+	struct csky_mbox_chan *mchan = chan->con_priv;
+
+	return chan->mbox->ops == &csky_mbox_ops && mchan->parent->tx_ring;
+}
+EXPORT_SYMBOL_GPL(csky_mbox_chan_has_ring);
+
+static int csky_mbox_test_cmp(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void csky_mbox_test_recv(struct csky_mbox *mbox,
+				const struct mbox_message *mssg)
+{
+	struct csky_mbox_test *test = &mbox->test;
+	u64 stamp;
+
+	if (!test->running)
+		return;
+
+	if (test->bulk && mssg->chan == MBOX_TEST_BULK_CHAN) {
+		test->bulk_received++;
+		return;
+	}
+
+	if (test->received >= test->count)
+		return;
+
+	memcpy(&stamp, mssg->data, sizeof(stamp));
+	test->lat_ns[test->received++] = ktime_get_ns() - stamp;
+}
+
+static u64 csky_mbox_test_pct(struct csky_mbox_test *test, u32 permille)
+{
+	return test->lat_ns[min_t(u64, test->count - 1,
+				  div_u64((u64)test->count * permille, 1000))];
+}
+
+/* Post the test's messages straight onto the ring, back to back */
+static int csky_mbox_test_send(struct csky_mbox *mbox)
+{
+	struct csky_mbox_test *test = &mbox->test;
+	struct mbox_message *mssg = &test->mssg[0];
+	unsigned long flags;
+	u64 stamp;
+	long left;
+	int err;
+
+	for (; test->sent < test->count; test->sent++) {
+		left = wait_event_timeout(test->wq, csky_mbox_ring_space(mbox),
+					  MBOX_TEST_TIMEOUT);
+		if (!left)
+			return -ETIMEDOUT;
+
+		stamp = ktime_get_ns();
+		memcpy(mssg->data, &stamp, sizeof(stamp));
+
+		spin_lock_irqsave(&mbox->tx_lock, flags);
+		err = csky_mbox_ring_send(mbox, mssg);
+		spin_unlock_irqrestore(&mbox->tx_lock, flags);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+/* Time stamp the test message of logical channel @i and queue it there */
+static void csky_mbox_test_queue(struct csky_mbox *mbox, u32 i)
+{
+	struct mbox_message *mssg = &mbox->test.mssg[i];
+	u64 stamp = ktime_get_ns();
+
+	memcpy(mssg->data, &stamp, sizeof(stamp));
+	csky_mbox_send_data(&mbox->chans[i], mssg);
+}
+
+/*
+ * Keep a message queued on the bulk channel, so that the ring stays full
+ * down to the slots reserved for urgent channels.  Whenever the bulk
+ * channel is held back, send the next control message on the top
+ * priority channel, one at a time.
+ */
+static int csky_mbox_test_send_bulk(struct csky_mbox *mbox)
+{
+	struct csky_mbox_test *test = &mbox->test;
+	struct csky_mbox_chan *bulk = &mbox->mchans[MBOX_TEST_BULK_CHAN];
+	unsigned long deadline = jiffies + MBOX_TEST_TIMEOUT;
+	long left;
+
+	while (test->sent < test->count) {
+		left = wait_event_timeout(test->wq,
+					  !READ_ONCE(bulk->pending) ||
+					  test->received == test->sent,
+					  MBOX_TEST_TIMEOUT);
+		/* The ring may also never fill, if it drains fast enough */
+		if (!left || time_after(jiffies, deadline))
+			return -ETIMEDOUT;
+
+		if (!READ_ONCE(bulk->pending)) {
+			csky_mbox_test_queue(mbox, MBOX_TEST_BULK_CHAN);
+		} else if (test->received == test->sent) {
+			test->sent++;
+			csky_mbox_test_queue(mbox, MBOX_TEST_CTRL_CHAN);
+			deadline = jiffies + MBOX_TEST_TIMEOUT;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Lend the test channels a bulk and a control priority, or give the
+ * ones they had back.
+ */
+static void csky_mbox_test_setup(struct csky_mbox *mbox, bool start)
+{
+	struct csky_mbox_chan *bulk = &mbox->mchans[MBOX_TEST_BULK_CHAN];
+	struct csky_mbox_chan *ctrl = &mbox->mchans[MBOX_TEST_CTRL_CHAN];
+	struct csky_mbox_test *test = &mbox->test;
+	unsigned long flags;
+	u32 i;
+
+	spin_lock_irqsave(&mbox->tx_lock, flags);
+	if (start) {
+		test->prio[0] = bulk->prio;
+		test->prio[1] = ctrl->prio;
+		bulk->prio = 0;
+		ctrl->prio = CSKY_MBOX_MAX_PRIO;
+	} else {
+		bulk->prio = test->prio[0];
+		ctrl->prio = test->prio[1];
+	}
+	/* No client holds them while the test runs */
+	bulk->active = start;
+	ctrl->active = start;
+	csky_mbox_update_top_prio(mbox);
+	for (i = 0; i < mbox->chan_num; i++) {
+		mbox->mchans[i].pending = NULL;
+		mbox->mchans[i].done = false;
+		mbox->mchans[i].credit = mbox->mchans[i].prio + 1;
+	}
+	spin_unlock_irqrestore(&mbox->tx_lock, flags);
+}
+
+/*
+ * Push time stamped messages through the ring while it loops back to
+ * this side, and record the latency from posting a message to having
+ * it drained.  Plain runs send @count messages back to back and report
+ * the throughput.  With @bulk, @count control messages compete with a
+ * bulk channel that keeps the ring full, and only their latency is
+ * recorded.
+ */
+static int csky_mbox_test_run(struct csky_mbox *mbox, u32 count, bool bulk)
+{
+	struct csky_mbox_test *test = &mbox->test;
+	u64 doorbells = mbox->doorbells;
+	u64 elapsed, rate;
+	ktime_t start;
+	long left;
+	u32 i;
+	int err;
+
+	if (!mbox->tx_ring || !loopback)
+		return -ENODEV;
+	if (bulk && mbox->chan_num <= MBOX_TEST_CTRL_CHAN)
+		return -ENODEV;
+	for (i = 0; i < mbox->chan_num; i++)
+		if (mbox->chans[i].cl)
+			return -EBUSY;
+
+	test->lat_ns = vmalloc(count * sizeof(*test->lat_ns));
+	if (!test->lat_ns)
+		return -ENOMEM;
+
+	for (i = 0; i < ARRAY_SIZE(test->mssg); i++) {
+		test->mssg[i].mssg_type = CSKY_MBOX_MSSG_TEST;
+		test->mssg[i].length = sizeof(u64);
+	}
+	test->bulk	    = bulk;
+	test->count	    = count;
+	test->sent	    = 0;
+	test->received	    = 0;
+	test->bulk_received = 0;
+	test->running	    = true;
+
+	start = ktime_get();
+	if (bulk) {
+		csky_mbox_test_setup(mbox, true);
+		err = csky_mbox_test_send_bulk(mbox);
+	} else {
+		err = csky_mbox_test_send(mbox);
+	}
+	if (err)
+		goto out;
+
+	left = wait_event_timeout(test->wq, test->received == count,
+				  MBOX_TEST_TIMEOUT);
+	if (!left) {
+		err = -ETIMEDOUT;
+		goto out;
+	}
+	elapsed = ktime_to_ns(ktime_sub(ktime_get(), start));
+	rate = div64_u64((bulk ? test->bulk_received : count) * NSEC_PER_SEC,
+			 elapsed ? elapsed : 1);
+
+	sort(test->lat_ns, count, sizeof(*test->lat_ns),
+	     csky_mbox_test_cmp, NULL);
+
+	if (bulk)
+		i = scnprintf(test->result, sizeof(test->result),
+			      "control messages: %u bulk messages: %llu "
+			      "slots: %u reserved: %u\n"
+			      "bulk msgs/sec: %llu\n"
+			      "control latency ns:",
+			      count, test->bulk_received, mbox->slots,
+			      MBOX_RING_RESERVE(mbox), rate);
+	else
+		i = scnprintf(test->result, sizeof(test->result),
+			      "messages: %u slots: %u doorbells: %llu\n"
+			      "msgs/sec: %llu\n"
+			      "latency ns:",
+			      count, mbox->slots, mbox->doorbells - doorbells,
+			      rate);
+	scnprintf(test->result + i, sizeof(test->result) - i,
+		  " p50 %llu p90 %llu p99 %llu p99.9 %llu max %llu\n",
+		  csky_mbox_test_pct(test, 500),
+		  csky_mbox_test_pct(test, 900),
+		  csky_mbox_test_pct(test, 990),
+		  csky_mbox_test_pct(test, 999),
+		  test->lat_ns[count - 1]);
+out:
+	if (bulk)
+		csky_mbox_test_setup(mbox, false);
+	test->running = false;
+	/* The loopback tasklet may still be looking at the samples */
+	tasklet_kill(&mbox->loop_task);
+	vfree(test->lat_ns);
+	test->lat_ns = NULL;
+
+	return err;
+}
+
+static ssize_t csky_mbox_test_start(struct file *file,
+				    const char __user *ubuf,
+				    size_t count, bool bulk)
+{
+	struct csky_mbox *mbox = file->private_data;
+	u32 n;
+	int err;
+
+	err = kstrtou32_from_user(ubuf, count, 0, &n);
+	if (err)
+		return err;
+	if (!n || n > MBOX_TEST_MAX_COUNT)
+		return -EINVAL;
+
+	mutex_lock(&mbox->test.lock);
+	err = csky_mbox_test_run(mbox, n, bulk);
+	mutex_unlock(&mbox->test.lock);
+
+	return err ? err : count;
+}
+
+static ssize_t csky_mbox_test_write(struct file *file,
+				    const char __user *ubuf,
+				    size_t count, loff_t *ppos)
+{
+	return csky_mbox_test_start(file, ubuf, count, false);
+}
+
+static ssize_t csky_mbox_test_bulk_write(struct file *file,
+					 const char __user *ubuf,
+					 size_t count, loff_t *ppos)
+{
+	return csky_mbox_test_start(file, ubuf, count, true);
+}
+
+static ssize_t csky_mbox_test_read(struct file *file, char __user *ubuf,
+				   size_t count, loff_t *ppos)
+{
+	struct csky_mbox *mbox = file->private_data;
+	ssize_t ret;
+
+	mutex_lock(&mbox->test.lock);
+	ret = simple_read_from_buffer(ubuf, count, ppos, mbox->test.result,
+				      strlen(mbox->test.result));
+	mutex_unlock(&mbox->test.lock);
+
+	return ret;
+}
+
+static const struct file_operations csky_mbox_test_ops = {
+	.write	= csky_mbox_test_write,
+	.read	= csky_mbox_test_read,
+	.open	= simple_open,
+	.llseek	= default_llseek,
+};
+
+static const struct file_operations csky_mbox_test_bulk_ops = {
+	.write	= csky_mbox_test_bulk_write,
+	.read	= csky_mbox_test_read,
+	.open	= simple_open,
+	.llseek	= default_llseek,
 };
 
+static void csky_mbox_add_debugfs(struct csky_mbox *mbox)
+{
+	char name[8];
+	u32 i;
+
+	if (!debugfs_initialized())
+		return;
+
+	if (!csky_mbox_debugfs_root)
+		csky_mbox_debugfs_root = debugfs_create_dir(DRIVER_NAME, NULL);
+	if (!csky_mbox_debugfs_root)
+		return;
+
+	mbox->debugfs = debugfs_create_dir(dev_name(mbox->dev),
+					   csky_mbox_debugfs_root);
+	if (!mbox->debugfs)
+		return;
+
+	debugfs_create_u64("tx_messages", 0400, mbox->debugfs,
+			   &mbox->tx_mssgs);
+	debugfs_create_u64("rx_messages", 0400, mbox->debugfs,
+			   &mbox->rx_mssgs);
+	debugfs_create_u64("doorbells", 0400, mbox->debugfs, &mbox->doorbells);
+
+	for (i = 0; i < mbox->chan_num; i++) {
+		struct csky_mbox_chan *mchan = &mbox->mchans[i];
+
+		snprintf(name, sizeof(name), "chan%u", i);
+		mchan->debugfs = debugfs_create_dir(name, mbox->debugfs);
+		if (!mchan->debugfs)
+			continue;
+
+		debugfs_create_u32("priority", 0400, mchan->debugfs,
+				   &mchan->prio);
+		debugfs_create_u64("tx_messages", 0400, mchan->debugfs,
+				   &mchan->tx_mssgs);
+		debugfs_create_u64("rx_messages", 0400, mchan->debugfs,
+				   &mchan->rx_mssgs);
+		debugfs_create_u64("tx_wait_ns", 0400, mchan->debugfs,
+				   &mchan->wait_ns);
+		debugfs_create_u64("tx_max_wait_ns", 0400, mchan->debugfs,
+				   &mchan->max_wait_ns);
+	}
+
+	if (!mbox->tx_ring)
+		return;
+
+	debugfs_create_u32("ring_slots", 0400, mbox->debugfs, &mbox->slots);
+	debugfs_create_u64("doorbells_saved", 0400, mbox->debugfs,
+			   &mbox->doorbells_saved);
+	debugfs_create_u64("tx_ring_full", 0400, mbox->debugfs,
+			   &mbox->tx_ring_full);
+	if (!loopback)
+		return;
+
+	debugfs_create_file("ring_test", 0600, mbox->debugfs, mbox,
+			    &csky_mbox_test_ops);
+	debugfs_create_file("ring_test_bulk", 0600, mbox->debugfs, mbox,
+			    &csky_mbox_test_bulk_ops);
+}
+
+/*
+ * The optional second "reg" entry is memory shared with the peer, split
+ * into two rings of equal size.  Each side produces into the ring the
+ * other one consumes; in loopback mode a side consumes its own ring.
+ *
+ * Each side only ever writes its own index: the producer starts from the
+ * consumer's tail and the consumer from the producer's head, so the side
+ * that comes up second finds the rings empty.
+ */
+static int csky_mbox_ring_init(struct csky_mbox *mbox)
+{
+	struct device_node *node = mbox->dev->of_node;
+	struct resource res;
+	void __iomem *shm;
+	size_t half;
+	u32 slots;
+
+	if (of_address_to_resource(node, 1, &res))
+		return 0;
+
+	half = resource_size(&res) / 2;
+	if (half <= sizeof(struct mbox_ring))
+		return -EINVAL;
+
+	slots = (half - sizeof(struct mbox_ring)) / sizeof(struct mbox_message);
+	slots = rounddown_pow_of_two(slots);
+	if (slots < MBOX_RING_MIN_SLOTS) {
+		dev_err(mbox->dev, "Shared memory too small for a ring\n");
+		return -EINVAL;
+	}
+
+	shm = of_iomap(node, 1);
+	if (!shm)
+		return -ENOMEM;
+
+	mbox->slots   = slots;
+	mbox->tx_ring = shm + (mbox->dev_id ? half : 0);
+	mbox->rx_ring = loopback ? mbox->tx_ring :
+				   shm + (mbox->dev_id ? 0 : half);
+
+	mbox->tx_head = readl(&mbox->tx_ring->tail);
+	writel(slots, &mbox->tx_ring->slots);
+	writel(mbox->tx_head, &mbox->tx_ring->head);
+	mbox->rx_tail = readl(&mbox->rx_ring->head);
+	writel(mbox->rx_tail, &mbox->rx_ring->tail);
+
+	dev_info(mbox->dev, "Ring transport with %u slots%s\n", slots,
+		 loopback ? ", loopback" : "");
+
+	return 0;
+}
+
 static int csky_mbox_probe(struct platform_device *pdev)
 {
 	struct device_node *node = pdev->dev.of_node;
@@ -224,6 +1113,20 @@ static int csky_mbox_probe(struct platform_device *pdev)
 	mbox->dev_id = val;
 	mbox->base = of_iomap(node, 0);
 
+	mutex_init(&mbox->cfg_lock);
+	spin_lock_init(&mbox->tx_lock);
+	spin_lock_init(&mbox->rx_lock);
+	tasklet_init(&mbox->txdone_task, csky_mbox_txdone_task,
+		     (unsigned long)mbox);
+	tasklet_init(&mbox->loop_task, csky_mbox_loop_task,
+		     (unsigned long)mbox);
+	mutex_init(&mbox->test.lock);
+	init_waitqueue_head(&mbox->test.wq);
+
+	err = csky_mbox_ring_init(mbox);
+	if (err)
+		return err;
+
 	err = devm_request_irq(dev, mbox->irq, csky_mbox_interrupt, 0,
 				dev_name(dev), mbox);
 	if (err) {
@@ -243,6 +1146,8 @@ static int csky_mbox_probe(struct platform_device *pdev)
 	for (i = 0; i < mbox->chan_num; ++i) {
 		mbox->chans[i].con_priv = &mbox->mchans[i];
 		mbox->mchans[i].parent = mbox;
+		mbox->mchans[i].index = i;
+		mbox->mchans[i].credit = 1;
 	}
 
 	/* Mask and clear all interrupt vectors */
@@ -258,6 +1163,7 @@ static int csky_mbox_probe(struct platform_device *pdev)
 	}
 
 	platform_set_drvdata(pdev, mbox);
+	csky_mbox_add_debugfs(mbox);
 	dev_info(dev, "Mailbox enabled\n");
 
 	return 0;
@@ -270,7 +1176,10 @@ static int csky_mbox_remove(struct platform_device *pdev)
 	if (!mbox)
 		return -EINVAL;
 
+	debugfs_remove_recursive(mbox->debugfs);
 	mbox_controller_unregister(&mbox->controller);
+	tasklet_kill(&mbox->txdone_task);
+	tasklet_kill(&mbox->loop_task);
 
 	return 0;
 }
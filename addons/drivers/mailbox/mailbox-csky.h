@@ -25,7 +25,8 @@
 #define CSKY_MBOX_DIRECTION_TX		0
 #define CSKY_MBOX_DIRECTION_RX		1
 
-#define CSKY_MBOX_MAX_CHAN		1
+#define CSKY_MBOX_MAX_CHAN		8	/* Logical channels */
+#define CSKY_MBOX_MAX_PRIO		7
 #define CSKY_MBOX_MAX_MESSAGE_LENGTH	64	/* u32 x 16 */
 #define CSKY_MBOX_MAX_DATA_LENGTH	(CSKY_MBOX_MAX_MESSAGE_LENGTH - 4)
 
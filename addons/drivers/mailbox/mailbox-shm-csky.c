@@ -0,0 +1,657 @@
+/*
+ * Shared buffer exchange over C-SKY's mailbox.
+ *
+ * Copyright (C) 2018 C-SKY MicroSystems Co.,Ltd.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <linux/dma-mapping.h>
+#include <linux/err.h>
+#include <linux/fs.h>
+#include <linux/io.h>
+#include <linux/kernel.h>
+#include <linux/kfifo.h>
+#include <linux/mailbox_client.h>
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/of.h>
+#include <linux/of_address.h>
+#include <linux/of_reserved_mem.h>
+#include <linux/platform_device.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/wait.h>
+
+#include "mailbox-csky.h"
+#include "mailbox-csky-internal.h"
+#include "mailbox-shm-csky.h"
+
+#define DRIVER_NAME		"mailbox-shm-csky"
+#define MBOX_SHM_BUF_SIZE	4096	/* Default "csky,buffer-size" */
+#define MBOX_SHM_BUF_COUNT	16	/* Default "csky,buffer-count" */
+#define MBOX_SHM_RX_DEPTH	64	/* This must be a power of two */
+/* Room for every buffer of the peer we can hold, see mbox_shm_csky_done() */
+#define MBOX_SHM_DONE_DEPTH	(2 * MBOX_SHM_RX_DEPTH)
+
+/* Who owns a buffer of our pool */
+enum {
+	MBOX_SHM_BUF_FREE,
+	MBOX_SHM_BUF_USER,
+	MBOX_SHM_BUF_PEER,
+};
+
+/*
+ * Large payloads cross cores by reference: the sender fills a buffer of
+ * its own DMA coherent pool and mails the peer a CSKY_MBOX_MSSG_BUF
+ * descriptor, the peer mails the same descriptor back as
+ * CSKY_MBOX_MSSG_BUF_DONE once it is done with the data.  The peer's
+ * pool is the node's "reg" region, ours comes from dma_alloc_coherent(),
+ * out of "memory-region" when the node has one.
+ */
+struct mbox_shm_csky_device {
+	struct device		*dev;
+	struct mbox_client	client;
+	struct mbox_chan	*channel;
+	struct miscdevice	miscdev;
+	unsigned long		busy;		/* Opened */
+	spinlock_t		lock;
+
+	/* Our pool, lent to the peer */
+	void			*tx_pool;
+	dma_addr_t		tx_dma;
+	u32			tx_size;
+	u32			buf_size;
+	u32			nr_bufs;
+	u32			tx_free;
+	u8			*tx_state;
+	wait_queue_head_t	tx_wq;
+
+	/* The peer's pool, lent to us */
+	void __iomem		*rx_pool;
+	phys_addr_t		rx_phys;
+	u32			rx_size;
+	u32			rx_offset;	/* mmap() offset of the pool */
+	DECLARE_KFIFO(rx_fifo, struct mbox_buf_desc, MBOX_SHM_RX_DEPTH);
+	struct mbox_buf_desc	rx_held[MBOX_SHM_RX_DEPTH];
+	wait_queue_head_t	rx_wq;
+
+	/* Buffers to hand back that the mailbox had no room for yet */
+	DECLARE_KFIFO(done_fifo, struct mbox_buf_desc, MBOX_SHM_DONE_DEPTH);
+};
+
+static int mbox_shm_csky_send(struct mbox_shm_csky_device *sdev, u8 type,
+			      const struct mbox_buf_desc *desc, gfp_t gfp)
+{
+	struct mbox_message *mssg;
+	int ret;
+
+	mssg = kzalloc(sizeof(*mssg), gfp);
+	if (!mssg)
+		return -ENOMEM;
+
+	mssg->mssg_type = type;
+	mssg->length = sizeof(*desc);
+	memcpy(mssg->data, desc, sizeof(*desc));
+
+	/* Freed by mbox_shm_csky_message_sent() */
+	ret = mbox_send_message(sdev->channel, mssg);
+	if (ret < 0) {
+		kfree(mssg);
+		return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Hand a buffer of the peer back with BUF_DONE.  Nothing may be lost
+ * here, the peer would be a buffer short for good: when the mailbox
+ * queue is full the descriptor waits in done_fifo, and
+ * mbox_shm_csky_message_sent() sends it as the queue drains.
+ */
+static void mbox_shm_csky_done(struct mbox_shm_csky_device *sdev,
+			       const struct mbox_buf_desc *desc, gfp_t gfp)
+{
+	unsigned long flags;
+	bool kept;
+
+	/* Keep the order once something is waiting */
+	if (kfifo_is_empty(&sdev->done_fifo) &&
+	    !mbox_shm_csky_send(sdev, CSKY_MBOX_MSSG_BUF_DONE, desc, gfp))
+		return;
+
+	spin_lock_irqsave(&sdev->lock, flags);
+	kept = kfifo_put(&sdev->done_fifo, *desc);
+	spin_unlock_irqrestore(&sdev->lock, flags);
+
+	if (!kept)
+		dev_err(sdev->dev, "Lost buffer %08x\n", desc->addr);
+}
+
+static void mbox_shm_csky_message_sent(struct mbox_client *client,
+				       void *message, int r)
+{
+	struct mbox_shm_csky_device *sdev = dev_get_drvdata(client->dev);
+	struct mbox_buf_desc desc;
+	unsigned long flags;
+	bool got;
+
+	if (r)
+		dev_warn(client->dev,
+			 "Client: Message could not be sent: %d\n", r);
+
+	kfree(message);
+
+	/* There is room in the mailbox queue again */
+	for (;;) {
+		spin_lock_irqsave(&sdev->lock, flags);
+		got = kfifo_get(&sdev->done_fifo, &desc);
+		spin_unlock_irqrestore(&sdev->lock, flags);
+		if (!got)
+			break;
+
+		if (mbox_shm_csky_send(sdev, CSKY_MBOX_MSSG_BUF_DONE, &desc,
+				       GFP_ATOMIC)) {
+			/* The slot it left is still free */
+			spin_lock_irqsave(&sdev->lock, flags);
+			kfifo_put(&sdev->done_fifo, desc);
+			spin_unlock_irqrestore(&sdev->lock, flags);
+			break;
+		}
+	}
+}
+
+static bool mbox_shm_csky_rx_valid(struct mbox_shm_csky_device *sdev,
+				   const struct mbox_buf_desc *desc)
+{
+	return sdev->rx_pool && desc->addr >= sdev->rx_phys &&
+	       desc->len <= sdev->rx_size &&
+	       desc->addr - sdev->rx_phys <= sdev->rx_size - desc->len;
+}
+
+static void mbox_shm_csky_receive_message(struct mbox_client *client,
+					  void *message)
+{
+	struct mbox_shm_csky_device *sdev = dev_get_drvdata(client->dev);
+	struct mbox_message *mssg = message;
+	struct mbox_buf_desc desc;
+	unsigned long flags;
+	bool queued = false;
+
+	if (mssg->length < sizeof(desc)) {
+		dev_err(client->dev, "Short message %d\n", mssg->length);
+		return;
+	}
+	memcpy(&desc, mssg->data, sizeof(desc));
+
+	switch (mssg->mssg_type) {
+	case CSKY_MBOX_MSSG_BUF:
+		if (mbox_shm_csky_rx_valid(sdev, &desc)) {
+			spin_lock_irqsave(&sdev->lock, flags);
+			if (test_bit(0, &sdev->busy))
+				queued = kfifo_put(&sdev->rx_fifo, desc);
+			spin_unlock_irqrestore(&sdev->lock, flags);
+		} else {
+			dev_err(client->dev, "Bad buffer %08x+%u\n",
+				desc.addr, desc.len);
+		}
+
+		if (queued) {
+			wake_up_interruptible(&sdev->rx_wq);
+			break;
+		}
+
+		/* Nobody to take it: hand the buffer straight back */
+		mbox_shm_csky_done(sdev, &desc, GFP_ATOMIC);
+		break;
+
+	case CSKY_MBOX_MSSG_BUF_DONE:
+		spin_lock_irqsave(&sdev->lock, flags);
+		if (desc.cookie < sdev->nr_bufs &&
+		    sdev->tx_state[desc.cookie] == MBOX_SHM_BUF_PEER) {
+			sdev->tx_state[desc.cookie] = MBOX_SHM_BUF_FREE;
+			sdev->tx_free++;
+			queued = true;
+		}
+		spin_unlock_irqrestore(&sdev->lock, flags);
+
+		if (queued)
+			wake_up_interruptible(&sdev->tx_wq);
+		else
+			dev_err(client->dev, "Bad buffer cookie %u\n",
+				desc.cookie);
+		break;
+
+	default:
+		dev_err(client->dev, "Undefined mssg_type:%02x\n",
+			mssg->mssg_type);
+	}
+}
+
+static int mbox_shm_csky_get(struct mbox_shm_csky_device *sdev,
+			     struct mbox_shm_buf *buf, bool nonblock)
+{
+	u32 i;
+	int ret;
+
+	for (;;) {
+		spin_lock_irq(&sdev->lock);
+		if (sdev->tx_free)
+			break;
+		spin_unlock_irq(&sdev->lock);
+
+		if (nonblock)
+			return -EAGAIN;
+
+		ret = wait_event_interruptible(sdev->tx_wq,
+					       READ_ONCE(sdev->tx_free));
+		if (ret)
+			return ret;
+	}
+
+	for (i = 0; i < sdev->nr_bufs; i++)
+		if (sdev->tx_state[i] == MBOX_SHM_BUF_FREE)
+			break;
+	sdev->tx_state[i] = MBOX_SHM_BUF_USER;
+	sdev->tx_free--;
+	spin_unlock_irq(&sdev->lock);
+
+	buf->offset = i * sdev->buf_size;
+	buf->len = sdev->buf_size;
+	buf->cookie = i;
+
+	return 0;
+}
+
+static int mbox_shm_csky_send_buf(struct mbox_shm_csky_device *sdev,
+				  const struct mbox_shm_buf *buf)
+{
+	struct mbox_buf_desc desc;
+	u32 i = buf->cookie;
+	int ret;
+
+	if (i >= sdev->nr_bufs || buf->len > sdev->buf_size)
+		return -EINVAL;
+
+	spin_lock_irq(&sdev->lock);
+	if (sdev->tx_state[i] != MBOX_SHM_BUF_USER) {
+		spin_unlock_irq(&sdev->lock);
+		return -EINVAL;
+	}
+	sdev->tx_state[i] = MBOX_SHM_BUF_PEER;
+	spin_unlock_irq(&sdev->lock);
+
+	desc.addr = sdev->tx_dma + i * sdev->buf_size;
+	desc.len = buf->len;
+	desc.cookie = i;
+
+	/* The pool is coherent: the data is there before the descriptor */
+	wmb();
+	ret = mbox_shm_csky_send(sdev, CSKY_MBOX_MSSG_BUF, &desc, GFP_KERNEL);
+	if (ret) {
+		spin_lock_irq(&sdev->lock);
+		sdev->tx_state[i] = MBOX_SHM_BUF_USER;
+		spin_unlock_irq(&sdev->lock);
+	}
+
+	return ret;
+}
+
+static int mbox_shm_csky_recv(struct mbox_shm_csky_device *sdev,
+			      struct mbox_shm_buf *buf, bool nonblock)
+{
+	struct mbox_buf_desc desc;
+	bool got;
+	u32 i;
+	int ret;
+
+	for (;;) {
+		spin_lock_irq(&sdev->lock);
+		for (i = 0; i < MBOX_SHM_RX_DEPTH; i++)
+			if (!sdev->rx_held[i].len)
+				break;
+		if (i == MBOX_SHM_RX_DEPTH) {
+			/* Everything the peer sent is held by user space */
+			spin_unlock_irq(&sdev->lock);
+			return -ENOSPC;
+		}
+		got = kfifo_get(&sdev->rx_fifo, &desc);
+		if (got && desc.len)
+			break;
+		spin_unlock_irq(&sdev->lock);
+
+		/* A zero length rx_held[] entry is unused, return empty ones */
+		if (got) {
+			mbox_shm_csky_done(sdev, &desc, GFP_KERNEL);
+			continue;
+		}
+
+		if (nonblock)
+			return -EAGAIN;
+
+		ret = wait_event_interruptible(sdev->rx_wq,
+					       !kfifo_is_empty(&sdev->rx_fifo));
+		if (ret)
+			return ret;
+	}
+	sdev->rx_held[i] = desc;
+	spin_unlock_irq(&sdev->lock);
+
+	buf->offset = sdev->rx_offset + (desc.addr - sdev->rx_phys);
+	buf->len = desc.len;
+	buf->cookie = desc.cookie;
+
+	return 0;
+}
+
+static int mbox_shm_csky_put(struct mbox_shm_csky_device *sdev,
+			     const struct mbox_shm_buf *buf)
+{
+	struct mbox_buf_desc desc;
+	u32 addr, i;
+
+	if (buf->offset < sdev->rx_offset)
+		return -EINVAL;
+	addr = sdev->rx_phys + (buf->offset - sdev->rx_offset);
+
+	spin_lock_irq(&sdev->lock);
+	for (i = 0; i < MBOX_SHM_RX_DEPTH; i++)
+		if (sdev->rx_held[i].len && sdev->rx_held[i].addr == addr &&
+		    sdev->rx_held[i].cookie == buf->cookie)
+			break;
+	if (i == MBOX_SHM_RX_DEPTH) {
+		spin_unlock_irq(&sdev->lock);
+		return -EINVAL;
+	}
+	desc = sdev->rx_held[i];
+	sdev->rx_held[i].len = 0;
+	spin_unlock_irq(&sdev->lock);
+
+	mbox_shm_csky_done(sdev, &desc, GFP_KERNEL);
+
+	return 0;
+}
+
+static long mbox_shm_csky_ioctl(struct file *filp, unsigned int cmd,
+				unsigned long arg)
+{
+	struct mbox_shm_csky_device *sdev =
+		container_of(filp->private_data, struct mbox_shm_csky_device,
+			     miscdev);
+	bool nonblock = filp->f_flags & O_NONBLOCK;
+	void __user *uarg = (void __user *)arg;
+	struct mbox_shm_info info;
+	struct mbox_shm_buf buf;
+	int ret;
+
+	switch (cmd) {
+	case MBOX_SHM_IOC_INFO:
+		info.buf_size = sdev->buf_size;
+		info.nr_bufs = sdev->nr_bufs;
+		info.tx_pool_size = sdev->tx_size;
+		info.rx_pool_offset = sdev->rx_offset;
+		info.rx_pool_size = sdev->rx_size;
+		return copy_to_user(uarg, &info, sizeof(info)) ? -EFAULT : 0;
+
+	case MBOX_SHM_IOC_GET:
+	case MBOX_SHM_IOC_RECV:
+		if (cmd == MBOX_SHM_IOC_GET)
+			ret = mbox_shm_csky_get(sdev, &buf, nonblock);
+		else
+			ret = mbox_shm_csky_recv(sdev, &buf, nonblock);
+		if (ret)
+			return ret;
+		return copy_to_user(uarg, &buf, sizeof(buf)) ? -EFAULT : 0;
+
+	case MBOX_SHM_IOC_SEND:
+	case MBOX_SHM_IOC_PUT:
+		if (copy_from_user(&buf, uarg, sizeof(buf)))
+			return -EFAULT;
+		if (cmd == MBOX_SHM_IOC_SEND)
+			return mbox_shm_csky_send_buf(sdev, &buf);
+		return mbox_shm_csky_put(sdev, &buf);
+	}
+
+	return -ENOTTY;
+}
+
+static int mbox_shm_csky_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct mbox_shm_csky_device *sdev =
+		container_of(filp->private_data, struct mbox_shm_csky_device,
+			     miscdev);
+	unsigned long off = vma->vm_pgoff << PAGE_SHIFT;
+
+	if (off == 0)
+		return dma_mmap_coherent(sdev->dev, vma, sdev->tx_pool,
+					 sdev->tx_dma, sdev->tx_size);
+
+	if (sdev->rx_pool && off == sdev->rx_offset) {
+		vma->vm_pgoff = 0;
+		vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+		return vm_iomap_memory(vma, sdev->rx_phys, sdev->rx_size);
+	}
+
+	return -EINVAL;
+}
+
+static unsigned int mbox_shm_csky_poll(struct file *filp, poll_table *wait)
+{
+	struct mbox_shm_csky_device *sdev =
+		container_of(filp->private_data, struct mbox_shm_csky_device,
+			     miscdev);
+	unsigned int mask = 0;
+
+	poll_wait(filp, &sdev->rx_wq, wait);
+	poll_wait(filp, &sdev->tx_wq, wait);
+
+	if (!kfifo_is_empty(&sdev->rx_fifo))
+		mask |= POLLIN | POLLRDNORM;
+	if (READ_ONCE(sdev->tx_free))
+		mask |= POLLOUT | POLLWRNORM;
+
+	return mask;
+}
+
+static int mbox_shm_csky_open(struct inode *inode, struct file *filp)
+{
+	struct mbox_shm_csky_device *sdev =
+		container_of(filp->private_data, struct mbox_shm_csky_device,
+			     miscdev);
+
+	if (test_and_set_bit(0, &sdev->busy))
+		return -EBUSY;
+
+	return 0;
+}
+
+/* Take back what user space got from us and return what it got from peer */
+static int mbox_shm_csky_release(struct inode *inode, struct file *filp)
+{
+	struct mbox_shm_csky_device *sdev =
+		container_of(filp->private_data, struct mbox_shm_csky_device,
+			     miscdev);
+	struct mbox_buf_desc desc;
+	u32 i;
+
+	spin_lock_irq(&sdev->lock);
+	for (i = 0; i < sdev->nr_bufs; i++) {
+		if (sdev->tx_state[i] == MBOX_SHM_BUF_USER) {
+			sdev->tx_state[i] = MBOX_SHM_BUF_FREE;
+			sdev->tx_free++;
+		}
+	}
+	spin_unlock_irq(&sdev->lock);
+
+	for (i = 0; i < MBOX_SHM_RX_DEPTH; i++) {
+		if (!sdev->rx_held[i].len)
+			continue;
+		mbox_shm_csky_done(sdev, &sdev->rx_held[i], GFP_KERNEL);
+		sdev->rx_held[i].len = 0;
+	}
+
+	spin_lock_irq(&sdev->lock);
+	clear_bit(0, &sdev->busy);
+	spin_unlock_irq(&sdev->lock);
+
+	/* Nothing is queued once busy is clear, but what came before */
+	while (kfifo_get(&sdev->rx_fifo, &desc))
+		mbox_shm_csky_done(sdev, &desc, GFP_KERNEL);
+
+	return 0;
+}
+
+static const struct file_operations mbox_shm_csky_fops = {
+	.owner		= THIS_MODULE,
+	.open		= mbox_shm_csky_open,
+	.release	= mbox_shm_csky_release,
+	.unlocked_ioctl	= mbox_shm_csky_ioctl,
+	.mmap		= mbox_shm_csky_mmap,
+	.poll		= mbox_shm_csky_poll,
+	.llseek		= noop_llseek,
+};
+
+static int mbox_shm_csky_probe(struct platform_device *pdev)
+{
+	struct device_node *node = pdev->dev.of_node;
+	struct device *dev = &pdev->dev;
+	struct mbox_shm_csky_device *sdev;
+	struct resource res;
+	int ret;
+
+	sdev = devm_kzalloc(dev, sizeof(*sdev), GFP_KERNEL);
+	if (!sdev)
+		return -ENOMEM;
+
+	sdev->dev = dev;
+	spin_lock_init(&sdev->lock);
+	init_waitqueue_head(&sdev->tx_wq);
+	init_waitqueue_head(&sdev->rx_wq);
+	INIT_KFIFO(sdev->rx_fifo);
+	INIT_KFIFO(sdev->done_fifo);
+	platform_set_drvdata(pdev, sdev);
+
+	sdev->buf_size = MBOX_SHM_BUF_SIZE;
+	sdev->nr_bufs = MBOX_SHM_BUF_COUNT;
+	of_property_read_u32(node, "csky,buffer-size", &sdev->buf_size);
+	of_property_read_u32(node, "csky,buffer-count", &sdev->nr_bufs);
+	if (!sdev->buf_size || !sdev->nr_bufs) {
+		dev_err(dev, "Empty buffer pool\n");
+		return -EINVAL;
+	}
+
+	sdev->tx_state = devm_kcalloc(dev, sdev->nr_bufs,
+				      sizeof(*sdev->tx_state), GFP_KERNEL);
+	if (!sdev->tx_state)
+		return -ENOMEM;
+
+	/* Our pool may come from a reserved region the peer can reach */
+	of_reserved_mem_device_init(dev);
+
+	sdev->tx_size = sdev->buf_size * sdev->nr_bufs;
+	sdev->tx_pool = dma_alloc_coherent(dev, sdev->tx_size, &sdev->tx_dma,
+					   GFP_KERNEL);
+	if (!sdev->tx_pool) {
+		ret = -ENOMEM;
+		goto err_mem;
+	}
+	sdev->tx_free = sdev->nr_bufs;
+
+	sdev->rx_offset = PAGE_ALIGN(sdev->tx_size);
+	if (!of_address_to_resource(node, 0, &res)) {
+		sdev->rx_phys = res.start;
+		sdev->rx_size = resource_size(&res);
+		sdev->rx_pool = of_iomap(node, 0);
+	}
+	if (!sdev->rx_pool)
+		dev_warn(dev, "No peer buffer pool, Tx only\n");
+
+	sdev->client.dev	 = dev;
+	sdev->client.rx_callback = mbox_shm_csky_receive_message;
+	sdev->client.tx_done	 = mbox_shm_csky_message_sent;
+	sdev->client.tx_block	 = false;
+	sdev->client.knows_txdone = false;
+
+	sdev->channel = mbox_request_channel_byname(&sdev->client, "channel");
+	if (IS_ERR(sdev->channel)) {
+		dev_err(dev, "Request channel failed\n");
+		ret = -EPROBE_DEFER;
+		goto err_chan;
+	}
+
+	/* BUF_DONE goes out from the rx callback */
+	if (!csky_mbox_chan_has_ring(sdev->channel)) {
+		dev_err(dev, "Needs the mailbox's ring transport\n");
+		ret = -ENODEV;
+		goto err_misc;
+	}
+
+	sdev->miscdev.minor = MISC_DYNAMIC_MINOR;
+	sdev->miscdev.name = "mbox-shm";
+	sdev->miscdev.fops = &mbox_shm_csky_fops;
+	sdev->miscdev.parent = dev;
+	ret = misc_register(&sdev->miscdev);
+	if (ret) {
+		dev_err(dev, "Failed to register misc device: %d\n", ret);
+		goto err_misc;
+	}
+
+	dev_info(dev, "%u x %uB buffers, peer pool %uB\n",
+		 sdev->nr_bufs, sdev->buf_size, sdev->rx_size);
+
+	return 0;
+
+err_misc:
+	mbox_free_channel(sdev->channel);
+err_chan:
+	if (sdev->rx_pool)
+		iounmap(sdev->rx_pool);
+	dma_free_coherent(dev, sdev->tx_size, sdev->tx_pool, sdev->tx_dma);
+err_mem:
+	of_reserved_mem_device_release(dev);
+	return ret;
+}
+
+static int mbox_shm_csky_remove(struct platform_device *pdev)
+{
+	struct mbox_shm_csky_device *sdev = platform_get_drvdata(pdev);
+
+	misc_deregister(&sdev->miscdev);
+	mbox_free_channel(sdev->channel);
+	if (sdev->rx_pool)
+		iounmap(sdev->rx_pool);
+	dma_free_coherent(sdev->dev, sdev->tx_size, sdev->tx_pool,
+			  sdev->tx_dma);
+	of_reserved_mem_device_release(sdev->dev);
+
+	return 0;
+}
+
+static const struct of_device_id mbox_shm_csky_match[] = {
+	{ .compatible = "csky,mailbox-shm" },
+	{},
+};
+
+static struct platform_driver mbox_shm_csky_driver = {
+	.driver = {
+		.name = DRIVER_NAME,
+		.of_match_table = mbox_shm_csky_match,
+	},
+	.probe  = mbox_shm_csky_probe,
+	.remove = mbox_shm_csky_remove,
+};
+module_platform_driver(mbox_shm_csky_driver);
+
+MODULE_DESCRIPTION("CSKY Mailbox shared buffer driver");
+MODULE_LICENSE("GPL v2");
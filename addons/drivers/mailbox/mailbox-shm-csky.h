@@ -0,0 +1,72 @@
+/*
+ * Shared buffer exchange over C-SKY's mailbox, user space interface.
+ *
+ * Copyright (C) 2018 C-SKY MicroSystems Co.,Ltd.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef __MAILBOX_SHM_CSKY_H
+#define __MAILBOX_SHM_CSKY_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/*
+ * /dev/mbox-shm is opened by one process at a time.  It mmap()s our own
+ * pool at offset 0 and the peer's pool at rx_pool_offset, then:
+ *
+ * producer: MBOX_SHM_IOC_GET a free buffer, fill it through the mapping,
+ *	     MBOX_SHM_IOC_SEND it with its length.  The buffer belongs to
+ *	     the peer until it hands it back.
+ * consumer: MBOX_SHM_IOC_RECV a buffer the peer sent, read it through
+ *	     the mapping, MBOX_SHM_IOC_PUT it back to the peer.
+ *
+ * poll() reports POLLIN for a buffer to receive and POLLOUT for a free
+ * one.  Buffers still held when the file is closed are reclaimed.
+ */
+
+/**
+ * struct mbox_shm_info - Layout of the mapping
+ * @buf_size:		Size of each buffer in our pool
+ * @nr_bufs:		Number of buffers in our pool
+ * @tx_pool_size:	Bytes mapped at offset 0
+ * @rx_pool_offset:	mmap() offset of the peer's pool
+ * @rx_pool_size:	Bytes mapped at @rx_pool_offset, 0 if none
+ */
+struct mbox_shm_info {
+	__u32 buf_size;
+	__u32 nr_bufs;
+	__u32 tx_pool_size;
+	__u32 rx_pool_offset;
+	__u32 rx_pool_size;
+};
+
+/**
+ * struct mbox_shm_buf - One buffer
+ * @offset:	Offset of the buffer in the mapping
+ * @len:	Buffer size from GET, payload length for SEND and RECV
+ * @cookie:	Identifies the buffer, pass back unchanged
+ */
+struct mbox_shm_buf {
+	__u32 offset;
+	__u32 len;
+	__u32 cookie;
+};
+
+#define MBOX_SHM_IOC_MAGIC	'M'
+#define MBOX_SHM_IOC_INFO	_IOR(MBOX_SHM_IOC_MAGIC, 0, struct mbox_shm_info)
+#define MBOX_SHM_IOC_GET	_IOR(MBOX_SHM_IOC_MAGIC, 1, struct mbox_shm_buf)
+#define MBOX_SHM_IOC_SEND	_IOW(MBOX_SHM_IOC_MAGIC, 2, struct mbox_shm_buf)
+#define MBOX_SHM_IOC_RECV	_IOR(MBOX_SHM_IOC_MAGIC, 3, struct mbox_shm_buf)
+#define MBOX_SHM_IOC_PUT	_IOW(MBOX_SHM_IOC_MAGIC, 4, struct mbox_shm_buf)
+
+#endif /* __MAILBOX_SHM_CSKY_H */
@@ -0,0 +1,640 @@
+/*
+ * RPMsg transport over C-SKY's mailbox.
+ *
+ * Copyright (C) 2018 C-SKY MicroSystems Co.,Ltd.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <linux/dma-mapping.h>
+#include <linux/err.h>
+#include <linux/io.h>
+#include <linux/kernel.h>
+#include <linux/mailbox_client.h>
+#include <linux/module.h>
+#include <linux/of.h>
+#include <linux/of_address.h>
+#include <linux/of_reserved_mem.h>
+#include <linux/platform_device.h>
+#include <linux/slab.h>
+#include <linux/virtio.h>
+#include <linux/virtio_config.h>
+#include <linux/virtio_ids.h>
+#include <linux/virtio_ring.h>
+#include <linux/workqueue.h>
+
+#include "mailbox-csky.h"
+#include "mailbox-csky-internal.h"
+
+#define DRIVER_NAME		"rpmsg-csky"
+#define CSKY_RPMSG_NUM		256	/* Default "csky,vring-num" */
+#define CSKY_RPMSG_ALIGN	4096	/* Default "csky,vring-align" */
+#define CSKY_RPMSG_NR_VQS	2
+
+/* Wire format of virtio_rpmsg_bus, as the peer's firmware sees it */
+#define CSKY_RPMSG_F_NS		0	/* VIRTIO_RPMSG_F_NS */
+#define CSKY_RPMSG_NS_ADDR	53
+#define CSKY_RPMSG_NS_CREATE	0
+#define CSKY_RPMSG_NAME_SIZE	32
+#define CSKY_RPMSG_LOOP_ADDR	0x400	/* Endpoint of the loopback peer */
+
+struct csky_rpmsg_hdr {
+	u32 src;
+	u32 dst;
+	u32 reserved;
+	u16 len;
+	u16 flags;
+	u8 data[0];
+} __packed;
+
+struct csky_rpmsg_ns_msg {
+	char name[CSKY_RPMSG_NAME_SIZE];
+	u32 addr;
+	u32 flags;
+} __packed;
+
+static bool loopback;
+module_param(loopback, bool, 0444);
+MODULE_PARM_DESC(loopback,
+		 "Serve the vrings locally, echoing every message, instead of kicking the peer");
+
+static char *loopback_service = "rpmsg-client-sample";
+module_param(loopback_service, charp, 0444);
+MODULE_PARM_DESC(loopback_service,
+		 "Channel the loopback peer announces");
+
+struct csky_rpmsg;
+
+struct csky_rpmsg_vq {
+	struct csky_rpmsg	*parent;
+	struct virtqueue	*vq;
+	void			*va;
+	dma_addr_t		dma;
+	size_t			size;
+
+	/* Device side view, used by the loopback peer only */
+	struct vring		vring;
+	u16			last_avail;
+};
+
+/*
+ * A virtio device the stock virtio_rpmsg_bus binds to.  Linux is the
+ * driver side of both vrings; the peer core is the device side.  The
+ * vrings and the rpmsg buffers are allocated from the node's
+ * "memory-region" so the peer can reach them, their addresses are
+ * published in the mbox_rpmsg_table at "reg", and kicks in either
+ * direction are mailbox messages.
+ *
+ * virtio_rpmsg_bus allocates its buffers from the grandparent of the
+ * virtio device, hence the intermediate @vdev_parent.
+ */
+struct csky_rpmsg {
+	struct device		*dev;
+	struct device		vdev_parent;
+	struct virtio_device	vdev;
+	struct mbox_client	client;
+	struct mbox_chan	*channel;
+	struct mbox_message	kick[CSKY_RPMSG_NR_VQS];
+	struct work_struct	rx_work;
+	struct mbox_rpmsg_table __iomem *table;
+	struct csky_rpmsg_vq	vqs[CSKY_RPMSG_NR_VQS];
+	u32			num;
+	u32			align;
+	u8			status;
+
+	/* Loopback peer */
+	struct work_struct	loop_work;
+	void			*shm;
+	phys_addr_t		shm_phys;
+	size_t			shm_size;
+	bool			loop_announced;
+};
+
+static struct csky_rpmsg *to_csky_rpmsg(struct virtio_device *vdev)
+{
+	return container_of(vdev, struct csky_rpmsg, vdev);
+}
+
+/*
+ * Loopback peer: consumes what Linux posts on vring 1 and answers on
+ * vring 0 from the same core, in a work item so a kick never re-enters
+ * virtio_rpmsg_bus from under its own locks.
+ */
+static void *csky_rpmsg_loop_va(struct csky_rpmsg *rp, u64 addr, u32 len)
+{
+	/* No IOMMU here, bus addresses are physical */
+	if (addr < rp->shm_phys || len > rp->shm_size ||
+	    addr - rp->shm_phys > rp->shm_size - len)
+		return NULL;
+
+	return rp->shm + (addr - rp->shm_phys);
+}
+
+static bool csky_rpmsg_loop_avail(struct csky_rpmsg *rp,
+				  struct csky_rpmsg_vq *rvq, u16 *head)
+{
+	struct vring *vr = &rvq->vring;
+
+	if (rvq->last_avail == virtio16_to_cpu(&rp->vdev, READ_ONCE(vr->avail->idx)))
+		return false;
+
+	/* Read the entry only after seeing the index that covers it */
+	virtio_rmb(false);
+	*head = virtio16_to_cpu(&rp->vdev,
+				vr->avail->ring[rvq->last_avail % vr->num]);
+	rvq->last_avail++;
+
+	return *head < vr->num;
+}
+
+static void csky_rpmsg_loop_used(struct csky_rpmsg *rp,
+				 struct csky_rpmsg_vq *rvq, u16 head, u32 len)
+{
+	struct vring *vr = &rvq->vring;
+	u16 idx = virtio16_to_cpu(&rp->vdev, vr->used->idx);
+
+	vr->used->ring[idx % vr->num].id = cpu_to_virtio32(&rp->vdev, head);
+	vr->used->ring[idx % vr->num].len = cpu_to_virtio32(&rp->vdev, len);
+	/* Publish the entry before the index that covers it */
+	virtio_wmb(false);
+	vr->used->idx = cpu_to_virtio16(&rp->vdev, idx + 1);
+}
+
+/* Post one message to Linux, false while it has no Rx buffer for it */
+static bool csky_rpmsg_loop_send(struct csky_rpmsg *rp, u32 src, u32 dst,
+				 const void *data, u32 len)
+{
+	struct csky_rpmsg_vq *rvq = &rp->vqs[0];
+	struct csky_rpmsg_hdr *hdr;
+	struct vring_desc *desc;
+	u32 size;
+	u16 head;
+
+	if (!csky_rpmsg_loop_avail(rp, rvq, &head))
+		return false;
+
+	desc = &rvq->vring.desc[head];
+	size = virtio32_to_cpu(&rp->vdev, desc->len);
+	hdr = csky_rpmsg_loop_va(rp, virtio64_to_cpu(&rp->vdev, desc->addr),
+				 size);
+	if (!hdr || size < sizeof(*hdr)) {
+		csky_rpmsg_loop_used(rp, rvq, head, 0);
+		return true;
+	}
+
+	len = min_t(u32, len, size - sizeof(*hdr));
+	hdr->src = src;
+	hdr->dst = dst;
+	hdr->reserved = 0;
+	hdr->len = len;
+	hdr->flags = 0;
+	memcpy(hdr->data, data, len);
+	csky_rpmsg_loop_used(rp, rvq, head, sizeof(*hdr) + len);
+
+	return true;
+}
+
+static void csky_rpmsg_loop_work(struct work_struct *work)
+{
+	struct csky_rpmsg *rp = container_of(work, struct csky_rpmsg,
+					     loop_work);
+	struct csky_rpmsg_vq *rx = &rp->vqs[0], *tx = &rp->vqs[1];
+	struct csky_rpmsg_hdr *hdr;
+	struct vring_desc *desc;
+	u32 size;
+	u16 head;
+
+	if (!rx->vq || !tx->vq || !(rp->status & VIRTIO_CONFIG_S_DRIVER_OK))
+		return;
+
+	if (!rp->loop_announced &&
+	    virtio_has_feature(&rp->vdev, CSKY_RPMSG_F_NS)) {
+		struct csky_rpmsg_ns_msg ns = {
+			.addr  = CSKY_RPMSG_LOOP_ADDR,
+			.flags = CSKY_RPMSG_NS_CREATE,
+		};
+
+		strlcpy(ns.name, loopback_service, sizeof(ns.name));
+		rp->loop_announced = csky_rpmsg_loop_send(rp,
+				CSKY_RPMSG_LOOP_ADDR, CSKY_RPMSG_NS_ADDR,
+				&ns, sizeof(ns));
+	}
+
+	/*
+	 * Echo everything back to its sender.  A message waits on vring 1
+	 * until Linux has an Rx buffer for the answer, Linux kicks vring 0
+	 * when it returns one.
+	 */
+	while (rx->last_avail !=
+	       virtio16_to_cpu(&rp->vdev, READ_ONCE(rx->vring.avail->idx))) {
+		if (!csky_rpmsg_loop_avail(rp, tx, &head))
+			break;
+
+		desc = &tx->vring.desc[head];
+		size = virtio32_to_cpu(&rp->vdev, desc->len);
+		hdr = csky_rpmsg_loop_va(rp,
+				virtio64_to_cpu(&rp->vdev, desc->addr), size);
+		/* Announcements of Linux's own services go nowhere */
+		if (hdr && size >= sizeof(*hdr) &&
+		    hdr->dst != CSKY_RPMSG_NS_ADDR)
+			csky_rpmsg_loop_send(rp, hdr->dst, hdr->src, hdr->data,
+					     min_t(u32, hdr->len,
+						   size - sizeof(*hdr)));
+		csky_rpmsg_loop_used(rp, tx, head, size);
+	}
+
+	vring_interrupt(0, rx->vq);
+	vring_interrupt(0, tx->vq);
+}
+
+static bool csky_rpmsg_notify(struct virtqueue *vq)
+{
+	struct csky_rpmsg_vq *rvq = vq->priv;
+	struct csky_rpmsg *rp = rvq->parent;
+	int ret;
+
+	if (loopback) {
+		schedule_work(&rp->loop_work);
+		return true;
+	}
+
+	/*
+	 * Kicks never change, so the same message may sit in the queue
+	 * several times.  A full queue already holds a kick and the peer
+	 * always looks at both vrings, so that is not an error either; a
+	 * false return would mark the virtqueue broken for good.
+	 */
+	ret = mbox_send_message(rp->channel, &rp->kick[vq->index]);
+	if (ret < 0 && ret != -ENOBUFS)
+		dev_warn(rp->dev, "Kick vring %u failed: %d\n", vq->index, ret);
+
+	return true;
+}
+
+static void csky_rpmsg_rx_work(struct work_struct *work)
+{
+	struct csky_rpmsg *rp = container_of(work, struct csky_rpmsg,
+					     rx_work);
+	int i;
+
+	if (!(rp->status & VIRTIO_CONFIG_S_DRIVER_OK))
+		return;
+
+	/* The index in the kick is a hint, look at both vrings */
+	for (i = 0; i < CSKY_RPMSG_NR_VQS; i++)
+		if (rp->vqs[i].vq)
+			vring_interrupt(0, rp->vqs[i].vq);
+}
+
+static void csky_rpmsg_receive_message(struct mbox_client *client,
+				       void *message)
+{
+	struct csky_rpmsg *rp = container_of(client, struct csky_rpmsg,
+					     client);
+
+	/*
+	 * Called in IRQ or tasklet context, but the rpmsg callbacks run
+	 * from vring_interrupt() may sleep.  Kicks that arrive while the
+	 * work is pending collapse into one pass over both vrings.
+	 */
+	schedule_work(&rp->rx_work);
+}
+
+static void csky_rpmsg_del_vqs(struct virtio_device *vdev)
+{
+	struct csky_rpmsg *rp = to_csky_rpmsg(vdev);
+	struct csky_rpmsg_vq *rvq;
+	int i;
+
+	if (loopback)
+		cancel_work_sync(&rp->loop_work);
+	else
+		cancel_work_sync(&rp->rx_work);
+
+	for (i = 0; i < CSKY_RPMSG_NR_VQS; i++) {
+		rvq = &rp->vqs[i];
+		if (!rvq->vq)
+			continue;
+
+		if (rp->table)
+			writel(0, &rp->table->vring[i]);
+		vring_del_virtqueue(rvq->vq);
+		rvq->vq = NULL;
+		dma_free_coherent(rp->dev, rvq->size, rvq->va, rvq->dma);
+	}
+}
+
+static int csky_rpmsg_find_vqs(struct virtio_device *vdev, unsigned nvqs,
+			       struct virtqueue *vqs[],
+			       vq_callback_t *callbacks[],
+			       const char * const names[])
+{
+	struct csky_rpmsg *rp = to_csky_rpmsg(vdev);
+	struct csky_rpmsg_vq *rvq;
+	int i, ret;
+
+	if (nvqs > CSKY_RPMSG_NR_VQS)
+		return -EINVAL;
+
+	for (i = 0; i < nvqs; i++) {
+		rvq = &rp->vqs[i];
+		rvq->size = PAGE_ALIGN(vring_size(rp->num, rp->align));
+		rvq->va = dma_alloc_coherent(rp->dev, rvq->size, &rvq->dma,
+					     GFP_KERNEL);
+		if (!rvq->va) {
+			ret = -ENOMEM;
+			goto err;
+		}
+		memset(rvq->va, 0, rvq->size);
+
+		/* The peer is another core, not a hypervisor: full barriers */
+		rvq->vq = vring_new_virtqueue(i, rp->num, rp->align, vdev,
+					      false, rvq->va, csky_rpmsg_notify,
+					      callbacks[i], names[i]);
+		if (!rvq->vq) {
+			dma_free_coherent(rp->dev, rvq->size, rvq->va,
+					  rvq->dma);
+			ret = -ENOMEM;
+			goto err;
+		}
+		rvq->vq->priv = rvq;
+		rvq->last_avail = 0;
+		vring_init(&rvq->vring, rp->num, rvq->va, rp->align);
+		vqs[i] = rvq->vq;
+
+		if (rp->table)
+			writel(rvq->dma, &rp->table->vring[i]);
+	}
+	rp->loop_announced = false;
+
+	return 0;
+
+err:
+	csky_rpmsg_del_vqs(vdev);
+	return ret;
+}
+
+static u8 csky_rpmsg_get_status(struct virtio_device *vdev)
+{
+	return to_csky_rpmsg(vdev)->status;
+}
+
+static void csky_rpmsg_set_status(struct virtio_device *vdev, u8 status)
+{
+	struct csky_rpmsg *rp = to_csky_rpmsg(vdev);
+
+	rp->status = status;
+	if (rp->table)
+		writel(status, &rp->table->status);
+
+	/* Tell the peer to start now that the Rx buffers are posted */
+	if (status & VIRTIO_CONFIG_S_DRIVER_OK) {
+		if (loopback)
+			schedule_work(&rp->loop_work);
+		else
+			mbox_send_message(rp->channel, &rp->kick[0]);
+	}
+}
+
+static void csky_rpmsg_reset(struct virtio_device *vdev)
+{
+	csky_rpmsg_set_status(vdev, 0);
+}
+
+static u64 csky_rpmsg_get_features(struct virtio_device *vdev)
+{
+	return BIT_ULL(CSKY_RPMSG_F_NS);
+}
+
+static int csky_rpmsg_finalize_features(struct virtio_device *vdev)
+{
+	struct csky_rpmsg *rp = to_csky_rpmsg(vdev);
+
+	vring_transport_features(vdev);
+	if (rp->table)
+		writel(lower_32_bits(vdev->features), &rp->table->features);
+
+	return 0;
+}
+
+static const struct virtio_config_ops csky_rpmsg_config_ops = {
+	.get_status	   = csky_rpmsg_get_status,
+	.set_status	   = csky_rpmsg_set_status,
+	.reset		   = csky_rpmsg_reset,
+	.find_vqs	   = csky_rpmsg_find_vqs,
+	.del_vqs	   = csky_rpmsg_del_vqs,
+	.get_features	   = csky_rpmsg_get_features,
+	.finalize_features = csky_rpmsg_finalize_features,
+};
+
+/*
+ * The virtio device may outlive the platform device, so struct
+ * csky_rpmsg is freed with the last of its two devices: the vdev holds
+ * a reference on vdev_parent, which it drops on release.
+ */
+static void csky_rpmsg_vdev_release(struct device *dev)
+{
+	struct csky_rpmsg *rp = to_csky_rpmsg(dev_to_virtio(dev));
+
+	put_device(&rp->vdev_parent);
+}
+
+static void csky_rpmsg_parent_release(struct device *dev)
+{
+	kfree(container_of(dev, struct csky_rpmsg, vdev_parent));
+}
+
+static int csky_rpmsg_loop_init(struct csky_rpmsg *rp)
+{
+	struct device_node *mem;
+	struct resource res;
+	int ret;
+
+	mem = of_parse_phandle(rp->dev->of_node, "memory-region", 0);
+	if (!mem) {
+		dev_err(rp->dev, "Loopback needs a memory-region\n");
+		return -EINVAL;
+	}
+	ret = of_address_to_resource(mem, 0, &res);
+	of_node_put(mem);
+	if (ret)
+		return ret;
+
+	/* Same attributes as the coherent pool carved out of it */
+	rp->shm_phys = res.start;
+	rp->shm_size = resource_size(&res);
+	rp->shm = devm_memremap(rp->dev, res.start, rp->shm_size,
+				MEMREMAP_WC);
+	if (IS_ERR(rp->shm))
+		return PTR_ERR(rp->shm);
+
+	INIT_WORK(&rp->loop_work, csky_rpmsg_loop_work);
+
+	return 0;
+}
+
+static int csky_rpmsg_probe(struct platform_device *pdev)
+{
+	struct device_node *node = pdev->dev.of_node;
+	struct device *dev = &pdev->dev;
+	struct csky_rpmsg *rp;
+	int i, ret;
+
+	rp = kzalloc(sizeof(*rp), GFP_KERNEL);
+	if (!rp)
+		return -ENOMEM;
+
+	/* From here on put_device(&rp->vdev_parent) frees rp */
+	device_initialize(&rp->vdev_parent);
+	rp->vdev_parent.parent = dev;
+	rp->vdev_parent.release = csky_rpmsg_parent_release;
+
+	rp->dev = dev;
+	platform_set_drvdata(pdev, rp);
+
+	rp->num = CSKY_RPMSG_NUM;
+	rp->align = CSKY_RPMSG_ALIGN;
+	of_property_read_u32(node, "csky,vring-num", &rp->num);
+	of_property_read_u32(node, "csky,vring-align", &rp->align);
+	if (!is_power_of_2(rp->num) || !is_power_of_2(rp->align)) {
+		dev_err(dev, "Bad vring geometry %u/%u\n", rp->num, rp->align);
+		ret = -EINVAL;
+		goto err_put;
+	}
+
+	for (i = 0; i < CSKY_RPMSG_NR_VQS; i++) {
+		rp->vqs[i].parent = rp;
+		rp->kick[i].mssg_type = CSKY_MBOX_MSSG_DATA;
+		rp->kick[i].length = sizeof(u32);
+		memcpy(rp->kick[i].data, &i, sizeof(u32));
+	}
+
+	/* vrings and rpmsg buffers must be reachable by the peer */
+	of_reserved_mem_device_init(dev);
+
+	if (loopback) {
+		ret = csky_rpmsg_loop_init(rp);
+		if (ret)
+			goto err_mem;
+	}
+
+	rp->table = of_iomap(node, 0);
+	if (rp->table) {
+		writel(0, &rp->table->magic);
+		writel(0, &rp->table->status);
+		writel(rp->num, &rp->table->num);
+		writel(rp->align, &rp->table->align);
+		writel(0, &rp->table->vring[0]);
+		writel(0, &rp->table->vring[1]);
+		/* The rest must be visible before the magic */
+		wmb();
+		writel(CSKY_RPMSG_MAGIC, &rp->table->magic);
+	} else if (!loopback) {
+		dev_err(dev, "No vring table\n");
+		ret = -EINVAL;
+		goto err_mem;
+	}
+
+	if (!loopback) {
+		INIT_WORK(&rp->rx_work, csky_rpmsg_rx_work);
+
+		rp->client.dev		= dev;
+		rp->client.rx_callback	= csky_rpmsg_receive_message;
+		rp->client.tx_block	= false;
+		rp->client.knows_txdone = false;
+
+		rp->channel = mbox_request_channel_byname(&rp->client,
+							  "channel");
+		if (IS_ERR(rp->channel)) {
+			dev_err(dev, "Request channel failed\n");
+			ret = -EPROBE_DEFER;
+			goto err_chan;
+		}
+	}
+
+	dev_set_name(&rp->vdev_parent, "%s-vdev", dev_name(dev));
+	ret = device_add(&rp->vdev_parent);
+	if (ret)
+		goto err_parent;
+
+	rp->vdev.id.device = VIRTIO_ID_RPMSG;
+	rp->vdev.config = &csky_rpmsg_config_ops;
+	rp->vdev.dev.parent = &rp->vdev_parent;
+	rp->vdev.dev.release = csky_rpmsg_vdev_release;
+	get_device(&rp->vdev_parent);
+	ret = register_virtio_device(&rp->vdev);
+	if (ret) {
+		dev_err(dev, "Failed to register virtio device: %d\n", ret);
+		put_device(&rp->vdev.dev);
+		goto err_vdev;
+	}
+
+	dev_info(dev, "%u entry vrings%s\n", rp->num,
+		 loopback ? ", loopback" : "");
+
+	return 0;
+
+err_vdev:
+	device_del(&rp->vdev_parent);
+err_parent:
+	if (rp->channel) {
+		mbox_free_channel(rp->channel);
+		cancel_work_sync(&rp->rx_work);
+	}
+err_chan:
+	if (rp->table) {
+		writel(0, &rp->table->magic);
+		iounmap(rp->table);
+	}
+err_mem:
+	of_reserved_mem_device_release(dev);
+err_put:
+	put_device(&rp->vdev_parent);
+	return ret;
+}
+
+static int csky_rpmsg_remove(struct platform_device *pdev)
+{
+	struct csky_rpmsg *rp = platform_get_drvdata(pdev);
+
+	unregister_virtio_device(&rp->vdev);
+	if (rp->channel) {
+		mbox_free_channel(rp->channel);
+		cancel_work_sync(&rp->rx_work);
+	}
+	if (rp->table) {
+		writel(0, &rp->table->magic);
+		iounmap(rp->table);
+	}
+	of_reserved_mem_device_release(rp->dev);
+	/* rp may be gone after this */
+	device_unregister(&rp->vdev_parent);
+
+	return 0;
+}
+
+static const struct of_device_id csky_rpmsg_match[] = {
+	{ .compatible = "csky,rpmsg" },
+	{},
+};
+
+static struct platform_driver csky_rpmsg_driver = {
+	.driver = {
+		.name = DRIVER_NAME,
+		.of_match_table = csky_rpmsg_match,
+	},
+	.probe  = csky_rpmsg_probe,
+	.remove = csky_rpmsg_remove,
+};
+module_platform_driver(csky_rpmsg_driver);
+
+MODULE_DESCRIPTION("CSKY Mailbox RPMsg transport");
+MODULE_LICENSE("GPL v2");
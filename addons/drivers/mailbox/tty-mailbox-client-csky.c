@@ -38,8 +38,6 @@ static struct dentry *root_debugfs_dir;
 
 struct tty_mbox_client_csky_device {
 	struct device		*dev;
-	void __iomem		*tx_mmio;
-	void __iomem		*rx_mmio;
 	struct mbox_chan	*tx_channel;
 	struct mbox_chan	*rx_channel;
 	char			*rx_buffer;
@@ -223,13 +221,8 @@ static void tty_mbox_client_csky_receive_message(struct mbox_client *client,
 	struct mbox_message mssg;
 	uint rx_buffer_space, copy_len;
 
-	if (tdev->rx_mmio == NULL) {
-		dev_err(client->dev, "rx_mmio is NULL\n");
-		return;
-	}
-
 	spin_lock_irqsave(&tdev->lock, flags);
-	memcpy(&mssg, (struct mbox_message*)(tdev->rx_mmio), sizeof(mssg));
+	memcpy(&mssg, message, sizeof(mssg));
 	rx_buffer_space = CIRC_SPACE(tdev->rx_head,
 				     tdev->rx_tail,
 				     RX_BUF_SIZE);
@@ -266,17 +259,6 @@ static void tty_mbox_client_csky_receive_message(struct mbox_client *client,
 	spin_unlock_irqrestore(&tdev->lock, flags);
 }
 
-static void tty_mbox_client_csky_prepare_message(struct mbox_client *client,
-						 void *message)
-{
-	struct tty_mbox_client_csky_device *tdev =
-		dev_get_drvdata(client->dev);
-
-	if (tdev->tx_mmio) {
-		memcpy_toio(tdev->tx_mmio, message, MBOX_MAX_MSG_LEN);
-	}
-}
-
 static void tty_mbox_client_csky_message_sent(struct mbox_client *client,
 					      void *message, int r)
 {
@@ -304,7 +286,6 @@ tty_mbox_client_csky_request_channel(struct platform_device *pdev,
 
 	client->dev		= &pdev->dev;
 	client->rx_callback	= tty_mbox_client_csky_receive_message;
-	client->tx_prepare	= tty_mbox_client_csky_prepare_message;
 	client->tx_done		= tty_mbox_client_csky_message_sent;
 	client->tx_block	= true;
 	client->knows_txdone	= true;
@@ -322,7 +303,6 @@ tty_mbox_client_csky_request_channel(struct platform_device *pdev,
 
 static int tty_mbox_client_csky_probe(struct platform_device *pdev)
 {
-	struct device_node *node = pdev->dev.of_node;
 	struct tty_mbox_client_csky_device *tdev;
 	int ret;
 
@@ -330,9 +310,6 @@ static int tty_mbox_client_csky_probe(struct platform_device *pdev)
 	if (!tdev)
 		return -ENOMEM;
 
-	tdev->tx_mmio = of_iomap(node, 0);
-	tdev->rx_mmio = of_iomap(node, 1);
-
 	tdev->tx_channel = tty_mbox_client_csky_request_channel(pdev,
 								"channel");
 	if (!tdev->tx_channel) {
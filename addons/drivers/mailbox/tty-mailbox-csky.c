@@ -15,10 +15,12 @@
  *
  */
 
+#include <linux/debugfs.h>
 #include <linux/device.h>
 #include <linux/interrupt.h>
 #include <linux/io.h>
 #include <linux/kernel.h>
+#include <linux/kfifo.h>
 #include <linux/mailbox_client.h>
 #include <linux/module.h>
 #include <linux/of.h>
@@ -39,7 +41,24 @@
 #define TTY_MBOX_MAJOR		0	/* Let kernel decides */
 #define TTY_MBOX_MAX_CONSOLES	1	/* Only 1 supported, don't try more */
 
-#define BUF_SIZE	2048	/* This must be a power of two */
+static unsigned int tx_buf_size = 4096;
+module_param(tx_buf_size, uint, 0444);
+MODULE_PARM_DESC(tx_buf_size,
+		 "Bytes of output queued for the mailbox, rounded up to a power of two");
+
+static unsigned int rx_buf_size = 8192;
+module_param(rx_buf_size, uint, 0444);
+MODULE_PARM_DESC(rx_buf_size,
+		 "Bytes of input held for the poll loop, rounded up to a power of two");
+
+static unsigned int rx_poll_threshold = 8;
+module_param(rx_poll_threshold, uint, 0644);
+MODULE_PARM_DESC(rx_poll_threshold,
+		 "Messages per jiffy beyond which input is handled by polling");
+
+static unsigned int rx_poll_budget = 4096;
+module_param(rx_poll_budget, uint, 0644);
+MODULE_PARM_DESC(rx_poll_budget, "Bytes pushed to the tty per poll");
 
 static const struct of_device_id csky_ttym_match[];
 
@@ -52,19 +71,28 @@ struct ttym_data {
 	struct tty_port		tty_port;
 
 	bool			rx_throttle;
-	void __iomem		*tx_mmio;
-	void __iomem		*rx_mmio;
 	struct mbox_chan	*tx_channel;
 	struct mbox_chan	*rx_channel;
 	struct mbox_message	*tx_buffer;
-	char			*rx_buffer;
-	bool			tx_sent;	/* Tx message has been sent */
-
-#if 0
-	u8			buf[BUF_SIZE];	/* transmit circular buffer */
-	u8			head;		/* circular buffer head */
-	u8			tail;		/* circular buffer tail */
-#endif
+	struct kfifo		tx_fifo;	/* Output not handed to mailbox */
+	bool			tx_busy;	/* tx_buffer is being sent */
+
+	/* Input, see csky_ttym_mbox_client_receive_message() */
+	spinlock_t		rx_lock;
+	struct kfifo		rx_fifo;	/* Input not pushed to the tty */
+	struct tasklet_struct	rx_task;
+	bool			rx_polling;
+	unsigned long		rx_stamp;	/* jiffy rx_burst counts in */
+	unsigned int		rx_burst;
+
+	/* statistics */
+	u64			rx_irq_mssgs;	/* Pushed from the interrupt */
+	u64			rx_poll_mssgs;	/* Queued for the poll loop */
+	u64			rx_polls;
+	u64			rx_batches;	/* Flip buffer pushes by polls */
+	u64			rx_to_poll;	/* Switches to polling */
+	u64			rx_dropped;	/* Bytes lost to a full rx_fifo */
+	struct dentry		*debugfs;
 };
 
 static struct tty_driver *s_ttym_driver;
@@ -89,34 +117,28 @@ static void ttym_close(struct tty_struct *ttys, struct file *filp)
 }
 
 /*
- * This function is called when the tty layer has data for us send.
+ * Hand the next chunk of queued output to the mailbox unless a message
+ * is already on its way; csky_ttym_mbox_client_message_sent() calls us
+ * again once it is.
  */
-static int ttym_write(struct tty_struct *ttys, const unsigned char *s,
-		      int count)
+static void ttym_tx_kick(struct ttym_data *ttymd)
 {
-	struct ttym_data *ttymd = ttys->driver_data;
-	uint copy_len;
-	uint written = 0;
+	unsigned long flags;
+	uint len;
 	int ret;
 
-	if (!ttymd->tx_channel) {
-		dev_err(ttymd->dev, "Channel cannot do Tx\n");
-		return -EINVAL;
-	}
-
-	if (!ttymd->tx_sent) {
-		dev_warn(ttymd->dev, "Tx message has not sent yet\n");
-		return 0;
+	spin_lock_irqsave(&ttymd->lock, flags);
+	if (ttymd->tx_busy || kfifo_is_empty(&ttymd->tx_fifo)) {
+		spin_unlock_irqrestore(&ttymd->lock, flags);
+		return;
 	}
 
-	written = (count <= CSKY_MBOX_MAX_DATA_LENGTH) ?
-		count : CSKY_MBOX_MAX_DATA_LENGTH;
-
+	len = kfifo_out(&ttymd->tx_fifo, ttymd->tx_buffer->data,
+			CSKY_MBOX_MAX_DATA_LENGTH);
 	ttymd->tx_buffer->mssg_type = CSKY_MBOX_MSSG_DATA;
-	ttymd->tx_buffer->length = written;	/* Payload len without head */
-	/* Align copy_len with 4, because IO only accept 4Bytes aligned data */
-	copy_len = (MBOX_CSKY_MSSG_HEAD_LENGTH + written + 3) & 0xFFFFFFFC;
-	memcpy(ttymd->tx_buffer->data, s, copy_len);
+	ttymd->tx_buffer->length = len;	/* Payload len without head */
+	ttymd->tx_busy = true;
+	spin_unlock_irqrestore(&ttymd->lock, flags);
 
 #ifdef DEBUG
 	print_hex_dump_bytes("Client: Sending: Message: ",
@@ -124,30 +146,95 @@ static int ttym_write(struct tty_struct *ttys, const unsigned char *s,
 #endif
 
 	ret = mbox_send_message(ttymd->tx_channel, ttymd->tx_buffer);
-	if (ret < 0)
+	if (ret < 0) {
 		dev_err(ttymd->dev, "Failed to send message via mailbox\n");
+		ttymd->tx_busy = false;
+	}
+}
 
-	return ret < 0 ? ret : written;
+/*
+ * This function is called when the tty layer has data for us send.
+ */
+static int ttym_write(struct tty_struct *ttys, const unsigned char *s,
+		      int count)
+{
+	struct ttym_data *ttymd = ttys->driver_data;
+	unsigned long flags;
+	int written;
+
+	if (!ttymd->tx_channel) {
+		dev_err(ttymd->dev, "Channel cannot do Tx\n");
+		return -EINVAL;
+	}
+
+	spin_lock_irqsave(&ttymd->lock, flags);
+	written = kfifo_in(&ttymd->tx_fifo, s, count);
+	spin_unlock_irqrestore(&ttymd->lock, flags);
+
+	ttym_tx_kick(ttymd);
+
+	return written;
 }
 
 static int ttym_write_room(struct tty_struct *ttys)
 {
 	struct ttym_data *ttymd = ttys->driver_data;
-	int count = ttymd->tx_sent ? CSKY_MBOX_MAX_DATA_LENGTH : 0;
+
+	return kfifo_avail(&ttymd->tx_fifo);
+}
+
+static int ttym_chars_in_buffer(struct tty_struct *ttys)
+{
+	struct ttym_data *ttymd = ttys->driver_data;
+	unsigned long flags;
+	int count;
+
+	spin_lock_irqsave(&ttymd->lock, flags);
+	count = kfifo_len(&ttymd->tx_fifo);
+	if (ttymd->tx_busy)
+		count += ttymd->tx_buffer->length;
+	spin_unlock_irqrestore(&ttymd->lock, flags);
 
 	return count;
 }
 
+static void ttym_flush_buffer(struct tty_struct *ttys)
+{
+	struct ttym_data *ttymd = ttys->driver_data;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ttymd->lock, flags);
+	kfifo_reset(&ttymd->tx_fifo);
+	spin_unlock_irqrestore(&ttymd->lock, flags);
+
+	tty_wakeup(ttys);
+}
+
 static void ttym_throttle(struct tty_struct *ttys)
 {
 	struct ttym_data *ttymd = ttys->driver_data;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ttymd->rx_lock, flags);
 	ttymd->rx_throttle = true;
+	spin_unlock_irqrestore(&ttymd->rx_lock, flags);
 }
 
 static void ttym_unthrottle(struct tty_struct *ttys)
 {
 	struct ttym_data *ttymd = ttys->driver_data;
+	unsigned long flags;
+	bool poll;
+
+	spin_lock_irqsave(&ttymd->rx_lock, flags);
 	ttymd->rx_throttle = false;
+	poll = !kfifo_is_empty(&ttymd->rx_fifo);
+	if (poll)
+		ttymd->rx_polling = true;
+	spin_unlock_irqrestore(&ttymd->rx_lock, flags);
+
+	if (poll)
+		tasklet_schedule(&ttymd->rx_task);
 }
 
 static void ttym_hangup(struct tty_struct *ttys)
@@ -159,73 +246,129 @@ static void ttym_hangup(struct tty_struct *ttys)
 /*
  * TTY driver operations
  *
- * If we could ask the hypervisor how much data is still in the TX buffer, or
- * at least how big the TX buffers are, then we could implement the
- * .wait_until_sent and .chars_in_buffer functions.
+ * Output is queued in tx_fifo and sent one mailbox message at a time, so
+ * .chars_in_buffer covers both and the default .wait_until_sent works.
  */
 static const struct tty_operations ttym_ops = {
 	.open		= ttym_open,
 	.close		= ttym_close,
 	.write		= ttym_write,
 	.write_room	= ttym_write_room,
+	.chars_in_buffer = ttym_chars_in_buffer,
+	.flush_buffer	= ttym_flush_buffer,
 	.throttle	= ttym_throttle,
 	.unthrottle	= ttym_unthrottle,
 	.hangup		= ttym_hangup,
 };
 
-static void csky_ttym_mbox_client_receive_message(struct mbox_client *client,
-						  void *message)
+/*
+ * Push a batch of queued input to the tty, pulling in whatever the
+ * controller already holds first.  Stays scheduled while input keeps
+ * coming and hands back to the interrupt path once it runs dry.
+ */
+static void csky_ttym_rx_poll(unsigned long data)
 {
-	struct ttym_data *ttymd = dev_get_drvdata(client->dev);
-	if (ttymd == NULL) {
+	struct ttym_data *ttymd = (struct ttym_data *)data;
+	struct tty_port *port = &ttymd->tty_port;
+	unsigned char *p;
+	unsigned long flags;
+	uint len = 0;
+	bool busy, more;
+
+	ttymd->rx_polls++;
+
+	busy = mbox_client_peek_data(ttymd->rx_channel);
+
+	/*
+	 * The flip buffer has a single producer: while rx_polling is set
+	 * that is us, so it is only cleared once our batch is pushed.
+	 */
+	spin_lock_irqsave(&ttymd->rx_lock, flags);
+	if (!ttymd->rx_polling) {
+		/* Scheduled again before a previous run handed back */
+		spin_unlock_irqrestore(&ttymd->rx_lock, flags);
 		return;
 	}
-	struct mbox_message *mssg = (struct mbox_message *)ttymd->rx_buffer;
-	int count, ret;
-	ulong flags;
-
-	if (ttymd->rx_throttle) {
-		return;
+	if (!ttymd->rx_throttle) {
+		len = min(kfifo_len(&ttymd->rx_fifo), rx_poll_budget);
+		if (len)
+			len = tty_prepare_flip_string(port, &p, len);
+		if (len)
+			len = kfifo_out(&ttymd->rx_fifo, p, len);
 	}
+	spin_unlock_irqrestore(&ttymd->rx_lock, flags);
 
-	if (ttymd->rx_mmio == NULL) {
-		dev_err(client->dev, "rx_mmio is NULL\n");
-		return;
+	if (len) {
+		ttymd->rx_batches++;
+		tty_flip_buffer_push(port);
 	}
 
-	spin_lock_irqsave(&ttymd->lock, flags);
-	memcpy_fromio(ttymd->rx_buffer, ttymd->rx_mmio, MBOX_MAX_MSG_LEN);
-	spin_unlock_irqrestore(&ttymd->lock, flags);
+	spin_lock_irqsave(&ttymd->rx_lock, flags);
+	if (kfifo_is_empty(&ttymd->rx_fifo) && !busy)
+		ttymd->rx_polling = false;
+	more = ttymd->rx_polling && !ttymd->rx_throttle;
+	spin_unlock_irqrestore(&ttymd->rx_lock, flags);
+
+	if (more)
+		tasklet_schedule(&ttymd->rx_task);
+}
 
+/*
+ * A quiet line pushes each message to the tty straight from here.  Once
+ * more than rx_poll_threshold messages arrive within a jiffy, messages
+ * are only queued and csky_ttym_rx_poll() pushes them in batches.
+ */
+static void csky_ttym_mbox_client_receive_message(struct mbox_client *client,
+						  void *message)
+{
+	struct ttym_data *ttymd = dev_get_drvdata(client->dev);
+	struct mbox_message *mssg = message;
+	uint len, queued;
+	ulong flags;
+	bool poll;
+
+	if (ttymd == NULL) {
+		return;
+	}
 
 #ifdef DEBUG
 	print_hex_dump_bytes("Client: Received: ", DUMP_PREFIX_ADDRESS,
-			     ttymd->rx_buffer, MBOX_MAX_MSG_LEN);
+			     mssg, MBOX_MAX_MSG_LEN);
 #endif
 
-	count = tty_buffer_request_room(&ttymd->tty_port, mssg->length);
-	if (count != mssg->length) {
-		dev_err(client->dev, "tty buffer request %dB room failed\n",
-			mssg->length);
-		return;
+	len = min_t(uint, mssg->length, CSKY_MBOX_MAX_DATA_LENGTH);
+
+	spin_lock_irqsave(&ttymd->rx_lock, flags);
+	if (ttymd->rx_stamp != jiffies) {
+		ttymd->rx_stamp = jiffies;
+		ttymd->rx_burst = 0;
 	}
-	ret = tty_insert_flip_string(&ttymd->tty_port, mssg->data, count);
-	if (ret != count) {
-		dev_err(client->dev, "Insert %dB but copied %dB\n",
-			count, ret);
+	if (++ttymd->rx_burst > rx_poll_threshold && !ttymd->rx_polling) {
+		ttymd->rx_polling = true;
+		ttymd->rx_to_poll++;
 	}
 
-	tty_flip_buffer_push(&ttymd->tty_port);
-}
+	/*
+	 * The flip buffer is only ours while rx_polling is clear, and only
+	 * as long as rx_lock keeps csky_ttym_rx_poll() from taking over.
+	 */
+	if (!ttymd->rx_polling && !ttymd->rx_throttle &&
+	    kfifo_is_empty(&ttymd->rx_fifo)) {
+		ttymd->rx_irq_mssgs++;
+		tty_insert_flip_string(&ttymd->tty_port, mssg->data, len);
+		tty_flip_buffer_push(&ttymd->tty_port);
+		spin_unlock_irqrestore(&ttymd->rx_lock, flags);
+		return;
+	}
 
-static void csky_ttym_mbox_client_prepare_message(struct mbox_client *client,
-						  void *message)
-{
-	struct ttym_data *ttymd = dev_get_drvdata(client->dev);
+	queued = kfifo_in(&ttymd->rx_fifo, mssg->data, len);
+	ttymd->rx_dropped += len - queued;
+	ttymd->rx_poll_mssgs++;
+	poll = ttymd->rx_polling && !ttymd->rx_throttle;
+	spin_unlock_irqrestore(&ttymd->rx_lock, flags);
 
-	if (ttymd->tx_mmio) {
-		memcpy_toio(ttymd->tx_mmio, message, MBOX_MAX_MSG_LEN);
-	}
+	if (poll)
+		tasklet_schedule(&ttymd->rx_task);
 }
 
 static void csky_ttym_mbox_client_message_sent(struct mbox_client *client,
@@ -241,7 +384,8 @@ static void csky_ttym_mbox_client_message_sent(struct mbox_client *client,
 		dev_info(client->dev, "Client: Message sent\n");
 #endif
 	}
-	ttymd->tx_sent = true;	/* Set to be true anyway */
+	ttymd->tx_busy = false;	/* Set to be false anyway */
+	ttym_tx_kick(ttymd);
 	tty_port_tty_wakeup(&ttymd->tty_port);
 }
 
@@ -258,11 +402,9 @@ csky_ttym_mbox_client_request_channel(struct platform_device *pdev,
 
 	client->dev		= &pdev->dev;
 	client->rx_callback	= csky_ttym_mbox_client_receive_message;
-	client->tx_prepare	= csky_ttym_mbox_client_prepare_message;
 	client->tx_done		= csky_ttym_mbox_client_message_sent;
-	client->tx_block	= true;
-	client->knows_txdone	= true;
-	client->tx_tout		= 1000;
+	client->tx_block	= false;	/* Sent from atomic context */
+	client->knows_txdone	= false;
 
 	channel = mbox_request_channel_byname(client, name);
 	if (IS_ERR(channel)) {
@@ -299,6 +441,11 @@ static void csky_ttym_port_shutdown(struct tty_port *port)
 {
 	struct ttym_data *ttymd = container_of(port,
 					       struct ttym_data, tty_port);
+	unsigned long flags;
+
+	spin_lock_irqsave(&ttymd->lock, flags);
+	kfifo_reset(&ttymd->tx_fifo);
+	spin_unlock_irqrestore(&ttymd->lock, flags);
 	dev_info(ttymd->dev, "ttym port shutdown\n");
 }
 
@@ -307,9 +454,31 @@ static const struct tty_port_operations csky_ttym_port_ops = {
 	.shutdown = csky_ttym_port_shutdown,
 };
 
+static void csky_ttym_add_debugfs(struct ttym_data *ttymd)
+{
+	if (!debugfs_initialized())
+		return;
+
+	ttymd->debugfs = debugfs_create_dir(TTY_MBOX_DRIVER_NAME, NULL);
+	if (!ttymd->debugfs)
+		return;
+
+	debugfs_create_u64("rx_irq_messages", 0400, ttymd->debugfs,
+			   &ttymd->rx_irq_mssgs);
+	debugfs_create_u64("rx_poll_messages", 0400, ttymd->debugfs,
+			   &ttymd->rx_poll_mssgs);
+	debugfs_create_u64("rx_polls", 0400, ttymd->debugfs,
+			   &ttymd->rx_polls);
+	debugfs_create_u64("rx_batches", 0400, ttymd->debugfs,
+			   &ttymd->rx_batches);
+	debugfs_create_u64("rx_to_poll", 0400, ttymd->debugfs,
+			   &ttymd->rx_to_poll);
+	debugfs_create_u64("rx_dropped", 0400, ttymd->debugfs,
+			   &ttymd->rx_dropped);
+}
+
 static int csky_ttym_probe(struct platform_device *pdev)
 {
-	struct device_node *node = pdev->dev.of_node;
 	struct device *dev = &pdev->dev;
 	struct device_node *np;
 	uint count = 0;
@@ -347,12 +516,13 @@ static int csky_ttym_probe(struct platform_device *pdev)
 		goto error;
 	}
 
-	s_ttym_data->rx_buffer = devm_kzalloc(&pdev->dev,
-					      MBOX_MAX_MSG_LEN, GFP_KERNEL);
-	if (!s_ttym_data->rx_buffer) {
-		ret = -ENOMEM;
+	ret = kfifo_alloc(&s_ttym_data->tx_fifo, tx_buf_size, GFP_KERNEL);
+	if (ret)
+		goto error;
+
+	ret = kfifo_alloc(&s_ttym_data->rx_fifo, rx_buf_size, GFP_KERNEL);
+	if (ret)
 		goto error;
-	}
 
 	/* Initialize the tty driver */
 	s_ttym_driver->owner = THIS_MODULE;
@@ -373,6 +543,9 @@ static int csky_ttym_probe(struct platform_device *pdev)
 
 	/* Initialize the s_ttym_data */
 	spin_lock_init(&s_ttym_data->lock);
+	spin_lock_init(&s_ttym_data->rx_lock);
+	tasklet_init(&s_ttym_data->rx_task, csky_ttym_rx_poll,
+		     (unsigned long)s_ttym_data);
 	mutex_init(&s_ttym_data->mtx);
 	s_ttym_data->tty_driver = s_ttym_driver;
 
@@ -387,8 +560,6 @@ static int csky_ttym_probe(struct platform_device *pdev)
 	}
 
 	s_ttym_data->rx_throttle = false;
-	s_ttym_data->tx_mmio = of_iomap(node, 0);
-	s_ttym_data->rx_mmio = of_iomap(node, 1);
 	s_ttym_data->tx_channel =
 		csky_ttym_mbox_client_request_channel(pdev, "channel");
 	if (!s_ttym_data->tx_channel) {
@@ -397,9 +568,10 @@ static int csky_ttym_probe(struct platform_device *pdev)
 	}
 	/* In fact, rx_channel is same with tx_channel in C-SKY's mailbox */
 	s_ttym_data->rx_channel = s_ttym_data->tx_channel;
-	s_ttym_data->tx_sent = true;
+	s_ttym_data->tx_busy = false;
 
 	dev_set_drvdata(&pdev->dev, s_ttym_data);
+	csky_ttym_add_debugfs(s_ttym_data);
 
 	dev_info(dev, "tty based on mailbox enabled\n");
 	return 0;
@@ -411,8 +583,9 @@ error:
 	}
 
 	tty_port_destroy(&s_ttym_data->tty_port);
+	kfifo_free(&s_ttym_data->tx_fifo);
+	kfifo_free(&s_ttym_data->rx_fifo);
 	devm_kfree(&pdev->dev, s_ttym_data->tx_buffer);
-	devm_kfree(&pdev->dev, s_ttym_data->rx_buffer);
 	devm_kfree(&pdev->dev, s_ttym_data);
 	s_ttym_data = NULL;
 
@@ -423,6 +596,8 @@ static int csky_ttym_remove(struct platform_device *pdev)
 {
 	struct device *dev = &pdev->dev;
 
+	debugfs_remove_recursive(s_ttym_data->debugfs);
+	tasklet_kill(&s_ttym_data->rx_task);
 	tty_unregister_device(s_ttym_driver, 0);
 	tty_unregister_driver(s_ttym_driver);
 	put_tty_driver(s_ttym_driver);
@@ -430,6 +605,8 @@ static int csky_ttym_remove(struct platform_device *pdev)
 	if(s_ttym_data->tty_port.count)
 		csky_ttym_port_shutdown(&s_ttym_data->tty_port);
 	tty_port_destroy(&s_ttym_data->tty_port);
+	kfifo_free(&s_ttym_data->tx_fifo);
+	kfifo_free(&s_ttym_data->rx_fifo);
 	kfree(s_ttym_data);
 	s_ttym_data = NULL;
 
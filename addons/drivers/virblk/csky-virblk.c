@@ -18,76 +18,122 @@
 #include <linux/clk.h>
 #include <linux/module.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/highmem.h>
 #include <linux/io.h>
 #include <linux/of_device.h>
+#include <linux/pfn_t.h>
 #include <linux/platform_device.h>
 #include <linux/regmap.h>
 
 #define SIMP_BLKDEV_MAJOR	82
 #define VIRT_DISK_NAME		"virblk"
+#define VIRBLK_QUEUE_DEPTH	128
 
 struct virblk_dev {
 	struct device *dev;
 	void __iomem *virt_base;
+	phys_addr_t phys_base;
 	size_t virt_size;
+	bool dax;
 
 	struct clk *clk;
+	struct blk_mq_tag_set tag_set;
 };
 
 static struct request_queue *simp_blkdev_queue;
 static struct gendisk *simp_blkdev_disk;
 
-static void simp_blkdev_do_request(struct request_queue *q)
+static int virblk_transfer(struct virblk_dev *virblk, struct request *req)
 {
-	struct request *req;
 	struct req_iterator ri;
 	struct bio_vec bvec;
 	char *disk_mem;
 	char *buffer;
+	bool write = rq_data_dir(req) == WRITE;
+
+	if ((blk_rq_pos(req) << 9) + blk_rq_bytes(req) > virblk->virt_size) {
+		dev_err_ratelimited(virblk->dev,
+				    "bad request: block = %llu, count=%u\n",
+				    (unsigned long long)blk_rq_pos(req),
+				    blk_rq_bytes(req));
+		return -EIO;
+	}
 
-	while ((req = blk_fetch_request(q)) != NULL) {
-		struct virblk_dev *virblk = q->queuedata;
-		if ((blk_rq_pos(req) << 9) + blk_rq_cur_bytes(req) > virblk->virt_size) {
-			printk("bad request: block = %llu, count=%u\n",
-				(unsigned long long)blk_rq_pos(req),
-				blk_rq_cur_bytes(req));
-			blk_end_request_all(req, -EIO);
-			continue;
-		}
-
-		disk_mem = virblk->virt_base + (blk_rq_pos(req) << 9);
-
-		switch (rq_data_dir(req)) {
-		case READ:
-			printk("read: %lld, %u\n", req->__sector, req->__data_len);
-			rq_for_each_segment(bvec, req, ri) {
-				buffer = kmap(bvec.bv_page) + bvec.bv_offset;
-				memcpy(buffer, disk_mem, bvec.bv_len);
-				kunmap(bvec.bv_page);
-				disk_mem += bvec.bv_len;
-			}
-			__blk_end_request_all(req, 0);
-			break;
-
-		case WRITE:
-			printk("write: %lld, %u\n", req->__sector, req->__data_len);
-			rq_for_each_segment(bvec, req, ri) {
-				buffer = kmap(bvec.bv_page) + bvec.bv_offset;
-				memcpy(disk_mem, buffer, bvec.bv_len);
-				kunmap(bvec.bv_page);
-				disk_mem += bvec.bv_len;
-			}
-			__blk_end_request_all(req, 0);
-			break;
-
-		default:
-			break;
-		}
+	disk_mem = virblk->virt_base + (blk_rq_pos(req) << 9);
+
+	/*
+	 * The backing store is a plain memory window, so every segment is
+	 * one memcpy. Low-memory pages are addressed directly; only highmem
+	 * pages need a (atomic, per-cpu) temporary mapping.
+	 */
+	rq_for_each_segment(bvec, req, ri) {
+		if (PageHighMem(bvec.bv_page))
+			buffer = kmap_atomic(bvec.bv_page);
+		else
+			buffer = page_address(bvec.bv_page);
+
+		if (write)
+			memcpy(disk_mem, buffer + bvec.bv_offset, bvec.bv_len);
+		else
+			memcpy(buffer + bvec.bv_offset, disk_mem, bvec.bv_len);
+
+		if (PageHighMem(bvec.bv_page))
+			kunmap_atomic(buffer);
+		disk_mem += bvec.bv_len;
 	}
+
+	return 0;
+}
+
+static int simp_blkdev_queue_rq(struct blk_mq_hw_ctx *hctx,
+				const struct blk_mq_queue_data *bd)
+{
+	struct request *req = bd->rq;
+	int err;
+
+	blk_mq_start_request(req);
+
+	/* The copy is synchronous, so the request ends right here */
+	if (req_op(req) != REQ_OP_READ && req_op(req) != REQ_OP_WRITE)
+		err = -EIO;
+	else
+		err = virblk_transfer(hctx->queue->queuedata, req);
+
+	blk_mq_end_request(req, err);
+
+	return BLK_MQ_RQ_QUEUE_OK;
 }
 
+static struct blk_mq_ops simp_blkdev_mq_ops = {
+	.queue_rq	= simp_blkdev_queue_rq,
+};
+
+#ifdef CONFIG_CSKY_VIRBLK_DAX
+static long simp_blkdev_direct_access(struct block_device *bdev,
+				      sector_t sector, void **kaddr,
+				      pfn_t *pfn, long size)
+{
+	struct virblk_dev *virblk = bdev->bd_disk->private_data;
+	resource_size_t offset = (resource_size_t)sector << 9;
+
+	if (!virblk->dax)
+		return -EOPNOTSUPP;
+	if (offset >= virblk->virt_size)
+		return -ERANGE;
+
+	*kaddr = (void __force *)virblk->virt_base + offset;
+	*pfn = phys_to_pfn_t(virblk->phys_base + offset, PFN_DEV);
+
+	return virblk->virt_size - offset;
+}
+#else
+#define simp_blkdev_direct_access NULL
+#endif
+
 struct block_device_operations simp_blkdev_fops = {
 	.owner = THIS_MODULE,
+	.direct_access = simp_blkdev_direct_access,
 };
 
 static const struct of_device_id virblk_dt_ids[] = {
@@ -122,11 +168,14 @@ static int virblk_probe(struct platform_device *pdev)
 		return -EBUSY;
 	}
 
-	if (of_property_read_bool(pdev->dev.of_node, "no-memory-wc"))
+	if (of_property_read_bool(pdev->dev.of_node, "no-memory-wc")) {
 		virblk->virt_base = devm_ioremap(virblk->dev, res->start, size);
-	else
+	} else {
 		virblk->virt_base = devm_ioremap_wc(virblk->dev, res->start, size);
+		virblk->dax = IS_ENABLED(CONFIG_CSKY_VIRBLK_DAX);
+	}
 
+	virblk->phys_base = res->start;
 	virblk->virt_size = size;
 
 	if (!virblk->virt_base)
@@ -139,12 +188,29 @@ static int virblk_probe(struct platform_device *pdev)
 	else
 		clk_prepare_enable(virblk->clk);
 
-	/* Init virtual block device */
-	simp_blkdev_queue = blk_init_queue(simp_blkdev_do_request, NULL);
-	simp_blkdev_queue->queuedata = virblk;
-	if (!simp_blkdev_queue) {
-		ret = -ENOMEM;
+	/* Init virtual block device: one hardware context per CPU */
+	virblk->tag_set.ops = &simp_blkdev_mq_ops;
+	virblk->tag_set.nr_hw_queues = nr_cpu_ids;
+	virblk->tag_set.queue_depth = VIRBLK_QUEUE_DEPTH;
+	virblk->tag_set.numa_node = NUMA_NO_NODE;
+	virblk->tag_set.flags = BLK_MQ_F_SHOULD_MERGE;
+	virblk->tag_set.driver_data = virblk;
+
+	ret = blk_mq_alloc_tag_set(&virblk->tag_set);
+	if (ret)
 		goto err_init_queue;
+
+	simp_blkdev_queue = blk_mq_init_queue(&virblk->tag_set);
+	if (IS_ERR(simp_blkdev_queue)) {
+		ret = PTR_ERR(simp_blkdev_queue);
+		goto err_mq_init_queue;
+	}
+	simp_blkdev_queue->queuedata = virblk;
+	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, simp_blkdev_queue);
+	queue_flag_clear_unlocked(QUEUE_FLAG_ADD_RANDOM, simp_blkdev_queue);
+	if (virblk->dax) {
+		blk_queue_physical_block_size(simp_blkdev_queue, PAGE_SIZE);
+		queue_flag_set_unlocked(QUEUE_FLAG_DAX, simp_blkdev_queue);
 	}
 
 	simp_blkdev_disk = alloc_disk(1);
@@ -158,9 +224,13 @@ static int virblk_probe(struct platform_device *pdev)
 	simp_blkdev_disk->first_minor = 0;
 	simp_blkdev_disk->fops = &simp_blkdev_fops;
 	simp_blkdev_disk->queue = simp_blkdev_queue;
+	simp_blkdev_disk->private_data = virblk;
 	set_capacity(simp_blkdev_disk, size >> 9);
 	add_disk(simp_blkdev_disk);
 
+	dev_info(virblk->dev, "%zu KiB at %pa, %s mode\n", size >> 10,
+		 &virblk->phys_base,
+		 virblk->dax ? "DAX" : "block copy");
 
 	platform_set_drvdata(pdev, virblk);
 
@@ -175,6 +245,8 @@ static int virblk_probe(struct platform_device *pdev)
 
 err_alloc_disk:
 	blk_cleanup_queue(simp_blkdev_queue);
+err_mq_init_queue:
+	blk_mq_free_tag_set(&virblk->tag_set);
 err_init_queue:
 
 	return ret;
@@ -188,6 +260,7 @@ static int virblk_remove(struct platform_device *pdev)
 	del_gendisk(simp_blkdev_disk);
 	put_disk(simp_blkdev_disk);
 	blk_cleanup_queue(simp_blkdev_queue);
+	blk_mq_free_tag_set(&virblk->tag_set);
 
 	if (virblk->clk)
 		clk_disable_unprepare(virblk->clk);